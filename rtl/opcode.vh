@@ -116,6 +116,10 @@ localparam  [11: 0] CSR_MVENDORID   = 12'hF11,    // Vender ID
                     CSR_MTVAL       = 12'h343,    // Machine bad address or instructions
                     CSR_MIP         = 12'h344,    // Machine interrupt pending
 
+                    CSR_MHPMEVENT3  = 12'h323,    // Machine performance-monitoring event selector 3..31
+                    CSR_MHPMCOUNTER3 = 12'hb03,   // Machine performance-monitoring counter 3..31
+                    CSR_MHPMCOUNTER3H = 12'hb83,  // upper 32-bits of performance-monitoring counter 3..31
+
                     CSR_SSTATUS     = 12'h100,    // Supervisor status register
                     CSR_SIE         = 12'h104,    // Supervisor interrupt-enable register
                     CSR_STVEC       = 12'h105,    // Supervisor trap handler base address
@@ -145,6 +149,19 @@ localparam  [31: 0] SYS_OPEN        = 32'h0031,
                     SYS_DUMP        = 32'h0088,
                     SYS_DUMP_BIN    = 32'h0099;
 
+// events of mhpmevent
+localparam  [31: 0] HPM_NONE        = 32'd0,
+                    HPM_BRANCH      = 32'd1,        // taken branches
+                    HPM_FLUSH       = 32'd2,        // pipeline flushes of the branches, jumps and traps
+                    HPM_LOAD        = 32'd3,        // loads
+                    HPM_STORE       = 32'd4,        // stores
+                    HPM_IMEM_STALL  = 32'd5,        // cycles of the instruction fetch stalls
+                    HPM_DMEM_STALL  = 32'd6,        // cycles of the load and store stalls
+                    HPM_INTERRUPT   = 32'd7,        // interrupts taken
+                    HPM_COMPRESSED  = 32'd8,        // compressed instructions
+                    HPM_MULDIV      = 32'd9,        // M extension instructions
+                    HPM_EVENTS      = 32'd10;
+
 // Exception code
 localparam  [31: 0] TRAP_INST_ALIGN = 32'h0,        // Instruction address misaligned
                     TRAP_INST_FAIL  = 32'h1,        // Instruction access fault
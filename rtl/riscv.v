@@ -26,7 +26,8 @@ module riscv #(
     parameter RV32M = 1,
     parameter RV32E = 0,
     parameter RV32B = 0,
-    parameter RV32C = 0
+    parameter RV32C = 0,
+    parameter HPMCOUNTERS = 4
 )(
     input                   clk,
     input                   resetb,
@@ -161,7 +162,14 @@ module riscv #(
     reg             [31: 0] csr_mcause;
     reg             [31: 0] csr_mtval;
 
+    reg             [63: 0] csr_mhpmcounter [3:HPMCOUNTERS+2];
+    reg             [31: 0] csr_mhpmevent [3:HPMCOUNTERS+2];
+    wire            [HPM_EVENTS-1: 0] hpm_event;
+    wire            [ 4: 0] hpm_sel;
+    wire                    hpm_csr;
+
     integer                 i;
+    integer                 n;
 
 assign if_insn              = imem_rdata;
 
@@ -860,7 +868,15 @@ end
 always @* begin
     ex_ill_csr  = 1'b0;
     ex_csr_read = 32'h0;
-    if (ex_csr && !ex_flush) begin
+    if (ex_csr && !ex_flush && hpm_csr) begin
+        if (hpm_sel < HPMCOUNTERS + 3) begin
+            case (ex_imm[11:5])
+                CSR_MHPMEVENT3[11:5]   : ex_csr_read = csr_mhpmevent[hpm_sel];
+                CSR_MHPMCOUNTER3[11:5] : ex_csr_read = csr_mhpmcounter[hpm_sel][31: 0];
+                default                : ex_csr_read = csr_mhpmcounter[hpm_sel][63:32];
+            endcase
+        end
+    end else if (ex_csr && !ex_flush) begin
         case (ex_imm[11:0])
             CSR_MVENDORID  : ex_csr_read = MVENDORID;
             CSR_MARCHID    : ex_csr_read = MARCHID;
@@ -954,6 +970,65 @@ always @(posedge clk or negedge resetb) begin
     end
 end
 
+////////////////////////////////////////////////////////////
+// Hardware performance counters
+////////////////////////////////////////////////////////////
+// mhpmcounter3.. count the event selected by mhpmevent3.., the events are
+// HPM_* of opcode.vh. The counters after HPMCOUNTERS are hardwired to zero.
+assign hpm_sel              = ex_imm[4:0];
+assign hpm_csr              = hpm_sel >= 5'd3 &&
+                              (ex_imm[11:5] == CSR_MHPMEVENT3[11:5] ||
+                               ex_imm[11:5] == CSR_MHPMCOUNTER3[11:5] ||
+                               ex_imm[11:5] == CSR_MHPMCOUNTER3H[11:5]);
+
+assign hpm_event[HPM_NONE]       = 1'b0;
+assign hpm_event[HPM_BRANCH]     = !ex_stall && ex_branch && branch_taken &&
+                                   !ex_ill_branch;
+assign hpm_event[HPM_FLUSH]      = !ex_stall && (branch_taken || ex_trap);
+assign hpm_event[HPM_LOAD]       = !ex_stall && !ex_flush && ex_mem2reg;
+assign hpm_event[HPM_STORE]      = !ex_stall && !ex_flush && ex_memwr;
+assign hpm_event[HPM_IMEM_STALL] = !imem_valid;
+assign hpm_event[HPM_DMEM_STALL] = (ex_mem2reg && !dmem_rvalid) ||
+                                   (wb_memwr && !dmem_wvalid);
+assign hpm_event[HPM_INTERRUPT]  = !ex_stall && !ex_trap_nop &&
+                                   (ex_timer_irq || ex_sw_irq || ex_interrupt);
+assign hpm_event[HPM_COMPRESSED] = 1'b0; // no RV32C instruction is decoded
+assign hpm_event[HPM_MULDIV]     = !ex_stall && !ex_flush && ex_mul;
+
+always @(posedge clk or negedge resetb) begin
+    if (!resetb) begin
+        for (n = 3; n < HPMCOUNTERS + 3; n = n + 1) begin
+            csr_mhpmcounter[n]  <= 64'h0;
+            csr_mhpmevent[n]    <= HPM_NONE;
+        end
+    end else if (!stall_r) begin
+        for (n = 3; n < HPMCOUNTERS + 3; n = n + 1) begin
+            if (!ex_stall && ex_csr_wr && !ex_flush && hpm_csr && hpm_sel == n) begin
+                case (ex_imm[11:5])
+                    CSR_MHPMEVENT3[11:5]   : begin
+                        csr_mhpmevent[n] <= !ex_alu_op[1] ? ex_csr_data : // CSRRW
+                                            !ex_alu_op[0] ? (csr_mhpmevent[n] | ex_csr_data) : // CSRRS
+                                            (csr_mhpmevent[n] & ~ex_csr_data); // CSRRC
+                    end
+                    CSR_MHPMCOUNTER3[11:5] : begin
+                        csr_mhpmcounter[n][31: 0] <= !ex_alu_op[1] ? ex_csr_data : // CSRRW
+                                                     !ex_alu_op[0] ? (csr_mhpmcounter[n][31: 0] | ex_csr_data) : // CSRRS
+                                                     (csr_mhpmcounter[n][31: 0] & ~ex_csr_data); // CSRRC
+                    end
+                    default                : begin
+                        csr_mhpmcounter[n][63:32] <= !ex_alu_op[1] ? ex_csr_data : // CSRRW
+                                                     !ex_alu_op[0] ? (csr_mhpmcounter[n][63:32] | ex_csr_data) : // CSRRS
+                                                     (csr_mhpmcounter[n][63:32] & ~ex_csr_data); // CSRRC
+                    end
+                endcase
+            end else if (pipefill == 2'b10 && csr_mhpmevent[n] < HPM_EVENTS &&
+                         hpm_event[csr_mhpmevent[n][3:0]]) begin
+                csr_mhpmcounter[n]      <= csr_mhpmcounter[n] + 1'b1;
+            end
+        end
+    end
+end
+
 ////////////////////////////////////////////////////////////
 // Register file
 ////////////////////////////////////////////////////////////
@@ -26,7 +26,8 @@ module top #(
     parameter RV32M = 1,
     parameter RV32E = 0,
     parameter RV32B = 0,
-    parameter RV32C = 0
+    parameter RV32C = 0,
+    parameter HPMCOUNTERS = 4
 )(
     input                   clk,
     input                   resetb,
@@ -115,7 +116,8 @@ end
         .RV32M (RV32M),
         .RV32E (RV32E),
         .RV32B (RV32B),
-        .RV32C (RV32C)
+        .RV32C (RV32C),
+        .HPMCOUNTERS (HPMCOUNTERS)
     ) riscv (
         .clk                (clk),
         .resetb             (resetb),
@@ -0,0 +1,140 @@
+// Lockstep co-simulation with rvsim
+//
+// The testbench calls cosim_retire() through DPI at each retired
+// instruction, the same condition as the line of trace.log. The ISS runs
+// to its next retired instruction and both are compared, so the first
+// mismatch is found without writing and comparing the trace logs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../tools/librvsim.h"
+
+#ifdef RV32E_ENABLED
+#define REGNUM 16
+#else
+#define REGNUM 32
+#endif
+
+extern "C" {
+    int cosim_retire(int cycle, int pc, int insn, int kind, int rd,
+                     int addr, int data);
+}
+
+static struct rv *iss = NULL;
+static long long retired = 0;
+
+static const char *kindname[] = { "-", "reg", "read", "write" };
+
+static const char *regname[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0(fp)", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+bool cosim_init(const char *file, const char *platform)
+{
+    srv32_config cfg;
+
+    srv32_config_default(&cfg);
+    cfg.mem_base = 0;
+    cfg.mem_size = MEMSIZE * 1024 * 2;
+    cfg.platform = platform;
+    cfg.spin     = false;
+    cfg.quiet    = true;
+    // the console output is printed by the testbench
+    cfg.outfile  = "/dev/null";
+    cfg.dumpfile = "/dev/null";
+    #ifdef SINGLE_RAM
+    cfg.singleram = true;
+    #endif
+
+    if ((iss = srv32_create(&cfg)) == NULL)
+        return false;
+
+    if (!srv32_load(iss, file)) {
+        printf("Can not read elf file %s\n", file);
+        srv32_destroy(iss);
+        iss = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void cosim_final(void)
+{
+    if (iss) {
+        printf("Co-simulation: %lld instructions are matched\n", retired);
+        srv32_destroy(iss);
+        iss = NULL;
+    }
+}
+
+static void dump_retired(const char *name, const srv32_retired *r)
+{
+    printf("%-4s %10u %08x %08x %-5s", name, r->cycle, r->pc, r->inst,
+           r->kind >= 0 && r->kind <= 3 ? kindname[r->kind] : "?");
+    if (r->kind == SRV32_RETIRE_READ || r->kind == SRV32_RETIRE_WRITE)
+        printf(" 0x%08x", r->addr);
+    if (r->kind == SRV32_RETIRE_REG || r->kind == SRV32_RETIRE_READ)
+        printf(" x%02d (%s)", r->rd & 31, regname[r->rd & 31]);
+    if (r->kind != SRV32_RETIRE_NONE)
+        printf(" <= 0x%08x", r->data);
+    printf("\n");
+}
+
+// Returns 0 if the ISS retires the same instruction, otherwise the states
+// are printed and the testbench stops the simulation.
+int cosim_retire(int cycle, int pc, int insn, int kind, int rd,
+                 int addr, int data)
+{
+    srv32_retired rtl, ref;
+    srv32_stat stat;
+    int result;
+    int i;
+
+    if (!iss)
+        return 0;
+
+    rtl.cycle = cycle;
+    rtl.pc    = pc;
+    rtl.inst  = insn;
+    rtl.kind  = kind;
+    rtl.rd    = rd;
+    rtl.addr  = addr;
+    rtl.data  = data;
+
+    ref.kind  = -1;
+    result = srv32_retire(iss, &ref);
+
+    // the RTL retires a few more instructions after the exit
+    if (result == RV_EXIT && ref.kind < 0)
+        return 0;
+
+    if (ref.cycle == rtl.cycle && ref.pc == rtl.pc && ref.inst == rtl.inst &&
+        ref.kind == rtl.kind &&
+        (ref.kind == SRV32_RETIRE_NONE || ref.data == rtl.data) &&
+        (ref.kind == SRV32_RETIRE_NONE || ref.kind == SRV32_RETIRE_WRITE ||
+         ref.rd == rtl.rd) &&
+        (ref.kind < SRV32_RETIRE_READ || ref.addr == rtl.addr)) {
+        retired++;
+        return 0;
+    }
+
+    printf("\nCo-simulation mismatch after %lld instructions\n", retired);
+    printf("          cycle pc       inst\n");
+    dump_retired("RTL", &rtl);
+    dump_retired("ISS", &ref);
+
+    srv32_get_stat(iss, &stat);
+    printf("\nISS state: pc %08x, %lld instructions, %lld cycles\n",
+           stat.pc, stat.instret, stat.cycle);
+    for (i = 0; i < REGNUM; i++) {
+        printf("%7s: %08x", regname[i], srv32_read_regs(iss, i));
+        printf("%s", (i % 4 == 3) ? "\n" : "    ");
+    }
+
+    return 1;
+}
@@ -1,6 +1,9 @@
 #include <signal.h>
+#include <string.h>
 #include "Vriscv.h"
 #include "verilated.h"
+#include "../tools/elfloader.h"
+#include "../tools/platform.h"
 
 #define HAVE_CHRONO
 
@@ -11,32 +14,63 @@
 
 #define RESOLUTION 4
 
-extern "C"
-int elfloader(char *file, char *mem,
-              int imem_base, int dmem_base,
-              int imem_size, int dmem_size);
-
 vluint64_t main_time = 0;
 
+bool cosim_init(const char *file, const char *platform);
+void cosim_final(void);
+
 double sc_time_stamp(void)
 {
     return main_time;
 }
 
+// The RTL has the instruction RAM at 0 and the data RAM next to it, the
+// platform description of rvsim is checked against them. The RTL has no
+// wait states, read-only or other regions, the traces would differ.
+void platform_check(const char *file)
+{
+    platform p;
+    uint32_t memsize = MEMSIZE * 1024;
+    int i;
+
+    if (!platform_read(&p, file))
+        exit(1);
+
+    for(i = 0; i < p.nregions; i++) {
+        const platform_region *r = &p.region[i];
+
+        if ((!strcmp(r->name, "iram") && (r->base != 0 || r->size != memsize)) ||
+            (!strcmp(r->name, "dram") && (r->base != memsize || r->size != memsize))) {
+            printf("Error: region %s does not match the RTL memory\n", r->name);
+            exit(1);
+        }
+
+        if ((strcmp(r->name, "iram") && strcmp(r->name, "dram")) ||
+            r->latency || r->readonly) {
+            printf("Error: region %s is not modeled by the RTL\n", r->name);
+            exit(1);
+        }
+    }
+}
+
 void elfread(char *filename)
 {
     FILE *fp;
     char *mem;
+    elf_file *elf;
     int memsize = MEMSIZE * 1024;
 
-    if ((mem = (char*)malloc(memsize*2)) == NULL) {
+    // the instruction memory is followed by the data memory
+    if ((mem = (char*)calloc(memsize*2, 1)) == NULL) {
         printf("memory allocate failure\n");
         exit(1);
     }
-    if (elfloader(filename, (char*)mem, 0, memsize, memsize, memsize) == 0) {
+    if ((elf = elf_open(filename)) == NULL ||
+        !elf_load(elf, mem, 0, memsize*2)) {
         printf("Can not read elf file %s\n", filename);
         exit(1);
     }
+    elf_close(elf);
 
     if ((fp = fopen("imem.bin", "wb")) == NULL) {
         printf("file imem.bin creates fail\n");
@@ -75,6 +109,8 @@ void finish(int dummy)
 int main(int argc, char** argv)
 {
     int elf_loaded = 0;
+    int cosim = 0;
+    const char *platform = NULL;
     Verilated::commandArgs(argc,argv);
     Verilated::traceEverOn(true);
 
@@ -84,9 +120,22 @@ int main(int argc, char** argv)
 
     signal(SIGINT, finish);
 
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "+platform=", sizeof("+platform=")-1)) {
+            platform = argv[i] + sizeof("+platform=")-1;
+            platform_check(platform);
+        }
+        if (!strcmp(argv[i], "+cosim"))
+            cosim = 1;
+    }
+
     if (argc >= 2 && argv[argc-1][0] != '+' && argv[argc-1][0] != '-') {
         elfread(argv[argc-1]);
         elf_loaded = 1;
+
+        // rvsim runs the same program, see cosim.cpp
+        if (cosim && !cosim_init(argv[argc-1], platform))
+            exit(1);
     }
 
     Vriscv *top = new Vriscv;
@@ -137,6 +186,8 @@ int main(int argc, char** argv)
     VerilatedCov::write("coverage.dat");
     #endif
 
+    cosim_final();
+
     top->final();
     delete top;
 
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rvconfig.h"
+
+#define N 64
+
+volatile int buf[N];
+volatile int counter[2][4];
+
+// The counters are read into registers and stored, so they are in the trace
+// log. It is not in the RTL regression yet, the events of the RTL and ISS
+// are defined differently, see the hardware performance counters of the
+// top README.
+static void clear_counters(void) {
+    CSRW_MHPMCOUNTER3(0); CSRW_MHPMCOUNTER3H(0);
+    CSRW_MHPMCOUNTER4(0); CSRW_MHPMCOUNTER4H(0);
+    CSRW_MHPMCOUNTER5(0); CSRW_MHPMCOUNTER5H(0);
+    CSRW_MHPMCOUNTER6(0); CSRW_MHPMCOUNTER6H(0);
+}
+
+static void read_counters(volatile int *c) {
+    c[0] = CSRR_MHPMCOUNTER3();
+    c[1] = CSRR_MHPMCOUNTER4();
+    c[2] = CSRR_MHPMCOUNTER5();
+    c[3] = CSRR_MHPMCOUNTER6();
+}
+
+static int workload(void) {
+    int i, sum = 0;
+
+    for(i=0; i<N; i++)
+        buf[i] = i * 3;
+    for(i=0; i<N; i++) {
+        if (buf[i] & 1)
+            sum += buf[i] * buf[(i+1)%N];
+        else
+            sum -= buf[i] / (i+1);
+    }
+
+    return sum;
+}
+
+int main(void) {
+    int sum;
+
+    // taken branches, flushes, loads and stores
+    CSRW_MHPMEVENT3(HPM_BRANCH);
+    CSRW_MHPMEVENT4(HPM_FLUSH);
+    CSRW_MHPMEVENT5(HPM_LOAD);
+    CSRW_MHPMEVENT6(HPM_STORE);
+    clear_counters();
+    sum = workload();
+    read_counters(counter[0]);
+
+    // fetch and memory stalls, M extension instructions and interrupts
+    CSRW_MHPMEVENT3(HPM_IMEM_STALL);
+    CSRW_MHPMEVENT4(HPM_DMEM_STALL);
+    CSRW_MHPMEVENT5(HPM_MULDIV);
+    CSRW_MHPMEVENT6(HPM_INTERRUPT);
+    clear_counters();
+    sum += workload();
+    read_counters(counter[1]);
+
+    CSRW_MHPMEVENT3(HPM_NONE);
+    CSRW_MHPMEVENT4(HPM_NONE);
+    CSRW_MHPMEVENT5(HPM_NONE);
+    CSRW_MHPMEVENT6(HPM_NONE);
+
+    printf("sum = %d\n", sum);
+    printf("branch %d, flush %d, load %d, store %d\n",
+           counter[0][0], counter[0][1], counter[0][2], counter[0][3]);
+    printf("imem stall %d, dmem stall %d, muldiv %d, interrupt %d\n",
+           counter[1][0], counter[1][1], counter[1][2], counter[1][3]);
+
+    // the workload has N loads and stores at least
+    if (counter[0][2] < N || counter[0][3] < N || counter[1][2] < N) {
+        printf("HPM test failed\n");
+        return 1;
+    }
+
+    printf("HPM test passed\n");
+    return 0;
+}
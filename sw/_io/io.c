@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <unistd.h>
+#include "rvconfig.h"
 
 int main(void) {
     char c;
     printf("Enter character (enter to exit): ");
     fflush(stdout);
+    roi_begin();
     do {
         size_t ret = read(STDIN_FILENO, &c, 1);
         if (ret != 1) continue;
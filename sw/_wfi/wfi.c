@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rvconfig.h"
+
+volatile int timer_irq = 0;
+
+void user_trap_handler(void) {
+    int mcause = CSRR_MCAUSE();
+
+    // machine timer interrupt
+    if (mcause == (int)0x80000007) {
+        CSRW_MIE(CSRR_MIE() & ~(1<<7));
+        timer_irq++;
+        return;
+    }
+    if (!(mcause & 0x80000000))
+        CSRW_MEPC(CSRR_MEPC()+4);
+}
+
+int main(void) {
+    int start, cycles, pending;
+
+    // sleep until the timer interrupt is taken
+    *(volatile int*)(MTIMECMP_BASE+4) = 0;
+    *(volatile int*)(MTIMECMP_BASE)   = 32768+300;
+    *(volatile int*)(MTIME_BASE)      = 32768;
+    *(volatile int*)(MTIME_BASE+4)    = 0;
+
+    CSRW_MIE(1<<7);
+    CSRW_MSTATUS(CSRR_MSTATUS() | 1<<3);
+
+    start = CSRR_RDCYCLE();
+    while(!timer_irq) WFI();
+    cycles = CSRR_RDCYCLE() - start;
+
+    printf("WFI with mstatus.MIE set: %d interrupt, %d cycles\n", timer_irq, cycles);
+
+    // WFI wakes up on a pending interrupt even when mstatus.MIE is clear
+    CSRW_MSTATUS(CSRR_MSTATUS() & ~(1<<3));
+    *(volatile int*)(MTIME_BASE)      = 32768;
+    CSRW_MIE(1<<7);
+
+    WFI();
+    pending = (CSRR_MIP() >> 7) & 1;
+    CSRW_MIE(0);
+
+    printf("WFI with mstatus.MIE clear: %d interrupt, mip.MTIP %d\n", timer_irq, pending);
+
+    if (timer_irq != 1 || !pending) {
+        printf("WFI test failed\n");
+        return 1;
+    }
+
+    printf("WFI test passed\n");
+    return 0;
+}
@@ -44,6 +44,28 @@
 #define _CSRR_MISA()        ({ int result; __asm volatile("csrr %0, misa" : "=r"(result)); result; })
 #define _CSRW_MISA(v)       __asm volatile("csrw misa, %0" : : "r"(v))
 
+// hardware performance counters, mhpmcounter3..6 count the event of
+// mhpmevent3..6, the others are hardwired to zero
+#define HPM_COUNTERS    4
+
+#define HPM_NONE        0
+#define HPM_BRANCH      1   // taken branches
+#define HPM_FLUSH       2   // pipeline flushes of the branches, jumps and traps
+#define HPM_LOAD        3   // loads
+#define HPM_STORE       4   // stores
+#define HPM_IMEM_STALL  5   // cycles of the instruction fetch stalls
+#define HPM_DMEM_STALL  6   // cycles of the load and store stalls
+#define HPM_INTERRUPT   7   // interrupts taken
+#define HPM_COMPRESSED  8   // compressed instructions
+#define HPM_MULDIV      9   // M extension instructions
+
+#define _CSRR_MHPMCOUNTER(n)    ({ int result; __asm volatile("csrr %0, mhpmcounter" #n : "=r"(result)); result; })
+#define _CSRW_MHPMCOUNTER(n, v) __asm volatile("csrw mhpmcounter" #n ", %0" : : "r"(v))
+#define _CSRR_MHPMCOUNTERH(n)   ({ int result; __asm volatile("csrr %0, mhpmcounter" #n "h" : "=r"(result)); result; })
+#define _CSRW_MHPMCOUNTERH(n, v) __asm volatile("csrw mhpmcounter" #n "h, %0" : : "r"(v))
+#define _CSRR_MHPMEVENT(n)      ({ int result; __asm volatile("csrr %0, mhpmevent" #n : "=r"(result)); result; })
+#define _CSRW_MHPMEVENT(n, v)   __asm volatile("csrw mhpmevent" #n ", %0" : : "r"(v))
+
 // no support CSR
 #define _CSRR_DPC()         ({ int result; __asm volatile("csrr %0, dpc" : "=r"(result)); result; })
 #define _CSRW_DPC(v)        __asm volatile("csrw dpc, %0" : : "r"(v))
@@ -83,10 +105,40 @@ static inline void CSRW_MSCRATCH(int v)   { _CSRW_MSCRATCH(v); }
 static inline int  CSRR_MISA(void)        { return _CSRR_MISA(); }
 static inline void CSRW_MISA(int v)       { _CSRW_MISA(v); }
 
+static inline int  CSRR_MHPMCOUNTER3(void)  { return _CSRR_MHPMCOUNTER(3); }
+static inline void CSRW_MHPMCOUNTER3(int v) { _CSRW_MHPMCOUNTER(3, v); }
+static inline int  CSRR_MHPMCOUNTER3H(void) { return _CSRR_MHPMCOUNTERH(3); }
+static inline void CSRW_MHPMCOUNTER3H(int v) { _CSRW_MHPMCOUNTERH(3, v); }
+static inline int  CSRR_MHPMEVENT3(void)    { return _CSRR_MHPMEVENT(3); }
+static inline void CSRW_MHPMEVENT3(int v)   { _CSRW_MHPMEVENT(3, v); }
+static inline int  CSRR_MHPMCOUNTER4(void)  { return _CSRR_MHPMCOUNTER(4); }
+static inline void CSRW_MHPMCOUNTER4(int v) { _CSRW_MHPMCOUNTER(4, v); }
+static inline int  CSRR_MHPMCOUNTER4H(void) { return _CSRR_MHPMCOUNTERH(4); }
+static inline void CSRW_MHPMCOUNTER4H(int v) { _CSRW_MHPMCOUNTERH(4, v); }
+static inline int  CSRR_MHPMEVENT4(void)    { return _CSRR_MHPMEVENT(4); }
+static inline void CSRW_MHPMEVENT4(int v)   { _CSRW_MHPMEVENT(4, v); }
+static inline int  CSRR_MHPMCOUNTER5(void)  { return _CSRR_MHPMCOUNTER(5); }
+static inline void CSRW_MHPMCOUNTER5(int v) { _CSRW_MHPMCOUNTER(5, v); }
+static inline int  CSRR_MHPMCOUNTER5H(void) { return _CSRR_MHPMCOUNTERH(5); }
+static inline void CSRW_MHPMCOUNTER5H(int v) { _CSRW_MHPMCOUNTERH(5, v); }
+static inline int  CSRR_MHPMEVENT5(void)    { return _CSRR_MHPMEVENT(5); }
+static inline void CSRW_MHPMEVENT5(int v)   { _CSRW_MHPMEVENT(5, v); }
+static inline int  CSRR_MHPMCOUNTER6(void)  { return _CSRR_MHPMCOUNTER(6); }
+static inline void CSRW_MHPMCOUNTER6(int v) { _CSRW_MHPMCOUNTER(6, v); }
+static inline int  CSRR_MHPMCOUNTER6H(void) { return _CSRR_MHPMCOUNTERH(6); }
+static inline void CSRW_MHPMCOUNTER6H(int v) { _CSRW_MHPMCOUNTERH(6, v); }
+static inline int  CSRR_MHPMEVENT6(void)    { return _CSRR_MHPMEVENT(6); }
+static inline void CSRW_MHPMEVENT6(int v)   { _CSRW_MHPMEVENT(6, v); }
+
 // no support CSR
 static inline int  CSRR_DPC(void)         { return _CSRR_DPC(); }
 static inline void CSRW_DPC(int v)        { _CSRW_DPC(v); }
 
+// wait for interrupt, the core is idle until an enabled interrupt is pending
+#define _WFI()              __asm volatile("wfi")
+
+static inline void WFI(void)              { _WFI(); }
+
 #define csr_read(reg) ({ unsigned long __tmp; \
   asm volatile ("csrr %0, " #reg : "=r"(__tmp)); \
   __tmp; })
@@ -107,5 +159,8 @@ static inline void CSRW_DPC(int v)        { _CSRW_DPC(v); }
     asm volatile ("csrrw %0, " #reg ", %1" : "=r" (__v) : "rK" (__v) : "memory"); \
     __v; })
 
+// the region of interest starts, see rvsim --fanout
+void roi_begin(void);
+
 #endif // __RVCONFIG_H
 
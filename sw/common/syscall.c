@@ -25,6 +25,7 @@ enum {
     SYS_SBRK     = 0x00d6,
     SYS_DUMP     = 0x0088,
     SYS_DUMP_BIN = 0x0099,
+    SYS_ROI      = 0x00aa,
 };
 
 extern int errno;
@@ -164,6 +165,13 @@ void exit(int code) {
     _exit(code);
 }
 
+/* the region of interest starts, rvsim --fanout forks the runs here */
+void roi_begin(void) {
+#if HAVE_SYSCALL || HAVE_TOHOST
+    __internal_syscall(SYS_ROI, 0, 0, 0, 0, 0, 0, 0);
+#endif
+}
+
 int _isatty(int file)
 {
     return (file == STDIN_FILENO  ||
@@ -27,6 +27,10 @@
 
 `ifdef VERILATOR
 import "DPI-C" function byte getch();
+import "DPI-C" function int cosim_retire(input int cycle, input int pc,
+                                         input int insn, input int kind,
+                                         input int rd, input int addr,
+                                         input int data);
 `endif
 
 `ifdef SYNTHESIS
@@ -119,12 +123,15 @@ endtask
 `ifndef SYNTHESIS
 initial begin
     if ($test$plusargs("help") != 0) begin
-        $display("Usage: sim [+help] [+no-meminit] [+dump] [+trace] [prog.elf]");
+        $display("Usage: sim [+help] [+no-meminit] [+dump] [+trace] [+cosim] [prog.elf]");
         $display("");
         $display("    +help         usage help");
         $display("    +no-meminit   memory uninitialized");
         $display("    +dump         dump vcd file");
         $display("    +trace        generate trace log");
+        `ifdef VERILATOR
+        $display("    +cosim        check with rvsim in lockstep");
+        `endif
         $display("");
         $finish(0);
     end
@@ -704,6 +711,80 @@ always @(posedge clk) begin
         end
     end
 end
+
+`ifdef VERILATOR
+////////////////////////////////////////////////////////////
+// Lockstep co-simulation with rvsim (sim/cosim.cpp)
+////////////////////////////////////////////////////////////
+    integer         cosim;
+    integer         cosim_i;
+    reg     [ 1: 0] cosim_kind;
+    reg     [31: 0] cosim_addr;
+    reg     [31: 0] cosim_data;
+
+initial begin
+    cosim = $test$plusargs("cosim");
+end
+
+// the retired instruction, the same as the line of trace.log
+always @* begin
+    cosim_kind          = 2'd0;
+    cosim_addr          = 32'h0;
+    cosim_data          = 32'h0;
+    if (`TOP.wb_mem2reg && !`TOP.wb_ld_align_excp) begin
+        cosim_kind      = `TOP.wb_alu2reg ? 2'd2 : 2'd0;
+        cosim_addr      = `TOP.wb_raddress;
+        cosim_data      = `TOP.wb_rdata;
+    end else if (`TOP.wb_alu2reg) begin
+        if (!`TOP.wb_trap_nop) begin
+            cosim_kind  = 2'd1;
+            cosim_data  = `TOP.wb_result;
+        end
+    end else if (`TOP.dmem_wready) begin
+        cosim_kind      = 2'd3;
+        cosim_addr      = `TOP.dmem_waddr;
+        case(`TOP.wb_alu_op)
+            3'h0: begin
+                case (`TOP.wb_wstrb)
+                    4'b0001: cosim_data = {24'h0, `TOP.dmem_wdata[8*0+7:8*0]};
+                    4'b0010: cosim_data = {24'h0, `TOP.dmem_wdata[8*1+7:8*1]};
+                    4'b0100: cosim_data = {24'h0, `TOP.dmem_wdata[8*2+7:8*2]};
+                    4'b1000: cosim_data = {24'h0, `TOP.dmem_wdata[8*3+7:8*3]};
+                    default: cosim_kind = 2'd0;
+                endcase
+            end
+            3'h1: begin
+                if (`TOP.wb_wstrb == 4'b0011)
+                    cosim_data  = {16'h0, `TOP.dmem_wdata[15:0]};
+                else if (`TOP.wb_wstrb == 4'b1100)
+                    cosim_data  = {16'h0, `TOP.dmem_wdata[31:16]};
+                else
+                    cosim_kind  = 2'd0;
+            end
+            3'h2: cosim_data    = `TOP.dmem_wdata;
+            default: cosim_kind = 2'd0;
+        endcase
+    end
+end
+
+always @(posedge clk) begin
+    if (cosim != 0 && !`TOP.wb_stall && !`TOP.stall_r &&
+        !`TOP.wb_flush && fillcount == 2'b11) begin
+        if (cosim_retire(top.riscv.csr_cycle[31:0], `TOP.wb_pc, `TOP.wb_insn,
+                         {30'h0, cosim_kind}, {27'h0, `TOP.wb_dst_sel},
+                         cosim_addr, cosim_data) != 0) begin
+            $display("\nRTL state: pc %08x, %0d instructions, %0d cycles",
+                     `TOP.wb_pc, `TOP.csr_instret, `TOP.csr_cycle);
+            for (cosim_i = 1; cosim_i < (RV32E == 1 ? 16 : 32); cosim_i = cosim_i + 1) begin
+                $write("    x%02d: %08x", cosim_i, `TOP.regs[cosim_i]);
+                if (cosim_i % 4 == 3) $write("\n");
+            end
+            $write("\n");
+            $finish(2);
+        end
+    end
+end
+`endif // VERILATOR
 `endif // TRACE
 `endif // SYNTHESIS
 
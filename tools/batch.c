@@ -0,0 +1,411 @@
+// Copyright © 2020 Kuoping Hsu
+// batch.c: run many ELF files in parallel
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+#define MAXLEN      1024
+#define MAXARGS     64
+
+// Each line of the batch file is a test, the ELF file followed by the
+// options of the test, e.g.
+//
+//     add.elf --memsize 1716 --sig add.signature --out add.out
+//
+// The options are the same as the command line, plus --sig for the file
+// of the memory dump (the signature), and --out for the console output.
+// Empty lines and the lines starting with '#' are skipped. A test of
+// --restore runs from the checkpoint, and the ELF file is not given, e.g.
+//
+//     --restore boot.ckpt --branch 3 --out b3.out
+
+enum {
+    BATCH_EXIT = 0,         // the program is terminated
+    BATCH_FAIL = 1          // the simulator can not be created or loaded
+};
+
+typedef struct batch_test {
+    char        *line;      // copy of the line, the options point to it
+    char        *file;
+    char        *sig;
+    char        *restore;   // the checkpoint, NULL to load the file
+    srv32_config cfg;
+    int          status;
+    srv32_stat   stat;
+    double       wall;      // wall time in seconds
+} batch_test;
+
+typedef struct batch {
+    batch_test *tests;
+    int         num;
+    int         next;       // the next test to run, taken atomically
+} batch;
+
+static int batch_parse(batch_test *t, char *line, const srv32_config *defaults) {
+    char *argv[MAXARGS];
+    int argc = 0;
+    int c;
+    char *p;
+
+    const char *optstring = "b:pl:m:n:s";
+    struct option opts[] = {
+        {"branch", 1, NULL, 'b'},
+        {"predict", 0, NULL, 'p'},
+        {"log", 1, NULL, 'l'},
+        {"membase", 1, NULL, 'm'},
+        {"memsize", 1, NULL, 'n'},
+        {"single", 0, NULL, 's'},
+        {"jit", 0, NULL, 'J'},
+        {"nospin", 0, NULL, 'S'},
+        {"platform", 1, NULL, 'P'},
+        {"sig", 1, NULL, 'D'},
+        {"out", 1, NULL, 'O'},
+        {"profile", 1, NULL, 'F'},
+        {"sample", 1, NULL, 'A'},
+        {"callgraph", 1, NULL, 'G'},
+        {"stats", 1, NULL, 'X'},
+        {"restore", 1, NULL, 'E'},
+        {"record", 1, NULL, 'V'},
+        {"replay", 1, NULL, 'Y'},
+        {NULL, 0, NULL, 0}
+    };
+
+    memset(t, 0, sizeof(batch_test));
+    t->cfg = *defaults;
+
+    if ((t->line = strdup(line)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return 0;
+        // LCOV_EXCL_STOP
+    }
+
+    argv[argc++] = "rvsim";
+    for(p = strtok(t->line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n")) {
+        if (argc >= MAXARGS - 1) {
+            printf("Too many options: %s", line);
+            return 0;
+        }
+        argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    // restart getopt for each line
+    #ifdef MACOX
+    optreset = 1;
+    optind = 1;
+    #else
+    optind = 0;
+    #endif // MACOX
+
+    while((c = getopt_long(argc, argv, optstring, opts, NULL)) != -1) {
+        switch(c) {
+            case 'b':
+                t->cfg.branch_penalty = atoi(optarg);
+                break;
+            case 'p':
+                t->cfg.branch_predict = true;
+                break;
+            case 'l':
+                t->cfg.logfile = optarg;
+                break;
+            case 'm':
+                sscanf(optarg, "%i", &t->cfg.mem_base);
+                break;
+            case 'n':
+                sscanf(optarg, "%i", &t->cfg.mem_size);
+                t->cfg.mem_size *= (2*1024);
+                break;
+            case 's':
+                t->cfg.singleram = true;
+                break;
+            case 'J':
+                #ifdef JIT_ENABLED
+                t->cfg.jit = true;
+                #endif // JIT_ENABLED
+                break;
+            case 'S':
+                t->cfg.spin = false;
+                break;
+            case 'P':
+                t->cfg.platform = optarg;
+                break;
+            case 'D':
+                t->sig = strdup(optarg);
+                break;
+            case 'O':
+                t->cfg.outfile = optarg;
+                break;
+            case 'F':
+                t->cfg.profile = optarg;
+                break;
+            case 'A':
+                t->cfg.profile_period = (uint32_t)atoi(optarg);
+                break;
+            case 'G':
+                t->cfg.callgraph = optarg;
+                break;
+            case 'X':
+                t->cfg.stats = optarg;
+                break;
+            case 'E':
+                t->restore = optarg;
+                break;
+            case 'V':
+                t->cfg.record = optarg;
+                break;
+            case 'Y':
+                t->cfg.replay = optarg;
+                break;
+            default:
+                printf("Unknown option: %s", line);
+                return 0;
+        }
+    }
+
+    if (t->restore) {
+        if (optind != argc) {
+            printf("The elf file is given by the checkpoint: %s", line);
+            return 0;
+        }
+        t->file = t->restore;
+    } else if (optind != argc - 1) {
+        printf("Missing the elf file: %s", line);
+        return 0;
+    } else {
+        t->file = argv[optind];
+    }
+
+    // the signatures of the tests can not share dump.txt, the default
+    // is the name of the elf file with .signature
+    if (!t->sig && (t->sig = malloc(strlen(t->file) + sizeof(".signature"))) != NULL) {
+        size_t len = strlen(t->file);
+        if (len > 4 && strcmp(t->file + len - 4, ".elf") == 0)
+            len -= 4;
+        memcpy(t->sig, t->file, len);
+        strcpy(t->sig + len, ".signature");
+    }
+    if (!t->sig) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return 0;
+        // LCOV_EXCL_STOP
+    }
+    t->cfg.dumpfile = t->sig;
+
+    return 1;
+}
+
+static void batch_run(batch_test *t) {
+    struct timeval start, end;
+    struct rv *rv;
+
+    gettimeofday(&start, NULL);
+
+    // remove the signature of the last run
+    unlink(t->sig);
+
+    t->status = BATCH_FAIL;
+    if ((rv = srv32_create(&t->cfg)) != NULL) {
+        if (t->restore) {
+            if (srv32_checkpoint_restore(rv, t->restore)) {
+                srv32_run(rv, -1);
+                t->status = BATCH_EXIT;
+            }
+        } else if (srv32_load(rv, t->file)) {
+            srv32_run(rv, -1);
+            t->status = BATCH_EXIT;
+        } else {
+            printf("Can not read elf file %s\n", t->file);
+        }
+        srv32_get_stat(rv, &t->stat);
+        srv32_destroy(rv);
+    }
+
+    gettimeofday(&end, NULL);
+    t->wall = (double)(end.tv_sec-start.tv_sec) +
+                      (end.tv_usec-start.tv_usec)/1000000.0;
+}
+
+static void *batch_worker(void *arg) {
+    batch *b = (batch*)arg;
+    int i;
+
+    while((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->num)
+        batch_run(&b->tests[i]);
+
+    return NULL;
+}
+
+// also used by the summary of --fanout
+void json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for(; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void batch_summary(FILE *fp, batch *b, bool json) {
+    int i;
+
+    if (json)
+        fprintf(fp, "[\n");
+    else
+        fprintf(fp, "file,status,exitcode,instret,cycles,wall,signature\n");
+
+    for(i = 0; i < b->num; i++) {
+        batch_test *t = &b->tests[i];
+        const char *status = (t->status == BATCH_EXIT) ? "exit" : "fail";
+        const char *sig = (access(t->sig, F_OK) == 0) ? t->sig : "";
+
+        if (json) {
+            fprintf(fp, "  {\"file\": ");
+            json_string(fp, t->file);
+            fprintf(fp, ", \"status\": \"%s\", \"exitcode\": %d, "
+                        "\"instret\": %lld, \"cycles\": %lld, \"wall\": %.6f, "
+                        "\"signature\": ",
+                    status, t->stat.exitcode, t->stat.instret, t->stat.cycle, t->wall);
+            json_string(fp, sig);
+            fprintf(fp, "}%s\n", (i < b->num - 1) ? "," : "");
+        } else {
+            fprintf(fp, "%s,%s,%d,%lld,%lld,%.6f,%s\n",
+                    t->file, status, t->stat.exitcode,
+                    t->stat.instret, t->stat.cycle, t->wall, sig);
+        }
+    }
+
+    if (json)
+        fprintf(fp, "]\n");
+}
+
+// Run the tests of the batch file with the worker threads, and write the
+// summary in JSON if the file name ends with .json, otherwise in CSV.
+// Returns 0 if all of the tests are terminated with exit code 0.
+int srv32_batch(const char *list, int jobs, const char *summary,
+                const srv32_config *defaults) {
+    FILE *fp;
+    char line[MAXLEN];
+    batch b;
+    srv32_config cfg = *defaults;
+    pthread_t *threads;
+    int size = 0;
+    int failed = 0;
+    int i;
+
+    // the log files are given for each test
+    cfg.logfile = NULL;
+    cfg.outfile = NULL;
+    cfg.dumpfile = NULL;
+    cfg.profile = NULL;
+    cfg.callgraph = NULL;
+    cfg.stats = NULL;
+    cfg.record = NULL;
+    cfg.replay = NULL;
+
+    if ((fp = fopen(list, "r")) == NULL) {
+        printf("can not open file %s\n", list);
+        return 1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    while(fgets(line, sizeof(line), fp)) {
+        char *p = line + strspn(line, " \t\r\n");
+
+        if (*p == 0 || *p == '#')
+            continue;
+
+        if (b.num == size) {
+            size = size ? size * 2 : 64;
+            if ((b.tests = realloc(b.tests, sizeof(batch_test) * size)) == NULL) {
+                // LCOV_EXCL_START
+                printf("malloc fail\n");
+                exit(1);
+                // LCOV_EXCL_STOP
+            }
+        }
+        if (!batch_parse(&b.tests[b.num++], p, &cfg)) {
+            fclose(fp);
+            return 1;
+        }
+    }
+    fclose(fp);
+
+    if (jobs <= 0)
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > b.num)
+        jobs = b.num;
+
+    if ((threads = malloc(sizeof(pthread_t) * (jobs + 1))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+
+    for(i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &b) != 0) {
+            // LCOV_EXCL_START
+            printf("Can not create thread\n");
+            exit(1);
+            // LCOV_EXCL_STOP
+        }
+    }
+    for(i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (summary) {
+        size_t len = strlen(summary);
+        bool json = len > 5 && strcmp(summary + len - 5, ".json") == 0;
+
+        if ((fp = fopen(summary, "w")) == NULL) {
+            printf("can not open file %s\n", summary);
+            failed = 1;
+        } else {
+            batch_summary(fp, &b, json);
+            fclose(fp);
+        }
+    } else {
+        batch_summary(stdout, &b, false);
+    }
+
+    for(i = 0; i < b.num; i++) {
+        if (b.tests[i].status != BATCH_EXIT || b.tests[i].stat.exitcode != 0)
+            failed = 1;
+        free(b.tests[i].line);
+        free(b.tests[i].sig);
+    }
+    free(b.tests);
+
+    return failed;
+}
@@ -0,0 +1,162 @@
+// Copyright © 2020 Kuoping Hsu
+// breakpoint.c: breakpoints and watchpoints of the memory
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+// A breakpoint is a bit of its halfword in bp_map. The blocks end before
+// the breakpoints, so srv32_run() only tests the bit at the start of each
+// block, and runs at the speed of the blocks between them.
+//
+// A watchpoint marks its type in the pages of watch_map, and the loads and
+// stores of the marked pages check the watchpoints. The compiled blocks
+// access the memory directly, so they are compiled again without it while
+// any watchpoint is set. The hit stops srv32_run() after the instruction.
+
+bool srv32_set_breakpoint(struct rv *rv, int32_t pc) {
+    uint32_t offset = (uint32_t)(pc - rv->mem_base);
+
+    if (offset >= (uint32_t)rv->mem_size || (pc & 1))
+        return false;
+
+    if (!rv->bp_map &&
+        (rv->bp_map = (uint8_t*)calloc(rv->mem_size / 16 + 1, 1)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    rv->bp_map[offset >> 4] |= 1 << ((offset >> 1) & 7);
+
+    // the blocks are split at the breakpoint
+    srv32_flush_icache(rv, pc, 2);
+
+    return true;
+}
+
+void srv32_del_breakpoint(struct rv *rv, int32_t pc) {
+    uint32_t offset = (uint32_t)(pc - rv->mem_base);
+
+    if (!rv->bp_map || offset >= (uint32_t)rv->mem_size || (pc & 1))
+        return;
+
+    rv->bp_map[offset >> 4] &= ~(1 << ((offset >> 1) & 7));
+    srv32_flush_icache(rv, pc, 2);
+}
+
+// the types of the pages, and the compiled blocks with the fast loads and
+// stores are dropped
+static void watch_update(struct rv *rv) {
+    int i;
+
+    memset(rv->watch_map, 0, (rv->mem_size >> WATCH_PAGE_BITS) + 1);
+    for(i = 0; i < rv->nwatch; i++) {
+        const rv_watch *w = &rv->watch[i];
+        uint32_t offset = w->addr - rv->mem_base;
+        uint32_t page;
+
+        for(page = offset >> WATCH_PAGE_BITS;
+            page <= (offset + w->len - 1) >> WATCH_PAGE_BITS; page++)
+            rv->watch_map[page] |= w->type;
+    }
+
+    #ifdef JIT_ENABLED
+    if (rv->jit)
+        srv32_flush_icache(rv, rv->mem_base, ICACHE_SIZE);
+    #endif // JIT_ENABLED
+}
+
+bool srv32_set_watchpoint(struct rv *rv, int32_t addr, int32_t len, int type) {
+    uint32_t offset = (uint32_t)(addr - rv->mem_base);
+
+    if (len <= 0 || offset >= (uint32_t)rv->mem_size ||
+        (uint32_t)len > rv->mem_size - offset || rv->nwatch == WATCH_MAX ||
+        (type & ~SRV32_WATCH_ACCESS) || !type)
+        return false;
+
+    if (!rv->watch_map &&
+        (rv->watch_map = (uint8_t*)calloc((rv->mem_size >> WATCH_PAGE_BITS) + 1, 1)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    rv->watch[rv->nwatch].addr = addr;
+    rv->watch[rv->nwatch].len  = len;
+    rv->watch[rv->nwatch].type = type;
+    rv->nwatch++;
+    watch_update(rv);
+
+    return true;
+}
+
+void srv32_del_watchpoint(struct rv *rv, int32_t addr, int32_t len, int type) {
+    int i;
+
+    for(i = 0; i < rv->nwatch; i++) {
+        rv_watch *w = &rv->watch[i];
+
+        if (w->addr == (uint32_t)addr && w->len == len && w->type == type) {
+            *w = rv->watch[--rv->nwatch];
+            watch_update(rv);
+            return;
+        }
+    }
+}
+
+// the load or store of a marked page
+void srv32_watch_access(struct rv *rv, int32_t addr, int32_t len, int type) {
+    int i;
+
+    for(i = 0; i < rv->nwatch; i++) {
+        const rv_watch *w = &rv->watch[i];
+
+        if ((w->type & type) && (uint32_t)addr < w->addr + w->len &&
+            w->addr < (uint32_t)addr + len) {
+            rv->watch_hit.addr = addr;
+            rv->watch_hit.len  = len;
+            rv->watch_hit.type = type;
+            rv->watch_pc = rv->pc;
+
+            // stop after this instruction, as srv32_roi()
+            srv32_sync(rv);
+            rv->instret_limit = rv->csr.instret.c;
+            rv->block_break = 1;
+            return;
+        }
+    }
+}
+
+void srv32_breakpoint_free(struct rv *rv) {
+    free(rv->bp_map);
+    free(rv->watch_map);
+    rv->bp_map = NULL;
+    rv->watch_map = NULL;
+    rv->nwatch = 0;
+}
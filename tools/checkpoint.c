@@ -0,0 +1,372 @@
+// Copyright © 2020 Kuoping Hsu
+// checkpoint.c: save and restore the simulator state
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rvsim.h"
+
+// The checkpoint is the header, the state, and the table of the runs of
+// the memory pages, padded to a page, followed by the pages of the runs.
+// The pages of zeros are not stored, so the image is as large as the
+// memory touched by the program. The pages are mapped from the file copy
+// on write at restore, which costs nothing until the program touches them.
+//
+// The ELF file is only kept by its path for the symbols. The timing
+// options (branch penalty, single RAM, prediction, wait states) are taken
+// from the configuration of the restore, so the runs of a sweep can share
+// one checkpoint. The host files opened by the program are not saved.
+
+#define CKPT_MAGIC      "SRV32CKP"
+#define CKPT_VERSION    1
+#define CKPT_PAGE       4096
+
+// the instruction sets of the build, the checkpoint only restores to the same
+#define CKPT_RV32C      (1<<0)
+#define CKPT_RV32E      (1<<1)
+#define CKPT_RV32B      (1<<2)
+
+typedef struct ckpt_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;         // CKPT_RV32*
+    uint32_t state_size;    // sizeof(rv_state), differs by the build
+    int32_t  mem_base;
+    int32_t  mem_size;
+    uint32_t nruns;
+    char     elf[PATH_MAX];
+} ckpt_header;
+
+// a run of the pages having data
+typedef struct ckpt_run {
+    uint32_t first;
+    uint32_t count;
+} ckpt_run;
+
+static uint32_t ckpt_flags(void) {
+    uint32_t flags = 0;
+
+    #ifdef RV32C_ENABLED
+    flags |= CKPT_RV32C;
+    #endif // RV32C_ENABLED
+    #ifdef RV32E_ENABLED
+    flags |= CKPT_RV32E;
+    #endif // RV32E_ENABLED
+    #ifdef RV32B_ENABLED
+    flags |= CKPT_RV32B;
+    #endif // RV32B_ENABLED
+    return flags;
+}
+
+static bool page_is_zero(const uint64_t *p, size_t len) {
+    size_t i;
+    uint64_t v = 0;
+
+    for(i = 0; i < len / sizeof(uint64_t); i++)
+        v |= p[i];
+    return v == 0;
+}
+
+static size_t ckpt_data_offset(uint32_t nruns) {
+    size_t size = sizeof(ckpt_header) + sizeof(rv_state) +
+                  sizeof(ckpt_run) * nruns;
+    return (size + CKPT_PAGE - 1) & ~(size_t)(CKPT_PAGE - 1);
+}
+
+// the length of the pages from the page first, the last page may be cut
+// by the end of the memory
+static size_t ckpt_run_len(struct rv *rv, uint32_t first, uint32_t count) {
+    size_t len = (size_t)count * CKPT_PAGE;
+
+    if ((size_t)first * CKPT_PAGE + len > (size_t)rv->mem_size)
+        len = (size_t)rv->mem_size - (size_t)first * CKPT_PAGE;
+    return len;
+}
+
+// the state is also kept by the snapshots of the reverse execution
+void srv32_save_state(struct rv *rv, rv_state *s) {
+    memset(s, 0, sizeof(rv_state));
+    s->pc              = rv->pc;
+    s->prev_pc         = rv->prev_pc;
+    memcpy(s->regs, rv->regs, sizeof(s->regs));
+    s->csr             = rv->csr;
+    s->timer_irq       = rv->timer_irq;
+    s->sw_irq          = rv->sw_irq;
+    s->sw_irq_next     = rv->sw_irq_next;
+    s->ext_irq         = rv->ext_irq;
+    s->ext_irq_next    = rv->ext_irq_next;
+    s->compressed_prev = rv->compressed_prev;
+    s->mtime_update    = rv->mtime_update;
+    s->exited          = rv->exited;
+    s->exitcode        = rv->exitcode;
+    s->htif_result     = rv->htif_result;
+    #ifdef RV32C_ENABLED
+    s->overhead        = rv->overhead;
+    #endif // RV32C_ENABLED
+    s->count_class     = rv->count_class;
+    s->irq_deadline    = rv->irq_deadline;
+    s->cpi             = rv->cpi;
+    memcpy(s->mhpmevent, rv->mhpmevent, sizeof(s->mhpmevent));
+    memcpy(s->hpm_base, rv->hpm_base, sizeof(s->hpm_base));
+}
+
+void srv32_load_state(struct rv *rv, const rv_state *s) {
+    rv->pc              = s->pc;
+    rv->prev_pc         = s->prev_pc;
+    memcpy(rv->regs, s->regs, sizeof(rv->regs));
+    rv->csr             = s->csr;
+    rv->timer_irq       = s->timer_irq;
+    rv->sw_irq          = s->sw_irq;
+    rv->sw_irq_next     = s->sw_irq_next;
+    rv->ext_irq         = s->ext_irq;
+    rv->ext_irq_next    = s->ext_irq_next;
+    rv->compressed_prev = s->compressed_prev;
+    rv->mtime_update    = s->mtime_update;
+    rv->block_break     = 0;
+    rv->exited          = s->exited;
+    rv->exitcode        = s->exitcode;
+    rv->htif_result     = s->htif_result;
+    #ifdef RV32C_ENABLED
+    rv->overhead        = s->overhead;
+    #endif // RV32C_ENABLED
+    rv->count_class     = s->count_class || rv->statsfile != NULL;
+    rv->irq_deadline    = s->irq_deadline;
+    rv->cpi             = s->cpi;
+    memcpy(rv->mhpmevent, s->mhpmevent, sizeof(rv->mhpmevent));
+    memcpy(rv->hpm_base, s->hpm_base, sizeof(rv->hpm_base));
+}
+
+bool srv32_checkpoint_save(struct rv *rv, const char *file) {
+    static const char zero[CKPT_PAGE];
+    uint32_t npages = (uint32_t)((rv->mem_size + CKPT_PAGE - 1) / CKPT_PAGE);
+    ckpt_header *hdr;
+    rv_state state;
+    ckpt_run *runs;
+    uint32_t nruns = 0;
+    uint32_t i;
+    size_t pos;
+    FILE *fp;
+    bool ok;
+
+    if ((hdr = (ckpt_header*)calloc(1, sizeof(ckpt_header))) == NULL ||
+        (runs = (ckpt_run*)malloc(sizeof(ckpt_run) * (npages / 2 + 1))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        free(hdr);
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    // the runs are separated by the zero pages, so there are npages / 2 + 1
+    // runs at most
+    for(i = 0; i < npages; i++) {
+        const uint64_t *p = (const uint64_t*)((char*)rv->mem + (size_t)i * CKPT_PAGE);
+
+        if (page_is_zero(p, ckpt_run_len(rv, i, 1)))
+            continue;
+        if (nruns && runs[nruns-1].first + runs[nruns-1].count == i) {
+            runs[nruns-1].count++;
+        } else {
+            runs[nruns].first = i;
+            runs[nruns].count = 1;
+            nruns++;
+        }
+    }
+
+    memcpy(hdr->magic, CKPT_MAGIC, 8);
+    hdr->version    = CKPT_VERSION;
+    hdr->flags      = ckpt_flags();
+    hdr->state_size = sizeof(rv_state);
+    hdr->mem_base   = rv->mem_base;
+    hdr->mem_size   = rv->mem_size;
+    hdr->nruns      = nruns;
+    if (rv->elf && rv->elf->path)
+        strncpy(hdr->elf, rv->elf->path, sizeof(hdr->elf) - 1);
+
+    srv32_save_state(rv, &state);
+
+    if ((fp = fopen(file, "wb")) == NULL) {
+        printf("can not open file %s\n", file);
+        free(runs);
+        free(hdr);
+        return false;
+    }
+
+    ok = fwrite(hdr, sizeof(ckpt_header), 1, fp) == 1 &&
+         fwrite(&state, sizeof(rv_state), 1, fp) == 1 &&
+         fwrite(runs, sizeof(ckpt_run), nruns, fp) == nruns;
+
+    pos = sizeof(ckpt_header) + sizeof(rv_state) + sizeof(ckpt_run) * nruns;
+    if (ok && pos < ckpt_data_offset(nruns))
+        ok = fwrite(zero, ckpt_data_offset(nruns) - pos, 1, fp) == 1;
+
+    // the last page is padded to the page size
+    for(i = 0; ok && i < nruns; i++) {
+        size_t len = ckpt_run_len(rv, runs[i].first, runs[i].count);
+
+        ok = fwrite((char*)rv->mem + (size_t)runs[i].first * CKPT_PAGE,
+                    len, 1, fp) == 1;
+        if (ok && len % CKPT_PAGE)
+            ok = fwrite(zero, CKPT_PAGE - len % CKPT_PAGE, 1, fp) == 1;
+    }
+
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        printf("can not write the checkpoint %s\n", file);
+
+    free(runs);
+    free(hdr);
+    return ok;
+}
+
+static bool ckpt_read(int fd, void *buf, size_t len, off_t offset) {
+    return pread(fd, buf, len, offset) == (ssize_t)len;
+}
+
+bool srv32_checkpoint_restore(struct rv *rv, const char *file) {
+    uint32_t npages = (uint32_t)((rv->mem_size + CKPT_PAGE - 1) / CKPT_PAGE);
+    ckpt_header *hdr = NULL;
+    rv_state state;
+    ckpt_run *runs = NULL;
+    struct stat st;
+    bool map = (CKPT_PAGE % sysconf(_SC_PAGESIZE)) == 0;
+    size_t data;
+    uint32_t i;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        printf("can not open file %s\n", file);
+        return false;
+    }
+
+    if ((hdr = (ckpt_header*)malloc(sizeof(ckpt_header))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    if (!ckpt_read(fd, hdr, sizeof(ckpt_header), 0) ||
+        memcmp(hdr->magic, CKPT_MAGIC, 8) != 0 || hdr->version != CKPT_VERSION) {
+        printf("%s is not a checkpoint\n", file);
+        goto fail;
+    }
+
+    if (hdr->flags != ckpt_flags() || hdr->state_size != sizeof(rv_state)) {
+        printf("%s is saved by rvsim of other instruction sets\n", file);
+        goto fail;
+    }
+
+    if (hdr->mem_base != rv->mem_base || hdr->mem_size != rv->mem_size) {
+        printf("%s is saved with the memory 0x%08x-0x%08x\n", file,
+               hdr->mem_base, hdr->mem_base + hdr->mem_size);
+        goto fail;
+    }
+
+    if ((runs = (ckpt_run*)malloc(sizeof(ckpt_run) * (hdr->nruns + 1))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    if (!ckpt_read(fd, &state, sizeof(rv_state), sizeof(ckpt_header)) ||
+        !ckpt_read(fd, runs, sizeof(ckpt_run) * hdr->nruns,
+                   sizeof(ckpt_header) + sizeof(rv_state))) {
+        printf("%s is truncated\n", file);
+        goto fail;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        // LCOV_EXCL_START
+        printf("can not open file %s\n", file);
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    // the symbols of the program, the run does not need them
+    hdr->elf[sizeof(hdr->elf) - 1] = 0;
+    rv->loaded = false;
+    elf_close(rv->elf);
+    if ((rv->elf = elf_open(hdr->elf)) == NULL)
+        printf("%s is restored without the symbols\n", file);
+
+    srv32_clear_mem(rv);
+
+    data = ckpt_data_offset(hdr->nruns);
+    for(i = 0; i < hdr->nruns; i++) {
+        char *addr = (char*)rv->mem + (size_t)runs[i].first * CKPT_PAGE;
+        size_t len;
+
+        if ((uint64_t)runs[i].first + runs[i].count > npages) {
+            printf("%s is corrupted\n", file);
+            goto fail;
+        }
+        len = ckpt_run_len(rv, runs[i].first, runs[i].count);
+
+        // the pages mapped beyond the end of the file fault at the access
+        if ((uint64_t)data + len > (uint64_t)st.st_size) {
+            printf("%s is truncated\n", file);
+            goto fail;
+        }
+
+        if (map) {
+            if (mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                     fd, (off_t)data) == MAP_FAILED) {
+                printf("%s is truncated\n", file);
+                goto fail;
+            }
+        } else if (!ckpt_read(fd, addr, len, (off_t)data)) {
+            printf("%s is truncated\n", file);
+            goto fail;
+        }
+        data += (size_t)runs[i].count * CKPT_PAGE;
+    }
+
+    srv32_load_state(rv, &state);
+
+    // the profile is of the run after the checkpoint
+    if (rv->prof)
+        srv32_profile_reset(rv);
+    if (rv->graph)
+        srv32_callgraph_reset(rv);
+
+    gettimeofday(&rv->time_start, NULL);
+    rv->loaded = true;
+
+    close(fd);
+    free(runs);
+    free(hdr);
+    return true;
+
+fail:
+    close(fd);
+    free(runs);
+    free(hdr);
+    return false;
+}
@@ -0,0 +1,361 @@
+// Copyright © 2020 Kuoping Hsu
+// compare.c: find the first difference of two trace logs
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "trace.h"
+#include "riscv-disas.h"
+
+// The two traces are compared as byte streams, the lines are only split
+// at the first difference. A text file is mapped into the memory, a pipe
+// is read in chunks, and a binary trace is formatted into the text chunk
+// by chunk, so the traces are never held on the disk or in the memory as
+// a whole. The text before the current position is kept in the buffer
+// for the lines printed before the difference.
+
+#define CMP_CHUNK       (4*1024*1024)
+#define CMP_KEEP        (64*1024)
+#define CMP_WINDOW_MAX  256
+
+typedef struct cmp_file {
+    const char    *name;
+    int            fd;
+    uint8_t       *map;         // the mapped file, NULL for a pipe
+    size_t         size;
+    const uint8_t *raw;         // binary records not formatted yet
+    const uint8_t *raw_end;
+    trace_state   *state;       // decoder of the binary trace, NULL for text
+    char          *buf;         // text of the pipe or the binary trace
+    const char    *text;        // start of the text in memory
+    const char    *pos;         // compare position
+    const char    *end;
+    bool           eof;         // no more text after end
+} cmp_file;
+
+// first position where a and b differ, n if they are the same
+static size_t first_diff(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+
+    // skip the equal blocks with memcmp, then locate the byte
+    while (n - i >= 4096 && memcmp(a + i, b + i, 4096) == 0)
+        i += 4096;
+
+    #ifdef __SSE2__
+    for(; n - i >= 16; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    #endif // __SSE2__
+
+    for(; i < n; i++) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+static long long count_lines(const char *p, size_t n) {
+    long long lines = 0;
+    size_t i;
+    for(i = 0; i < n; i++)
+        lines += p[i] == '\n';
+    return lines;
+}
+
+// read more text after end, keeps the lines before pos
+static void cmp_fill(cmp_file *f) {
+    const char *keep = f->pos;
+    size_t kept;
+    ssize_t n;
+
+    if (f->eof)
+        return;
+
+    if (keep - f->text > CMP_KEEP) {
+        keep = f->pos - CMP_KEEP;
+        while (keep < f->pos && *keep++ != '\n')
+            ;
+    } else {
+        keep = f->text;
+    }
+
+    kept = f->end - keep;
+    memmove(f->buf, keep, kept);
+    f->pos = f->buf + (f->pos - keep);
+    f->text = f->buf;
+    f->end = f->buf + kept;
+
+    if (f->state) {
+        int len = trace_format(f->state, &f->raw, f->raw_end, f->buf + kept,
+                               CMP_CHUNK + CMP_KEEP - (int)kept);
+        if (len < 0) {
+            // LCOV_EXCL_START
+            printf("%s: malformed trace record\n", f->name);
+            len = 0;
+            f->raw = f->raw_end;
+            // LCOV_EXCL_STOP
+        }
+        f->end += len;
+        f->eof = f->raw >= f->raw_end;
+    } else {
+        n = read(f->fd, f->buf + kept, CMP_CHUNK + CMP_KEEP - kept);
+        if (n > 0)
+            f->end += n;
+        else
+            f->eof = true;
+    }
+}
+
+static bool cmp_open(cmp_file *f, const char *name) {
+    struct stat st;
+
+    memset(f, 0, sizeof(cmp_file));
+    f->name = name;
+
+    if (strcmp(name, "-") == 0) {
+        f->fd = 0;
+    } else if ((f->fd = open(name, O_RDONLY)) < 0) {
+        printf("can not open file %s\n", name);
+        return false;
+    }
+
+    if (fstat(f->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        f->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+        if (f->map == MAP_FAILED)
+            f->map = NULL;
+        else
+            f->size = st.st_size;
+    }
+
+    if (f->map && f->size >= 9 && memcmp(f->map, TRACE_MAGIC, 8) == 0) {
+        if (f->map[8] != TRACE_VERSION) {
+            printf("%s: unknown trace version %d\n", name, f->map[8]);
+            return false;
+        }
+        if ((f->state = (trace_state*)malloc(sizeof(trace_state))) == NULL)
+            return false;
+        trace_reset(f->state);
+        f->raw = f->map + 9;
+        f->raw_end = f->map + f->size;
+        madvise(f->map, f->size, MADV_SEQUENTIAL);
+    } else if (f->map) {
+        // the text is compared in place
+        f->text = f->pos = (const char*)f->map;
+        f->end = f->text + f->size;
+        f->eof = true;
+        madvise(f->map, f->size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    if ((f->buf = malloc(CMP_CHUNK + CMP_KEEP)) == NULL)
+        return false;
+    f->text = f->pos = f->end = f->buf;
+    cmp_fill(f);
+
+    if (!f->state && f->end - f->text >= 8 &&
+        memcmp(f->text, TRACE_MAGIC, 8) == 0) {
+        printf("%s: the binary trace can not be read from a pipe\n", name);
+        return false;
+    }
+    return true;
+}
+
+static void cmp_close(cmp_file *f) {
+    if (f->map) munmap(f->map, f->size);
+    if (f->fd > 0) close(f->fd);
+    free(f->state);
+    free(f->buf);
+}
+
+// make sure the line at pos is complete
+static void cmp_line(cmp_file *f) {
+    while (!f->eof && memchr(f->pos, '\n', f->end - f->pos) == NULL)
+        cmp_fill(f);
+}
+
+static const char *line_start(const cmp_file *f, const char *p) {
+    while (p > f->text && p[-1] != '\n')
+        p--;
+    return p;
+}
+
+static const char *line_end(const cmp_file *f, const char *p) {
+    const char *e = memchr(p, '\n', f->end - p);
+    return e ? e : f->end;
+}
+
+// skip the "%10d " cycle column
+static const char *skip_cycle(const char *p, const char *end) {
+    const char *s = p;
+
+    while (p < end && *p == ' ')
+        p++;
+    if (p < end && *p == '-')
+        p++;
+    if (p >= end || *p < '0' || *p > '9')
+        return s;
+    while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    return (p < end && *p == ' ') ? p + 1 : s;
+}
+
+static void print_line(const char *mark, const char *p, const char *end) {
+    char buf[80] = {0};
+    char line[256];
+    unsigned int pc, inst;
+    int len = (int)(end - p);
+
+    if (len > (int)sizeof(line) - 1)
+        len = sizeof(line) - 1;
+    memcpy(line, p, len);
+    line[len] = 0;
+
+    // the pc and the instruction follow the cycle column
+    if (sscanf(skip_cycle(line, line + len), "%8x %8x", &pc, &inst) == 2) {
+        disasm_inst(buf, sizeof(buf), rv32, pc, inst);
+        printf("%s %-60s  # %s\n", mark, line, buf);
+    } else {
+        printf("%s %s\n", mark, line);
+    }
+}
+
+// print the lines after pos
+static void print_after(cmp_file *f, const char *mark, int window) {
+    int i;
+
+    for(i = 0; i <= window; i++) {
+        const char *e;
+
+        cmp_line(f);
+        if (f->pos >= f->end)
+            break;
+        e = line_end(f, f->pos);
+        print_line(mark, f->pos, e);
+        f->pos = e < f->end ? e + 1 : e;
+    }
+    if (i == 0)
+        printf("%s <end of file>\n", mark);
+}
+
+int srv32_compare(const char *file1, const char *file2, int window,
+                  bool nocycle) {
+    cmp_file a, b;
+    long long line = 1;
+    int result = 2;
+
+    if (window < 0) window = 0;
+    if (window > CMP_WINDOW_MAX) window = CMP_WINDOW_MAX;
+
+    if (!cmp_open(&a, file1)) {
+        cmp_close(&a);
+        return 2;
+    }
+    if (!cmp_open(&b, file2)) {
+        cmp_close(&a);
+        cmp_close(&b);
+        return 2;
+    }
+
+    for(;;) {
+        size_t n, d;
+        const char *sa, *sb, *ea, *eb, *ra, *rb;
+
+        if (a.pos == a.end) cmp_fill(&a);
+        if (b.pos == b.end) cmp_fill(&b);
+
+        n = a.end - a.pos;
+        if (n > (size_t)(b.end - b.pos))
+            n = b.end - b.pos;
+
+        d = first_diff(a.pos, b.pos, n);
+        line += count_lines(a.pos, d);
+        a.pos += d;
+        b.pos += d;
+
+        // the end of a buffer, unless both files end
+        if (d == n) {
+            if (a.pos == a.end && b.pos == b.end && a.eof && b.eof) {
+                result = 0;
+                break;
+            }
+            if ((a.pos == a.end && !a.eof) || (b.pos == b.end && !b.eof))
+                continue;
+        }
+
+        // the lines of the difference, both are complete
+        cmp_line(&a);
+        cmp_line(&b);
+        sa = line_start(&a, a.pos);
+        sb = line_start(&b, b.pos);
+        ea = line_end(&a, a.pos);
+        eb = line_end(&b, b.pos);
+
+        if (nocycle && a.pos < a.end && b.pos < b.end) {
+            ra = skip_cycle(sa, ea);
+            rb = skip_cycle(sb, eb);
+            if (ra != sa && rb != sb && ea - ra == eb - rb &&
+                memcmp(ra, rb, ea - ra) == 0 && ea < a.end && eb < b.end) {
+                a.pos = ea + 1;
+                b.pos = eb + 1;
+                line++;
+                continue;
+            }
+        }
+
+        printf("%s %s differ: line %lld\n", file1, file2, line);
+        if (window > 0) {
+            const char *p = sa;
+            int i;
+
+            // the same lines before the difference
+            for(i = 0; i < window && p > a.text; i++)
+                p = line_start(&a, p - 1);
+            while (p < sa) {
+                const char *e = line_end(&a, p);
+                print_line(" ", p, e);
+                p = e + 1;
+            }
+        }
+        a.pos = sa;
+        b.pos = sb;
+        print_after(&a, "<", window);
+        print_after(&b, ">", window);
+        result = 1;
+        break;
+    }
+
+    cmp_close(&a);
+    cmp_close(&b);
+    return result;
+}
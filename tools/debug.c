@@ -42,8 +42,11 @@ static void debug_usage(void) {
 "pc                         # show pc\n"
 "quit|q                     # quit\n"
 "regs                       # dump registers\n"
+"rfinish                    # run back to the call of the function\n"
+"rstep [count]              # step back\n"
+"runtil <val>|<symbol>      # run back until pc hits <val> or the symbol\n"
 "step [count]               # run\n"
-"until <val>                # run until pc htis <val>\n"
+"until <val>|<symbol>       # run until pc htis <val> or the symbol\n"
 "\n"
     );
 }
@@ -73,9 +76,13 @@ static void dump_mem(struct rv *rv, int32_t addr, int32_t len) {
 static int show_pc(struct rv *rv, int pc) {
     char buf[80] = {0};
     rv_inst inst;
+    const elf_symbol *sym = elf_find_symbol(rv->elf, pc);
 
     srv32_read_mem(rv, pc, sizeof(rv_inst), &inst);
 
+    if (sym && sym->addr == (uint32_t)pc)
+        printf("%08x <%s>:\n", pc, sym->name);
+
     disasm_inst(buf, sizeof(buf), rv32, pc, inst);
     printf("%7s: %08x %s\n", "pc", pc, buf);
 
@@ -119,6 +126,46 @@ static void dump_csrs(struct rv *rv) {
     printf("\n");
 }
 
+static bool at_pc(struct rv *rv, void *arg) {
+    return rv->pc == *(int*)arg;
+}
+
+// the entry of the function which is not returned yet, it is the one with
+// sp above the current sp, or the same sp and the return address outside
+// the function, since the calls of the function itself which are returned
+// have the same sp and return to it
+typedef struct {
+    const elf_symbol *func;
+    uint32_t sp;
+} debug_frame;
+
+static bool at_entry(struct rv *rv, void *arg) {
+    const debug_frame *f = (const debug_frame*)arg;
+    uint32_t sp = (uint32_t)rv->regs[SP];
+    uint32_t ra = (uint32_t)rv->regs[RA];
+
+    return rv->pc == (int32_t)f->func->addr &&
+           (sp > f->sp ||
+            (sp == f->sp && (ra - f->func->addr) >= f->func->size));
+}
+
+// the address of "<cmd> <val>|<symbol>", false if the symbol is not found
+static bool parse_addr(struct rv *rv, const char *cmd, int *addr) {
+    char name[256] = {0};
+    const elf_symbol *sym;
+
+    if (sscanf(cmd, "%*s %i", addr) == 1)
+        return true;
+
+    sscanf(cmd, "%*s %255s", name);
+    if ((sym = elf_lookup_symbol(rv->elf, name)) == NULL) {
+        printf("Unknown symbol %s\n", name);
+        return false;
+    }
+    *addr = sym->addr;
+    return true;
+}
+
 static int isspace_ascii(int c)
 {
     return c == '\t' || c == '\n' || c == '\v' ||
@@ -195,11 +242,57 @@ int debug(struct rv *rv) {
             if (!strncmp(cmd, "until", sizeof("until")-1)) {
                 until_pc = 0;
                 count_en = 0;
-                sscanf(cmd, "until %i", &until_pc);
+                if (!parse_addr(rv, cmd, &until_pc))
+                    continue;
                 running = 1;
                 break;
             }
 
+            if (!strncmp(cmd, "rstep", sizeof("rstep")-1)) {
+                long long step;
+                int n = 1;
+
+                sscanf(cmd, "rstep %i", &n);
+                step = rv->rev->step - (n > 1 ? n : 1);
+                if (step < srv32_reverse_oldest(rv)) {
+                    printf("No more history\n");
+                    step = srv32_reverse_oldest(rv);
+                }
+                srv32_reverse_goto(rv, step);
+                dump_regs(rv);
+                continue;
+            }
+
+            if (!strncmp(cmd, "runtil", sizeof("runtil")-1)) {
+                int pc;
+
+                if (!parse_addr(rv, cmd, &pc))
+                    continue;
+                if (!srv32_reverse_cont(rv, at_pc, &pc))
+                    printf("No more history\n");
+                dump_regs(rv);
+                continue;
+            }
+
+            if (!strncmp(cmd, "rfinish", sizeof(cmd))) {
+                debug_frame f;
+
+                f.func = elf_find_symbol(rv->elf, rv->pc);
+                f.sp = (uint32_t)rv->regs[SP];
+                if (!f.func) {
+                    printf("No function at pc %08x\n", rv->pc);
+                    continue;
+                }
+                // the step before the entry is the call
+                if (srv32_reverse_cont(rv, at_entry, &f) &&
+                    rv->rev->step > srv32_reverse_oldest(rv))
+                    srv32_reverse_goto(rv, rv->rev->step - 1);
+                else
+                    printf("No more history\n");
+                dump_regs(rv);
+                continue;
+            }
+
             if (!strncmp(cmd, "regs", sizeof(cmd))) {
                 dump_regs(rv);
                 continue;
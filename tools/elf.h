@@ -9,6 +9,15 @@
 
 #define PT_LOAD   1
 
+#define SHT_SYMTAB 2
+#define SHN_UNDEF  0
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC   2
+
+#define ELF32_ST_TYPE(i) ((i) & 0xf)
+
 /* 32-bit ELF base types. */
 typedef unsigned int        Elf32_Addr;
 typedef unsigned short      Elf32_Half;
@@ -56,6 +65,15 @@ typedef struct elf32_shdr {
     Elf32_Word              sh_entsize;
 } Elf32_Shdr;
 
+typedef struct elf32_sym {
+    Elf32_Word              st_name;
+    Elf32_Addr              st_value;
+    Elf32_Word              st_size;
+    unsigned char           st_info;
+    unsigned char           st_other;
+    Elf32_Half              st_shndx;
+} Elf32_Sym;
+
 typedef struct elf32_phdr {
     Elf32_Word              p_type;
     Elf32_Off               p_offset;
@@ -1,5 +1,5 @@
 // Copyright © 2020 Kuoping Hsu
-// ELF reader
+// ELF loader, shared by rvsim and the Verilator harness
 //
 // Permission is hereby granted, free of charge, to any person obtaining a copy
 // of this software and associated documentation files (the “Software”), to deal
@@ -21,52 +21,170 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "elf.h"
-#include "opcode.h"
-#include "rvsim.h"
+#include "elfloader.h"
 
 #ifndef VERBOSE
 #define VERBOSE 0
 #endif
 
-#ifndef LIBRARY
-#define LIBRARY 1
-#endif
+// the range [offset, offset+len) is in the file
+#define IN_FILE(elf, offset, len) \
+    ((uint64_t)(offset) + (uint64_t)(len) <= (uint64_t)(elf)->size)
+
+static int symbol_compare(const void *a, const void *b) {
+    const elf_symbol *sa = (const elf_symbol*)a;
+    const elf_symbol *sb = (const elf_symbol*)b;
+
+    if (sa->addr != sb->addr)
+        return (sa->addr < sb->addr) ? -1 : 1;
 
-static int elf32_read(FILE *fp, struct rv *rv)
+    // on the same address, the function is the last one, it is the one
+    // found by elf_find_symbol()
+    return sa->type - sb->type;
+}
+
+static void elf32_symbols(elf_file *elf)
 {
-    int i;
-    Elf32_Ehdr elf32_header;
-    Elf32_Phdr *elf32_phdr = NULL;
-    Elf32_Phdr *ph;
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr*)elf->data;
+    const Elf32_Shdr *sh = (const Elf32_Shdr*)(elf->data + eh->e_shoff);
+    int i, n;
+
+    if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(Elf32_Shdr) ||
+        !IN_FILE(elf, eh->e_shoff, eh->e_shnum * sizeof(Elf32_Shdr)))
+        return;
+
+    for(i = 0; i < eh->e_shnum; i++) {
+        const Elf32_Sym *sym;
+        const Elf32_Shdr *str;
+        const char *strtab;
+
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+
+        str = &sh[sh[i].sh_link];
+        if (!IN_FILE(elf, sh[i].sh_offset, sh[i].sh_size) ||
+            !IN_FILE(elf, str->sh_offset, str->sh_size) ||
+            str->sh_size == 0 ||
+            elf->data[str->sh_offset + str->sh_size - 1] != 0)
+            return;
+
+        sym = (const Elf32_Sym*)(elf->data + sh[i].sh_offset);
+        strtab = (const char*)(elf->data + str->sh_offset);
+        n = sh[i].sh_size / sizeof(Elf32_Sym);
+
+        if ((elf->symbols = (elf_symbol*)malloc(sizeof(elf_symbol) * n)) == NULL) {
+            // LCOV_EXCL_START
+            printf("malloc fail!\n");
+            return;
+            // LCOV_EXCL_STOP
+        }
+
+        for(; n > 0; n--, sym++) {
+            int type = ELF32_ST_TYPE(sym->st_info);
+            elf_symbol *s = &elf->symbols[elf->nsymbols];
+
+            // skip the sections, files, and the mapping symbols ($x, $d)
+            if (type > STT_FUNC || sym->st_shndx == SHN_UNDEF ||
+                sym->st_name == 0 || sym->st_name >= str->sh_size ||
+                strtab[sym->st_name] == '$')
+                continue;
+
+            s->addr = sym->st_value;
+            s->size = sym->st_size;
+            s->type = type;
+            s->name = &strtab[sym->st_name];
+            elf->nsymbols++;
+        }
+
+        qsort(elf->symbols, elf->nsymbols, sizeof(elf_symbol), symbol_compare);
+        return;
+    }
+}
 
-    fseek(fp, 0, SEEK_SET);
-    if (!fread(&elf32_header, sizeof(Elf32_Ehdr), 1, fp)) {
+elf_file *elf_open(const char *file)
+{
+    elf_file *elf;
+    struct stat st;
+    void *data;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
         // LCOV_EXCL_START
-        printf("File read fail\n");
-        goto fail;
+        printf("Can not open file %s\n", file);
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+
+    // the file is mapped for the life time of elf_file, the symbol names
+    // point to the mapped string table
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf32_Ehdr) ||
+        (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        // LCOV_EXCL_START
+        printf("Can not read file %s\n", file);
+        close(fd);
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+    close(fd);
+
+    if (memcmp(data, "\177ELF", 4) != 0) {
+        // LCOV_EXCL_START
+        printf("The file %s is not an ELF format\n", file);
+        munmap(data, st.st_size);
+        return NULL;
         // LCOV_EXCL_STOP
     }
 
-    if (!(elf32_phdr =
-           (Elf32_Phdr*)malloc(sizeof(Elf32_Phdr) * elf32_header.e_phnum))) {
+    if (((const char*)data)[EI_CLASS] != 1) { // ELF32
         // LCOV_EXCL_START
-        goto fail;
+        printf("The file %s is not an ELF32 file\n", file);
+        munmap(data, st.st_size);
+        return NULL;
         // LCOV_EXCL_STOP
     }
 
-    fseek(fp, elf32_header.e_phoff, SEEK_SET);
-    if (!fread(elf32_phdr,
-               sizeof(Elf32_Phdr) * elf32_header.e_phnum, 1, fp)) {
+    if ((elf = (elf_file*)calloc(1, sizeof(elf_file))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail!\n");
+        munmap(data, st.st_size);
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+
+    elf->data  = (const uint8_t*)data;
+    elf->size  = st.st_size;
+    elf->entry = ((const Elf32_Ehdr*)data)->e_entry;
+    // the absolute path is kept for the checkpoint
+    if ((elf->path = realpath(file, NULL)) == NULL)
+        elf->path = strdup(file);
+
+    elf32_symbols(elf);
+
+    return elf;
+}
+
+int elf_load(const elf_file *elf, char *mem, uint32_t base, uint32_t size)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr*)elf->data;
+    const Elf32_Phdr *ph = (const Elf32_Phdr*)(elf->data + eh->e_phoff);
+    int i;
+
+    if (eh->e_phentsize != sizeof(Elf32_Phdr) ||
+        !IN_FILE(elf, eh->e_phoff, eh->e_phnum * sizeof(Elf32_Phdr))) {
         // LCOV_EXCL_START
         printf("File read fail\n");
-        goto fail;
+        return 0;
         // LCOV_EXCL_STOP
     }
 
-    for(i = 0, ph = elf32_phdr; i < elf32_header.e_phnum; i++, ph++) {
-        void *ptr;
+    for(i = 0; i < eh->e_phnum; i++, ph++) {
         if (VERBOSE) printf("[%d] 0x%08x 0x%08x 0x%08x 0x%08x\n", i,
                             (int)ph->p_type,
                             (int)ph->p_offset,
@@ -76,83 +194,83 @@ static int elf32_read(FILE *fp, struct rv *rv)
         if (ph->p_type != PT_LOAD)
             continue;
 
-        fseek(fp, ph->p_offset, SEEK_SET);
-
-        if ((ptr = malloc(ph->p_memsz)) == NULL) {
+        if (ph->p_vaddr < base || ph->p_filesz > ph->p_memsz ||
+            (uint64_t)ph->p_vaddr + ph->p_memsz > (uint64_t)base + size) {
             // LCOV_EXCL_START
-            printf("malloc fail!\n");
-            goto fail;
+            printf("Error: memory %08x with size %d out of range\n",
+                    (int)ph->p_vaddr, (int)ph->p_memsz);
+            return 0;
             // LCOV_EXCL_STOP
         }
-        if(!fread((void*)ptr, (int)ph->p_memsz, 1, fp)) {
+
+        if (!IN_FILE(elf, ph->p_offset, ph->p_filesz)) {
             // LCOV_EXCL_START
             printf("File read fail\n");
-            goto fail;
+            return 0;
             // LCOV_EXCL_STOP
         }
 
-        if (srv32_write_mem(rv, ph->p_vaddr, ph->p_memsz, (void*)ptr)) {
-            if (VERBOSE) printf("load memory, address 0x%08x, size %d\n",
-                                (int)ph->p_vaddr, (int)ph->p_memsz);
-        } else {
-            // LCOV_EXCL_START
-            printf("Error: memory %08x with size %d out of range\n",
-                    (int)ph->p_vaddr, (int)ph->p_memsz);
-            exit(-1);
-            // LCOV_EXCL_STOP
-        }
-        free(ptr);
+        // the rest of the segment (.bss) is zero in the cleared memory
+        memcpy(&mem[ph->p_vaddr - base], elf->data + ph->p_offset, ph->p_filesz);
+
+        if (VERBOSE) printf("load memory, address 0x%08x, size %d\n",
+                            (int)ph->p_vaddr, (int)ph->p_filesz);
     }
 
-    if (elf32_phdr) free(elf32_phdr);
     return 1;
-
-// LCOV_EXCL_START
-fail:
-    if (elf32_phdr) free(elf32_phdr);
-    return 0;
-// LCOV_EXCL_STOP
 }
 
-int elfloader(char *file, struct rv *rv)
+const elf_symbol *elf_find_symbol(const elf_file *elf, uint32_t addr)
 {
-    FILE *fp;
-    char elf_header[EI_NIDENT];
+    const elf_symbol *s;
+    int lo = 0, hi;
 
-    if ((fp = fopen(file, "rb")) == NULL) {
-        // LCOV_EXCL_START
-        printf("Can not open file %s\n", file);
-        return 0;
-        // LCOV_EXCL_STOP
-    }
+    if (!elf || elf->nsymbols == 0)
+        return NULL;
 
-    if (!fread(&elf_header, sizeof(elf_header), 1, fp)) {
-        // LCOV_EXCL_START
-        printf("Can not read file %s\n", file);
-        fclose(fp);
-        return 0;
-        // LCOV_EXCL_STOP
+    // the last symbol with the address <= addr
+    hi = elf->nsymbols;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (elf->symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    if (elf_header[0] == 0x7F || elf_header[1] == 'E') {
-        if (elf_header[EI_CLASS] == 1) { // ELF32
-            int result = elf32_read(fp, rv);
-            fclose(fp);
-            return result;
-        } else { // ELF64
-            // LCOV_EXCL_START
-            return 0;
-            // LCOV_EXCL_STOP
-        }
-    } else {
-        // LCOV_EXCL_START
-        printf("The file %s is not an ELF format\n", file);
-        fclose(fp);
-        return 0;
-        // LCOV_EXCL_STOP
-    }
+    if (lo == 0)
+        return NULL;
 
-    fclose(fp);
-    return 1;
+    s = &elf->symbols[lo - 1];
+
+    // the labels have no size, it is up to the next symbol
+    if (s->size != 0 && addr >= s->addr + s->size)
+        return NULL;
+
+    return s;
 }
 
+const elf_symbol *elf_lookup_symbol(const elf_file *elf, const char *name)
+{
+    int i;
+
+    if (!elf)
+        return NULL;
+
+    for(i = 0; i < elf->nsymbols; i++)
+        if (!strcmp(elf->symbols[i].name, name))
+            return &elf->symbols[i];
+
+    return NULL;
+}
+
+void elf_close(elf_file *elf)
+{
+    if (!elf)
+        return;
+
+    munmap((void*)elf->data, elf->size);
+    free(elf->symbols);
+    free(elf->path);
+    free(elf);
+}
@@ -0,0 +1,67 @@
+// Copyright © 2020 Kuoping Hsu
+// ELF loader, shared by rvsim and the Verilator harness
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __ELFLOADER_H
+#define __ELFLOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct elf_symbol {
+    uint32_t    addr;
+    uint32_t    size;
+    int         type;       // STT_NOTYPE, STT_OBJECT or STT_FUNC
+    const char *name;       // points to the mapped file
+} elf_symbol;
+
+typedef struct elf_file {
+    const uint8_t *data;    // the file mapped read-only
+    size_t         size;
+    uint32_t       entry;
+    elf_symbol    *symbols; // .symtab sorted by address
+    int            nsymbols;
+    char          *path;    // absolute path of the file
+} elf_file;
+
+// map the ELF file and parse the symbol table, NULL on error
+elf_file *elf_open(const char *file);
+
+// copy the PT_LOAD segments to mem, which is the memory of [base, base+size).
+// The memory should be cleared, the .bss is not written.
+int elf_load(const elf_file *elf, char *mem, uint32_t base, uint32_t size);
+
+// the symbol containing addr, NULL if not found
+const elf_symbol *elf_find_symbol(const elf_file *elf, uint32_t addr);
+
+// the symbol of the name, NULL if not found
+const elf_symbol *elf_lookup_symbol(const elf_file *elf, const char *name);
+
+void elf_close(elf_file *elf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ELFLOADER_H
@@ -0,0 +1,443 @@
+// Copyright © 2020 Kuoping Hsu
+// fanout.c: fork the what-if runs at the region of interest
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+#define MAXLEN      1024
+#define MAXARGS     64
+
+// The program runs once to the ROI marker (SYS_ROI), then a child process
+// is forked for each line of the list file and runs to the end with the
+// options of the line, e.g.
+//
+//     --branch 1
+//     --branch 3 --single
+//     --latency 2 --stdin input2.txt --out run2.out
+//
+// The children share the memory pages of the parent copy-on-write, so only
+// the part after the ROI is simulated for each run. The timing options are
+// --branch, --predict, --single and --latency (the wait states of all of
+// the regions); --stdin is the file read by SYS_READ of the standard input,
+// and --out, --sig and --stats are the same as the batch file. The results
+// are written by the children to a shared mapping and collected by the
+// parent. Empty lines and the lines starting with '#' are skipped.
+
+enum {
+    FANOUT_EXIT = 0,        // the program is terminated
+    FANOUT_FAIL = 1         // the child is killed or can not run the options
+};
+
+typedef struct fanout_run {
+    char        *line;      // copy of the line, the options point to it
+    char        *name;      // the options as given, for the summary
+    int32_t      branch_penalty;
+    bool         branch_predict;
+    bool         singleram;
+    int          latency;   // -1 keeps the wait states of the platform
+    const char  *input;
+    const char  *out;
+    const char  *sig;
+    const char  *stats;
+} fanout_run;
+
+// written by the child to the shared mapping
+typedef struct fanout_result {
+    int          status;
+    srv32_stat   stat;
+    double       wall;      // wall time in seconds after the ROI
+} fanout_result;
+
+void json_string(FILE *fp, const char *s);
+
+static int fanout_parse(fanout_run *r, char *line, const srv32_config *defaults) {
+    char *argv[MAXARGS];
+    int argc = 0;
+    int c;
+    char *p;
+
+    const char *optstring = "b:ps";
+    struct option opts[] = {
+        {"branch", 1, NULL, 'b'},
+        {"predict", 0, NULL, 'p'},
+        {"single", 0, NULL, 's'},
+        {"latency", 1, NULL, 'L'},
+        {"stdin", 1, NULL, 'I'},
+        {"out", 1, NULL, 'O'},
+        {"sig", 1, NULL, 'D'},
+        {"stats", 1, NULL, 'X'},
+        {NULL, 0, NULL, 0}
+    };
+
+    memset(r, 0, sizeof(fanout_run));
+    r->branch_penalty = defaults->branch_penalty;
+    r->branch_predict = defaults->branch_predict;
+    r->singleram      = defaults->singleram;
+    r->latency        = -1;
+
+    line[strcspn(line, "\r\n")] = 0;
+
+    if ((r->line = strdup(line)) == NULL || (r->name = strdup(line)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return 0;
+        // LCOV_EXCL_STOP
+    }
+
+    argv[argc++] = "rvsim";
+    for(p = strtok(r->line, " \t"); p; p = strtok(NULL, " \t")) {
+        if (argc >= MAXARGS - 1) {
+            printf("Too many options: %s\n", line);
+            return 0;
+        }
+        argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    // restart getopt for each line
+    #ifdef MACOX
+    optreset = 1;
+    optind = 1;
+    #else
+    optind = 0;
+    #endif // MACOX
+
+    while((c = getopt_long(argc, argv, optstring, opts, NULL)) != -1) {
+        switch(c) {
+            case 'b':
+                r->branch_penalty = atoi(optarg);
+                break;
+            case 'p':
+                r->branch_predict = true;
+                break;
+            case 's':
+                r->singleram = true;
+                break;
+            case 'L':
+                r->latency = atoi(optarg);
+                break;
+            case 'I':
+                r->input = optarg;
+                break;
+            case 'O':
+                r->out = optarg;
+                break;
+            case 'D':
+                r->sig = optarg;
+                break;
+            case 'X':
+                r->stats = optarg;
+                break;
+            default:
+                printf("Unknown option: %s\n", line);
+                return 0;
+        }
+    }
+
+    if (optind != argc) {
+        printf("Unknown option: %s\n", line);
+        return 0;
+    }
+
+    return 1;
+}
+
+// apply the options of the run to the forked simulator
+static bool fanout_apply(struct rv *rv, const fanout_run *r) {
+    if (r->input) {
+        int fd = open(r->input, O_RDONLY);
+        if (fd < 0) {
+            printf("can not open file %s\n", r->input);
+            return false;
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+
+    if (r->out) {
+        if (rv->fo)
+            fclose(rv->fo);
+        if ((rv->fo = fopen(r->out, "w")) == NULL) {
+            printf("can not open file %s\n", r->out);
+            return false;
+        }
+    }
+
+    if (r->sig) {
+        free(rv->dumpfile);
+        if ((rv->dumpfile = strdup(r->sig)) == NULL) {
+            // LCOV_EXCL_START
+            printf("malloc fail\n");
+            return false;
+            // LCOV_EXCL_STOP
+        }
+    }
+
+    // the instruction classes are counted from the ROI
+    if (r->stats) {
+        free(rv->statsfile);
+        if ((rv->statsfile = strdup(r->stats)) == NULL) {
+            // LCOV_EXCL_START
+            printf("malloc fail\n");
+            return false;
+            // LCOV_EXCL_STOP
+        }
+        rv->count_class = true;
+    }
+
+    srv32_retime(rv, r->branch_penalty, r->branch_predict, r->singleram,
+                 r->latency);
+
+    return true;
+}
+
+static void fanout_child(struct rv *rv, const fanout_run *r, fanout_result *res) {
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    res->status = FANOUT_FAIL;
+    if (fanout_apply(rv, r)) {
+        srv32_run(rv, -1);
+        res->status = FANOUT_EXIT;
+    }
+    srv32_get_stat(rv, &res->stat);
+
+    gettimeofday(&end, NULL);
+    res->wall = (double)(end.tv_sec-start.tv_sec) +
+                        (end.tv_usec-start.tv_usec)/1000000.0;
+
+    // the stats file and the console output are written
+    srv32_destroy(rv);
+}
+
+static void fanout_summary(FILE *fp, const fanout_run *runs,
+                           const fanout_result *res, int num,
+                           const srv32_stat *roi, bool json) {
+    int i;
+
+    if (json)
+        fprintf(fp, "[\n");
+    else
+        fprintf(fp, "options,status,exitcode,instret,cycles,"
+                    "roi_instret,roi_cycles,roi_cpi,wall\n");
+
+    for(i = 0; i < num; i++) {
+        const fanout_result *r = &res[i];
+        const char *status = (r->status == FANOUT_EXIT) ? "exit" : "fail";
+        long long instret = 0, cycles = 0;
+        double cpi = 0.0;
+
+        // the part after the ROI
+        if (r->status == FANOUT_EXIT) {
+            instret = r->stat.instret - roi->instret;
+            cycles  = r->stat.cycle - roi->cycle;
+            if (instret > 0)
+                cpi = (double)cycles / instret;
+        }
+
+        if (json) {
+            fprintf(fp, "  {\"options\": ");
+            json_string(fp, runs[i].name);
+            fprintf(fp, ", \"status\": \"%s\", \"exitcode\": %d, "
+                        "\"instret\": %lld, \"cycles\": %lld, "
+                        "\"roi_instret\": %lld, \"roi_cycles\": %lld, "
+                        "\"roi_cpi\": %.4f, \"wall\": %.6f}%s\n",
+                    status, r->stat.exitcode, r->stat.instret, r->stat.cycle,
+                    instret, cycles, cpi, r->wall, (i < num - 1) ? "," : "");
+        } else {
+            fprintf(fp, "\"%s\",%s,%d,%lld,%lld,%lld,%lld,%.4f,%.6f\n",
+                    runs[i].name, status, r->stat.exitcode,
+                    r->stat.instret, r->stat.cycle, instret, cycles, cpi, r->wall);
+        }
+    }
+
+    if (json)
+        fprintf(fp, "]\n");
+}
+
+// Run the program to the ROI marker and fork the runs of the list file,
+// at most jobs of them at the same time. The summary is written in JSON if
+// the file name ends with .json, otherwise in CSV. Returns 0 if all of the
+// runs are terminated with exit code 0.
+int srv32_fanout(const char *file, const char *list, int jobs,
+                 const char *summary, const srv32_config *defaults) {
+    FILE *fp;
+    char line[MAXLEN];
+    fanout_run *runs = NULL;
+    fanout_result *res;
+    pid_t *pids;
+    srv32_config cfg = *defaults;
+    srv32_stat roi;
+    struct rv *rv;
+    int num = 0, size = 0;
+    int running = 0;
+    int failed = 0;
+    int i;
+
+    // the writer thread of the trace log is not forked, and the profiles
+    // are of the whole program
+    cfg.logfile = NULL;
+    cfg.profile = NULL;
+    cfg.callgraph = NULL;
+    cfg.stats = NULL;
+    cfg.record = NULL;
+    cfg.replay = NULL;
+    cfg.roi = true;
+
+    if ((fp = fopen(list, "r")) == NULL) {
+        printf("can not open file %s\n", list);
+        return 1;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        char *p = line + strspn(line, " \t\r\n");
+
+        if (*p == 0 || *p == '#')
+            continue;
+
+        if (num == size) {
+            size = size ? size * 2 : 64;
+            if ((runs = realloc(runs, sizeof(fanout_run) * size)) == NULL) {
+                // LCOV_EXCL_START
+                printf("malloc fail\n");
+                exit(1);
+                // LCOV_EXCL_STOP
+            }
+        }
+        if (!fanout_parse(&runs[num++], p, &cfg)) {
+            fclose(fp);
+            return 1;
+        }
+    }
+    fclose(fp);
+
+    if (num == 0) {
+        printf("No run in %s\n", list);
+        free(runs);
+        return 1;
+    }
+
+    if ((rv = srv32_create(&cfg)) == NULL) {
+        // LCOV_EXCL_START
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+
+    if (!srv32_load(rv, file)) {
+        printf("Can not read elf file %s\n", file);
+        srv32_destroy(rv);
+        return 1;
+    }
+
+    if (srv32_run(rv, -1) != RV_ROI) {
+        printf("The program exits before the ROI marker\n");
+        srv32_destroy(rv);
+        return 1;
+    }
+    srv32_get_stat(rv, &roi);
+
+    res = (fanout_result*)mmap(NULL, sizeof(fanout_result) * num,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED || (pids = malloc(sizeof(pid_t) * num)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+
+    if (jobs <= 0)
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // the buffered output is not copied to the children
+    fflush(stdout);
+    if (rv->fo)
+        fflush(rv->fo);
+
+    for(i = 0; i < num; i++) {
+        res[i].status = FANOUT_FAIL;
+
+        // wait for a child when all of the jobs are running
+        if (running == jobs) {
+            wait(NULL);
+            running--;
+        }
+
+        if ((pids[i] = fork()) == 0) {
+            fanout_child(rv, &runs[i], &res[i]);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pids[i] < 0) {
+            // LCOV_EXCL_START
+            printf("Can not fork the run: %s\n", runs[i].name);
+            continue;
+            // LCOV_EXCL_STOP
+        }
+        running++;
+    }
+
+    // the results of the killed children are left FANOUT_FAIL
+    for(i = 0; i < num; i++) {
+        if (pids[i] > 0)
+            waitpid(pids[i], NULL, 0);
+    }
+    free(pids);
+
+    if (summary) {
+        size_t len = strlen(summary);
+        bool json = len > 5 && strcmp(summary + len - 5, ".json") == 0;
+
+        if ((fp = fopen(summary, "w")) == NULL) {
+            printf("can not open file %s\n", summary);
+            failed = 1;
+        } else {
+            fanout_summary(fp, runs, res, num, &roi, json);
+            fclose(fp);
+        }
+    } else {
+        fanout_summary(stdout, runs, res, num, &roi, false);
+    }
+
+    for(i = 0; i < num; i++) {
+        if (res[i].status != FANOUT_EXIT || res[i].stat.exitcode != 0)
+            failed = 1;
+        free(runs[i].line);
+        free(runs[i].name);
+    }
+    free(runs);
+    munmap(res, sizeof(fanout_result) * num);
+    srv32_destroy(rv);
+
+    return failed;
+}
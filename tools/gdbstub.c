@@ -32,6 +32,22 @@
 #define VERBOSE 0
 #endif
 
+// instructions run between the checks of the interrupt from gdb
+#define GDB_SLICE   (1 << 20)
+
+// the types of Z packets after BP_SOFTWARE, mini-gdbstub passes them as is
+#define BP_HARDWARE 1
+#define WP_WRITE    2
+#define WP_READ     3
+#define WP_ACCESS   4
+
+// the length of the watchpoints, the kind of Z packets is not passed
+#define WP_LEN      4
+
+static const int watch_type[] = {
+    0, 0, SRV32_WATCH_WRITE, SRV32_WATCH_READ, SRV32_WATCH_ACCESS
+};
+
 static inline bool srv_is_halted(struct rv *rv) {
     return __atomic_load_n(&rv->halt, __ATOMIC_RELAXED);
 }
@@ -48,10 +64,19 @@ static gdb_action_t srv_cont(void *args) {
     struct rv *rv = (struct rv *) args;
 
     for (; !srv_is_halted(rv) && !srv_is_interrupt(rv);) {
-        if (findNode(rv->root, rv->pc) != NULL)
-            break;
+        int result = srv32_run(rv, GDB_SLICE);
+
+        if (result == RV_EXIT)
+            return ACT_SHUTDOWN;
 
-        srv32_step(rv);
+        if (result == RV_BREAK) {
+            if (rv->watch_hit.type)
+                fprintf(stderr, "watchpoint: 0x%08x is %s at pc 0x%08x\n",
+                        rv->watch_hit.addr,
+                        rv->watch_hit.type == SRV32_WATCH_READ ? "read" : "written",
+                        rv->watch_pc);
+            break;
+        }
     }
 
     /* Clear the interrupt if it's pending */
@@ -65,7 +90,8 @@ static gdb_action_t srv_stepi(void *args) {
 
     if (VERBOSE) fprintf(stderr, "stepi\n");
 
-    srv32_step(rv);
+    if (srv32_step(rv) == RV_EXIT)
+        return ACT_SHUTDOWN;
 
     return ACT_RESUME;
 }
@@ -121,26 +147,41 @@ static int srv_write_mem(void *args, size_t addr, size_t len, void *val) {
 static bool srv_set_bp(void *args, size_t addr, bp_type_t type) {
     struct rv *rv = (struct rv *) args;
 
-    if (VERBOSE) fprintf(stderr, "set_bp 0x%08x\n", (uint32_t)addr);
-
-    if (type != BP_SOFTWARE)
-        return true;
-
-    insertNode(&rv->root, addr);
+    if (VERBOSE) {
+        const elf_symbol *sym = elf_find_symbol(rv->elf, addr);
+        fprintf(stderr, "set_bp %d 0x%08x <%s>\n", (int)type, (uint32_t)addr, sym ? sym->name : "");
+    }
 
-    return true;
+    switch((int)type) {
+        case BP_SOFTWARE:
+        case BP_HARDWARE:
+            return srv32_set_breakpoint(rv, addr);
+        case WP_WRITE:
+        case WP_READ:
+        case WP_ACCESS:
+            return srv32_set_watchpoint(rv, addr, WP_LEN, watch_type[type]);
+        default:
+            return false;
+    }
 }
 
 static bool srv_del_bp(void *args, size_t addr, bp_type_t type) {
     struct rv *rv = (struct rv *) args;
 
-    if (VERBOSE) fprintf(stderr, "del_bp 0x%08x\n", (uint32_t)addr);
+    if (VERBOSE) fprintf(stderr, "del_bp %d 0x%08x\n", (int)type, (uint32_t)addr);
 
     // It's fine when there's no matching breakpoint, just doing nothing
-    if (type != BP_SOFTWARE || findNode(rv->root, addr) == NULL)
-        return true;
-
-    deleteNode(&rv->root, addr);
+    switch((int)type) {
+        case BP_SOFTWARE:
+        case BP_HARDWARE:
+            srv32_del_breakpoint(rv, addr);
+            break;
+        case WP_WRITE:
+        case WP_READ:
+        case WP_ACCESS:
+            srv32_del_watchpoint(rv, addr, WP_LEN, watch_type[type]);
+            break;
+    }
 
     return true;
 }
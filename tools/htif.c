@@ -33,15 +33,10 @@
 #include "opcode.h"
 #include "rvsim.h"
 
-void prog_exit(struct rv *rv, int exitcode);
-
-static int result = 0;
-
 int srv32_fromhost(
     struct rv *rv)
 {
-    (void)rv; // no used
-    return result;
+    return rv->htif_result;
 }
 
 void srv32_tohost(
@@ -64,44 +59,71 @@ void srv32_tohost(
 
     switch(func) {
        case SYS_OPEN:
-           result = (int)open((const char*)(a0_ptr),
-                              O_RDWR | O_CREAT /* a1 */,
-                              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH /* a2 */ );
+           if (!srv32_replay_input(rv, func, &rv->htif_result, NULL, 0))
+               rv->htif_result = (int)open((const char*)(a0_ptr),
+                                           O_RDWR | O_CREAT /* a1 */,
+                                           S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH /* a2 */ );
+           srv32_record_input(rv, func, rv->htif_result, NULL);
            break;
        case SYS_CLOSE:
-           result = (int)close(a0);
+           if (!srv32_replay_input(rv, func, &rv->htif_result, NULL, 0))
+               rv->htif_result = (int)close(a0);
+           srv32_record_input(rv, func, rv->htif_result, NULL);
            break;
        case SYS_LSEEK:
-           result = (int)lseek(a0, a1, a2);
+           if (!srv32_replay_input(rv, func, &rv->htif_result, NULL, 0))
+               rv->htif_result = (int)lseek(a0, a1, a2);
+           srv32_record_input(rv, func, rv->htif_result, NULL);
            break;
        case SYS_EXIT:
-           result = 0;
-           prog_exit(rv, a0);
+           rv->htif_result = 0;
+           rv->exited = true;
            break;
        case SYS_READ:
-           result = (int)read(a0, (void *)(a1_ptr), a2);
+           srv32_reverse_mem(rv, a1, a2);
+           if (!srv32_replay_input(rv, func, &rv->htif_result, a1_ptr, a2))
+               rv->htif_result = (int)read(a0, (void *)(a1_ptr), a2);
+           srv32_record_input(rv, func, rv->htif_result, a1_ptr);
+           srv32_flush_icache(rv, a1, a2);
            break;
        case SYS_WRITE:
-           result = (int)write(a0, (const char*)(a1_ptr), a2);
+           // the console output is also written by the replay, but not by
+           // the steps executed again by the debugger
+           if ((a0 == STDOUT || a0 == STDERR) && REV_REPLAY(rv))
+               rv->htif_result = a2;
+           else if (a0 == STDOUT && rv->fo)
+               rv->htif_result = (int)fwrite((const char*)(a1_ptr), 1, a2, rv->fo);
+           else if (a0 == STDOUT || a0 == STDERR ||
+                    !srv32_replay_input(rv, func, &rv->htif_result, NULL, 0)) {
+               rv->htif_result = (int)write(a0, (const char*)(a1_ptr), a2);
+               if (a0 != STDOUT && a0 != STDERR)
+                   srv32_record_input(rv, func, rv->htif_result, NULL);
+           }
            break;
        case SYS_DUMP: {
                FILE *fp;
                int *start = (int*)srv32_get_memptr(rv, a0);
                int *end   = (int*)srv32_get_memptr(rv, a1);
 
-               if ((fp = fopen("dump.txt", "w")) == NULL) {
-                   printf("Create dump.txt fail\n");
-                   exit(1);
-               }
                if ((a0 & 3) != 0 || (a1 & 3) != 0) {
                    printf("Alignment error on memory dumping.\n");
-                   exit(1);
+                   rv->htif_result = -1;
+                   break;
+               }
+               if ((fp = fopen(rv->dumpfile, "w")) == NULL) {
+                   printf("Create %s fail\n", rv->dumpfile);
+                   rv->htif_result = -1;
+                   break;
                }
                while(start != end)
                    fprintf(fp, "%08x\n", *start++);
                fclose(fp);
            }
-           result = 0;
+           rv->htif_result = 0;
+           break;
+       case SYS_ROI:
+           srv32_roi(rv);
+           rv->htif_result = 0;
            break;
        case SYS_DUMP_BIN: {
                FILE *fp;
@@ -110,13 +132,14 @@ void srv32_tohost(
 
                if ((fp = fopen("dump.bin", "wb")) == NULL) {
                    printf("Create dump.bin fail\n");
-                   exit(1);
+                   rv->htif_result = -1;
+                   break;
                }
                while(start != end)
                    fprintf(fp, "%c", *start++);
                fclose(fp);
            }
-           result = 0;
+           rv->htif_result = 0;
            break;
        default:
            break;
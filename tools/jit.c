@@ -0,0 +1,693 @@
+// Copyright © 2020 Kuoping Hsu
+// jit.c: x86-64 code generator for the hot basic blocks of rvsim
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// A compiled block does the same as srv32_exec_block() without the trace
+// log. The guest registers stay in struct rv. The integer and multiply
+// instructions, branches and jumps are translated to host code, and the
+// loads and stores access the memory directly when the address is in the
+// memory and no instruction has been decoded in the page. Otherwise, and
+// for the system instructions, divisions, the B extension and the traps,
+// the compiled code calls the instruction handler of the interpreter.
+//
+// The cycles of a block are committed by srv32_commit() before the handler
+// of a load, store or system instruction is called and when the block is
+// left, so the counters are the same as the interpreter. Registers: rbx = struct rv, r12 = rv_exec.
+
+#ifdef JIT_ENABLED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+// worst case code size of an instruction
+#define JIT_INSN_SIZE   (320)
+#define JIT_BLOCK_SIZE  (BLOCK_MAX * JIT_INSN_SIZE + 64)
+
+#define RV_OFF(field)   ((int32_t)offsetof(struct rv, field))
+#define RV_REG(n)       ((int32_t)(offsetof(struct rv, regs) + (n) * sizeof(int32_t)))
+#define EX_OFF(field)   ((int32_t)offsetof(rv_exec, field))
+
+enum {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    EBX = 3
+};
+
+// x86 condition codes
+enum {
+    CC_B  = 0x2,
+    CC_AE = 0x3,
+    CC_E  = 0x4,
+    CC_NE = 0x5,
+    CC_A  = 0x7,
+    CC_L  = 0xc,
+    CC_GE = 0xd
+};
+
+typedef struct {
+    uint8_t *p;
+} jit_buf;
+
+static inline void emit8(jit_buf *b, uint8_t v) {
+    *b->p++ = v;
+}
+
+static inline void emit32(jit_buf *b, uint32_t v) {
+    memcpy(b->p, &v, sizeof(v));
+    b->p += sizeof(v);
+}
+
+static inline void emit64(jit_buf *b, uint64_t v) {
+    memcpy(b->p, &v, sizeof(v));
+    b->p += sizeof(v);
+}
+
+// op reg, [rbx + disp32]
+static void emit_rbx(jit_buf *b, uint8_t op, int reg, int32_t disp) {
+    emit8(b, op);
+    emit8(b, 0x80 | (reg << 3) | EBX);
+    emit32(b, disp);
+}
+
+// reg = x[n], x0 is always zero
+static void emit_load_reg(jit_buf *b, int reg, int n) {
+    if (n == 0) {
+        emit8(b, 0x31); emit8(b, 0xc0 | (reg << 3) | reg); // xor reg, reg
+    } else {
+        emit_rbx(b, 0x8b, reg, RV_REG(n));                  // mov reg, [x]
+    }
+}
+
+// x[n] = eax, the write to x0 is dropped
+static void emit_store_rd(jit_buf *b, int n) {
+    if (n != 0)
+        emit_rbx(b, 0x89, EAX, RV_REG(n));                  // mov [x], eax
+}
+
+// mov dword [rbx + disp32], imm32
+static void emit_store_imm(jit_buf *b, int32_t disp, int32_t imm) {
+    emit8(b, 0xc7); emit8(b, 0x83); emit32(b, disp); emit32(b, imm);
+}
+
+// srv32_cycle_add(), mtime_update is always clear in a block
+static void emit_cycle_add(jit_buf *b, int32_t count) {
+    emit8(b, 0x48); emit_rbx(b, 0x81, 0, RV_OFF(csr.cycle.c)); emit32(b, count);
+    emit8(b, 0x48); emit_rbx(b, 0x81, 0, RV_OFF(csr.mtime.c)); emit32(b, count);
+}
+
+// the cycles counted by the cause, see srv32_stall()
+static void emit_stall(jit_buf *b, int cause, int32_t count) {
+    int32_t events = RV_OFF(cpi.events) + cause * (int32_t)sizeof(long long);
+    int32_t cycles = RV_OFF(cpi.cycles) + cause * (int32_t)sizeof(long long);
+
+    if (cause <= SRV32_STALL_MRET) {
+        emit8(b, 0x48); emit_rbx(b, 0xff, 0, RV_OFF(cpi.flushes));  // inc qword
+    }
+    emit8(b, 0x48); emit_rbx(b, 0xff, 0, events);               // inc qword
+    emit8(b, 0x48); emit_rbx(b, 0x81, 0, cycles); emit32(b, count);
+    emit_cycle_add(b, count);
+}
+
+// jcc rel32, returns the position to patch
+static uint8_t *emit_jcc(jit_buf *b, int cc) {
+    emit8(b, 0x0f); emit8(b, 0x80 | cc); emit32(b, 0);
+    return b->p - 4;
+}
+
+static uint8_t *emit_jmp(jit_buf *b) {
+    emit8(b, 0xe9); emit32(b, 0);
+    return b->p - 4;
+}
+
+static void patch(jit_buf *b, uint8_t *rel) {
+    int32_t off = (int32_t)(b->p - (rel + 4));
+    memcpy(rel, &off, sizeof(off));
+}
+
+static void emit_call(jit_buf *b, void *func) {
+    emit8(b, 0x48); emit8(b, 0xb8); emit64(b, (uint64_t)(uintptr_t)func); // mov rax, func
+    emit8(b, 0xff); emit8(b, 0xd0);                                       // call rax
+}
+
+static void emit_return(jit_buf *b) {
+    emit8(b, 0x5d);                 // pop rbp
+    emit8(b, 0x41); emit8(b, 0x5c); // pop r12
+    emit8(b, 0x5b);                 // pop rbx
+    emit8(b, 0xc3);                 // ret
+}
+
+// leave the block after the i-th instruction, eax is the result
+static void emit_exit(jit_buf *b, int i) {
+    emit8(b, 0x41); emit8(b, 0xc7); emit8(b, 0x84); emit8(b, 0x24); // mov [r12+count], i+1
+    emit32(b, EX_OFF(count));
+    emit32(b, i + 1);
+    emit_return(b);
+}
+
+// leave the block after a translated control transfer
+static void emit_exit_okay(jit_buf *b, const rv_insn *ir, int i) {
+    emit_store_imm(b, RV_OFF(prev_pc), ir->pc);
+    emit8(b, 0x31); emit8(b, 0xc0); // xor eax, eax
+    emit_exit(b, i);
+}
+
+// call the handler of the interpreter, as srv32_exec_block() does
+static void emit_handler(jit_buf *b, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    uint8_t *fail, *next;
+
+    emit_store_imm(b, RV_OFF(pc), ir->pc);
+    emit_store_imm(b, RV_OFF(prev_pc), ir->pc);
+    emit_store_imm(b, RV_REG(0), 0);
+
+    if (ir->sync || ir->memop) {
+        emit8(b, 0x48); emit8(b, 0x89); emit8(b, 0xdf);  // mov rdi, rbx
+        emit8(b, 0x4c); emit8(b, 0x89); emit8(b, 0xe6);  // mov rsi, r12
+        emit8(b, 0xba); emit32(b, i);                    // mov edx, i
+        emit_call(b, (void*)srv32_commit);
+    }
+
+    emit8(b, 0x48); emit8(b, 0x89); emit8(b, 0xdf);      // mov rdi, rbx
+    emit8(b, 0x48); emit8(b, 0xbe);                      // mov rsi, ir
+    emit64(b, (uint64_t)(uintptr_t)ir);
+    emit_call(b, (void*)ir->handler);
+
+    // mov byte [rbx+mtime_update], 0
+    emit_rbx(b, 0xc6, 0, RV_OFF(mtime_update)); emit8(b, 0);
+
+    emit8(b, 0x85); emit8(b, 0xc0);                      // test eax, eax
+    fail = emit_jcc(b, CC_NE);
+    emit_rbx(b, 0x80, 7, RV_OFF(block_break)); emit8(b, 0); // cmp byte [], 0
+    next = emit_jcc(b, CC_E);
+    patch(b, fail);
+    emit_exit(b, i);
+    patch(b, next);
+}
+
+// edx = address - mem_base if the access of len bytes is in the memory and
+// aligned, or jump to the slow path
+static void emit_address(jit_buf *b, struct rv *rv, const rv_insn *ir,
+                         int len, uint8_t **slow, int *nslow) {
+    emit_load_reg(b, EAX, ir->rs1);
+    if (ir->imm) {
+        emit8(b, 0x05); emit32(b, ir->imm);                 // add eax, imm
+    }
+    if (len > 1) {
+        emit8(b, 0xa8); emit8(b, len - 1);                  // test al, len-1
+        slow[(*nslow)++] = emit_jcc(b, CC_NE);
+    }
+    emit8(b, 0x89); emit8(b, 0xc2);                         // mov edx, eax
+    emit8(b, 0x81); emit8(b, 0xea); emit32(b, rv->mem_base); // sub edx, base
+    emit8(b, 0x81); emit8(b, 0xfa); emit32(b, rv->mem_size - len); // cmp edx, n
+    slow[(*nslow)++] = emit_jcc(b, CC_A);
+    emit8(b, 0x49); emit8(b, 0xb8);                          // mov r8, mem
+    emit64(b, (uint64_t)(uintptr_t)rv->mem);
+}
+
+static void emit_load(jit_buf *b, struct rv *rv, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    uint8_t *slow[2], *next;
+    int nslow = 0;
+    int len;
+
+    // the regions of the platform and the watchpoints are checked by the
+    // interpreter
+    if (!rv->flat || rv->nwatch) {
+        emit_handler(b, blk, i);
+        return;
+    }
+
+    switch(ir->inst.i.func3) {
+        case OP_LB:
+        case OP_LBU: len = 1; break;
+        case OP_LH:
+        case OP_LHU: len = 2; break;
+        case OP_LW:  len = 4; break;
+        default:
+            emit_handler(b, blk, i);
+            return;
+    }
+
+    emit_address(b, rv, ir, len, slow, &nslow);
+
+    switch(ir->inst.i.func3) {
+        case OP_LB:  // movsx eax, byte [r8+rdx]
+            emit8(b, 0x41); emit8(b, 0x0f); emit8(b, 0xbe); break;
+        case OP_LBU: // movzx eax, byte [r8+rdx]
+            emit8(b, 0x41); emit8(b, 0x0f); emit8(b, 0xb6); break;
+        case OP_LH:  // movsx eax, word [r8+rdx]
+            emit8(b, 0x41); emit8(b, 0x0f); emit8(b, 0xbf); break;
+        case OP_LHU: // movzx eax, word [r8+rdx]
+            emit8(b, 0x41); emit8(b, 0x0f); emit8(b, 0xb7); break;
+        case OP_LW:  // mov eax, [r8+rdx]
+            emit8(b, 0x41); emit8(b, 0x8b); break;
+    }
+    emit8(b, 0x04); emit8(b, 0x10);
+
+    emit_store_rd(b, ir->rd);
+    if (rv->singleram) emit_stall(b, SRV32_STALL_SINGLERAM, 1);
+
+    next = emit_jmp(b);
+    while(nslow) patch(b, slow[--nslow]);
+    emit_handler(b, blk, i);
+    patch(b, next);
+}
+
+static void emit_store(jit_buf *b, struct rv *rv, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    uint8_t *slow[4], *next;
+    int nslow = 0;
+    int len;
+
+    // the regions of the platform and the watchpoints are checked by the
+    // interpreter
+    if (!rv->flat || rv->nwatch) {
+        emit_handler(b, blk, i);
+        return;
+    }
+
+    switch(ir->inst.s.func3) {
+        case OP_SB: len = 1; break;
+        case OP_SH: len = 2; break;
+        case OP_SW: len = 4; break;
+        default:
+            emit_handler(b, blk, i);
+            return;
+    }
+
+    emit_address(b, rv, ir, len, slow, &nslow);
+
+    // the pages holding the decoded instructions are written by memrw()
+    emit8(b, 0x48); emit8(b, 0xbe);                          // mov rsi, code_map
+    emit64(b, (uint64_t)(uintptr_t)rv->code_map);
+    emit8(b, 0x89); emit8(b, 0xd1);                          // mov ecx, edx
+    emit8(b, 0xc1); emit8(b, 0xe9); emit8(b, CODE_PAGE_BITS); // shr ecx, bits
+    emit8(b, 0x80); emit8(b, 0x3c); emit8(b, 0x0e); emit8(b, 0); // cmp byte [rsi+rcx], 0
+    slow[nslow++] = emit_jcc(b, CC_NE);
+    if (len > 1) {
+        emit8(b, 0x8d); emit8(b, 0x4a); emit8(b, len - 1);      // lea ecx, [rdx+len-1]
+        emit8(b, 0xc1); emit8(b, 0xe9); emit8(b, CODE_PAGE_BITS);
+        emit8(b, 0x80); emit8(b, 0x3c); emit8(b, 0x0e); emit8(b, 0);
+        slow[nslow++] = emit_jcc(b, CC_NE);
+    }
+
+    emit_load_reg(b, EAX, ir->rs2);
+    switch(ir->inst.s.func3) {
+        case OP_SB: // mov byte [r8+rdx], al
+            emit8(b, 0x41); emit8(b, 0x88); break;
+        case OP_SH: // mov word [r8+rdx], ax
+            emit8(b, 0x66); emit8(b, 0x41); emit8(b, 0x89); break;
+        case OP_SW: // mov dword [r8+rdx], eax
+            emit8(b, 0x41); emit8(b, 0x89); break;
+    }
+    emit8(b, 0x04); emit8(b, 0x10);
+
+    if (rv->singleram) emit_stall(b, SRV32_STALL_SINGLERAM, 1);
+
+    next = emit_jmp(b);
+    while(nslow) patch(b, slow[--nslow]);
+    emit_handler(b, blk, i);
+    patch(b, next);
+}
+
+// eax = x[rs1] op imm
+static bool emit_arithi(jit_buf *b, const rv_insn *ir) {
+    INST inst = ir->inst;
+
+    emit_load_reg(b, EAX, ir->rs1);
+    switch(inst.i.func3) {
+        case OP_ADD: emit8(b, 0x05); emit32(b, ir->imm); break;
+        case OP_XOR: emit8(b, 0x35); emit32(b, ir->imm); break;
+        case OP_OR:  emit8(b, 0x0d); emit32(b, ir->imm); break;
+        case OP_AND: emit8(b, 0x25); emit32(b, ir->imm); break;
+        case OP_SLT:
+        case OP_SLTU:
+            emit8(b, 0x3d); emit32(b, ir->imm);                      // cmp eax, imm
+            emit8(b, 0x0f); emit8(b, inst.i.func3 == OP_SLT ? 0x9c : 0x92); // setl/setb
+            emit8(b, 0xc0);
+            emit8(b, 0x0f); emit8(b, 0xb6); emit8(b, 0xc0);          // movzx eax, al
+            break;
+        case OP_SLL:
+            if (inst.r.func7 != FN_RV32I) return false;
+            emit8(b, 0xc1); emit8(b, 0xe0); emit8(b, ir->imm & 0x1f); // shl eax, imm
+            break;
+        case OP_SR:
+            if (inst.r.func7 == FN_SRL) {
+                emit8(b, 0xc1); emit8(b, 0xe8); emit8(b, ir->imm & 0x1f); // shr eax, imm
+            } else if (inst.r.func7 == FN_SRA) {
+                emit8(b, 0xc1); emit8(b, 0xf8); emit8(b, ir->imm & 0x1f); // sar eax, imm
+            } else {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// eax = x[rs1] op x[rs2]
+static bool emit_arithr(jit_buf *b, const rv_insn *ir) {
+    INST inst = ir->inst;
+    int op = -1;
+
+    switch(inst.r.func7) {
+        case FN_RV32I:
+            switch(inst.r.func3) {
+                case OP_ADD: op = 0x01; break;
+                case OP_XOR: op = 0x31; break;
+                case OP_OR:  op = 0x09; break;
+                case OP_AND: op = 0x21; break;
+                case OP_SLL:
+                case OP_SR:
+                case OP_SLT:
+                case OP_SLTU: op = 0; break;
+            }
+            break;
+        case FN_ANDN:
+            switch(inst.r.func3) {
+                case OP_ADD: op = 0x29; break; // sub
+                case OP_SR:  op = 0; break;    // sra
+            }
+            break;
+        #ifdef RV32M_ENABLED
+        case FN_RV32M:
+            switch(inst.r.func3) {
+                case OP_MUL:
+                case OP_MULH:
+                case OP_MULSU:
+                case OP_MULU: op = 0; break;
+            }
+            break;
+        #endif // RV32M_ENABLED
+    }
+
+    if (op < 0)
+        return false;
+
+    if (op > 0) {
+        emit_load_reg(b, EAX, ir->rs1);
+        emit_load_reg(b, ECX, ir->rs2);
+        emit8(b, op); emit8(b, 0xc8);              // op eax, ecx
+        return true;
+    }
+
+    #ifdef RV32M_ENABLED
+    if (inst.r.func7 == FN_RV32M) {
+        switch(inst.r.func3) {
+            case OP_MUL:
+                emit_load_reg(b, EAX, ir->rs1);
+                emit_load_reg(b, ECX, ir->rs2);
+                emit8(b, 0x0f); emit8(b, 0xaf); emit8(b, 0xc1); // imul eax, ecx
+                return true;
+            case OP_MULH:
+            case OP_MULSU:
+                if (ir->rs1) { // movsxd rax, [x]
+                    emit8(b, 0x48); emit_rbx(b, 0x63, EAX, RV_REG(ir->rs1));
+                } else {
+                    emit_load_reg(b, EAX, 0);
+                }
+                if (ir->rs2 && inst.r.func3 == OP_MULH) { // movsxd rcx, [x]
+                    emit8(b, 0x48); emit_rbx(b, 0x63, ECX, RV_REG(ir->rs2));
+                } else {
+                    emit_load_reg(b, ECX, ir->rs2);
+                }
+                emit8(b, 0x48); emit8(b, 0x0f); emit8(b, 0xaf); emit8(b, 0xc1); // imul rax, rcx
+                emit8(b, 0x48); emit8(b, 0xc1); emit8(b, 0xf8); emit8(b, 32);   // sar rax, 32
+                return true;
+            case OP_MULU:
+                emit_load_reg(b, EAX, ir->rs1);
+                emit_load_reg(b, ECX, ir->rs2);
+                emit8(b, 0x48); emit8(b, 0x0f); emit8(b, 0xaf); emit8(b, 0xc1); // imul rax, rcx
+                emit8(b, 0x48); emit8(b, 0xc1); emit8(b, 0xe8); emit8(b, 32);   // shr rax, 32
+                return true;
+        }
+    }
+    #endif // RV32M_ENABLED
+
+    emit_load_reg(b, EAX, ir->rs1);
+    emit_load_reg(b, ECX, ir->rs2);
+    switch(inst.r.func3) {
+        case OP_SLL:
+            emit8(b, 0xd3); emit8(b, 0xe0); break;   // shl eax, cl
+        case OP_SR:
+            emit8(b, 0xd3);
+            emit8(b, inst.r.func7 == FN_SRA ? 0xf8 : 0xe8); // sar/shr eax, cl
+            break;
+        case OP_SLT:
+        case OP_SLTU:
+            emit8(b, 0x39); emit8(b, 0xc8);          // cmp eax, ecx
+            emit8(b, 0x0f); emit8(b, inst.r.func3 == OP_SLT ? 0x9c : 0x92);
+            emit8(b, 0xc0);
+            emit8(b, 0x0f); emit8(b, 0xb6); emit8(b, 0xc0);
+            break;
+    }
+    return true;
+}
+
+static void emit_branch(jit_buf *b, struct rv *rv, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    int32_t target = ir->pc + ir->imm;
+    uint8_t *not_taken;
+    int cc;
+
+    // condition to skip the branch
+    switch(ir->inst.b.func3) {
+        case OP_BEQ:  cc = CC_NE; break;
+        case OP_BNE:  cc = CC_E;  break;
+        case OP_BLT:  cc = CC_GE; break;
+        case OP_BGE:  cc = CC_L;  break;
+        case OP_BLTU: cc = CC_AE; break;
+        case OP_BGEU: cc = CC_B;  break;
+        default:
+            emit_handler(b, blk, i);
+            return;
+    }
+
+    emit_load_reg(b, EAX, ir->rs1);
+    emit_load_reg(b, ECX, ir->rs2);
+    emit8(b, 0x39); emit8(b, 0xc8);                 // cmp eax, ecx
+    not_taken = emit_jcc(b, cc);
+
+    emit_store_imm(b, RV_OFF(pc), target);
+    emit8(b, 0x48); emit_rbx(b, 0xff, 0, RV_OFF(cpi.taken));    // inc qword
+    if ((!rv->branch_predict || ir->imm > 0) && (target & 3) == 0)
+        emit_stall(b, SRV32_STALL_BRANCH, rv->branch_penalty);
+    emit_exit_okay(b, ir, i);
+
+    patch(b, not_taken);
+
+    // the block goes on when the branch is not taken
+    if (i < blk->n - 1)
+        return;
+    emit_store_imm(b, RV_OFF(pc), ir->compressed ? ir->pc + 2 : ir->pc + 4);
+    emit_exit_okay(b, ir, i);
+}
+
+static void emit_jal(jit_buf *b, struct rv *rv, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    int32_t target = (ir->pc + ir->imm) & ~1;
+
+    // forever loop, leave it to the interpreter
+    if (ir->imm == 0) {
+        emit_handler(b, blk, i);
+        return;
+    }
+
+    emit_store_imm(b, RV_OFF(pc), target);
+
+    #ifndef RV32C_ENABLED
+    if ((target & 3) != 0) {
+        // Instruction address misaligned
+        emit_exit_okay(b, ir, i);
+        return;
+    }
+    #endif // RV32C_ENABLED
+
+    if (ir->rd)
+        emit_store_imm(b, RV_REG(ir->rd), ir->compressed ? ir->pc + 2 : ir->pc + 4);
+    emit_stall(b, SRV32_STALL_JUMP, rv->branch_penalty);
+
+    // the block goes on at the target, see srv32_build_block()
+    if (i < blk->n - 1)
+        return;
+    emit_exit_okay(b, ir, i);
+}
+
+static void emit_jalr(jit_buf *b, struct rv *rv, const rv_block *blk, int i) {
+    const rv_insn *ir = &blk->insn[i];
+    uint8_t *slow[2];
+    int nslow = 0;
+
+    emit_load_reg(b, EAX, ir->rs1);
+    if (ir->imm) {
+        emit8(b, 0x05); emit32(b, ir->imm);          // add eax, imm
+    }
+
+    // forever loop, leave it to the interpreter
+    emit8(b, 0x3d); emit32(b, ir->pc);               // cmp eax, pc
+    slow[nslow++] = emit_jcc(b, CC_E);
+
+    emit8(b, 0x25); emit32(b, ~1);                   // and eax, ~1
+
+    #ifndef RV32C_ENABLED
+    // Instruction address misaligned
+    emit8(b, 0xa8); emit8(b, 3);                     // test al, 3
+    slow[nslow++] = emit_jcc(b, CC_NE);
+    #endif // RV32C_ENABLED
+
+    emit_rbx(b, 0x89, EAX, RV_OFF(pc));              // mov [pc], eax
+    if (ir->rd)
+        emit_store_imm(b, RV_REG(ir->rd), ir->compressed ? ir->pc + 2 : ir->pc + 4);
+    emit_stall(b, SRV32_STALL_JUMP, rv->branch_penalty);
+    emit_exit_okay(b, ir, i);
+
+    while(nslow) patch(b, slow[--nslow]);
+    emit_handler(b, blk, i);
+}
+
+// the registers of RV32E are checked by the handlers
+static bool regs_valid(const rv_insn *ir) {
+    return ir->rd < REGNUM && ir->rs1 < REGNUM && ir->rs2 < REGNUM;
+}
+
+static void jit_flush(struct rv *rv) {
+    int i;
+
+    for(i = 0; i < BCACHE_SIZE; i++) {
+        rv->bcache[i].code = NULL;
+        rv->bcache[i].hits = 0;
+    }
+    rv->jit_used = 0;
+}
+
+rv_jit_fn srv32_jit_compile(struct rv *rv, rv_block *blk) {
+    jit_buf buf;
+    jit_buf *b = &buf;
+    uint8_t *start;
+    int i;
+    int op = blk->insn[blk->n-1].inst.r.op;
+
+    if (rv->jit_used + JIT_BLOCK_SIZE > JIT_CODE_SIZE)
+        jit_flush(rv);
+
+    start = buf.p = rv->jit_code + rv->jit_used;
+
+    // prologue, keep the stack 16-byte aligned for the calls
+    emit8(b, 0x53);                                  // push rbx
+    emit8(b, 0x41); emit8(b, 0x54);                  // push r12
+    emit8(b, 0x55);                                  // push rbp
+    emit8(b, 0x48); emit8(b, 0x89); emit8(b, 0xfb);  // mov rbx, rdi
+    emit8(b, 0x49); emit8(b, 0x89); emit8(b, 0xf4);  // mov r12, rsi
+
+    for(i = 0; i < blk->n; i++) {
+        const rv_insn *ir = &blk->insn[i];
+
+        if (!regs_valid(ir)) {
+            emit_handler(b, blk, i);
+            continue;
+        }
+
+        switch(ir->inst.r.op) {
+            case OP_LUI:
+                emit8(b, 0xb8); emit32(b, ir->imm);  // mov eax, imm
+                emit_store_rd(b, ir->rd);
+                break;
+            case OP_AUIPC:
+                emit8(b, 0xb8); emit32(b, ir->pc + ir->imm);
+                emit_store_rd(b, ir->rd);
+                break;
+            case OP_ARITHI:
+                if (emit_arithi(b, ir))
+                    emit_store_rd(b, ir->rd);
+                else
+                    emit_handler(b, blk, i);
+                break;
+            case OP_ARITHR:
+                if (emit_arithr(b, ir))
+                    emit_store_rd(b, ir->rd);
+                else
+                    emit_handler(b, blk, i);
+                break;
+            case OP_LOAD:
+                emit_load(b, rv, blk, i);
+                break;
+            case OP_STORE:
+                emit_store(b, rv, blk, i);
+                break;
+            case OP_FENCE:
+                break;
+            case OP_BRANCH:
+                emit_branch(b, rv, blk, i);
+                break;
+            case OP_JAL:
+                emit_jal(b, rv, blk, i);
+                break;
+            case OP_JALR:
+                emit_jalr(b, rv, blk, i);
+                break;
+            default:
+                // system instructions, illegal instructions and traps
+                emit_handler(b, blk, i);
+                break;
+        }
+    }
+
+    // the block ends without any control transfer, otherwise the PC has
+    // been updated by the handler of the last instruction
+    if (op != OP_BRANCH && op != OP_JAL && op != OP_JALR && op != OP_SYSTEM)
+        emit_store_imm(b, RV_OFF(pc), blk->end);
+    emit_store_imm(b, RV_OFF(prev_pc), blk->insn[blk->n-1].pc);
+    emit8(b, 0x31); emit8(b, 0xc0);                  // xor eax, eax
+    emit_exit(b, blk->n - 1);
+
+    rv->jit_used = (rv->jit_used + (int32_t)(b->p - start) + 15) & ~15;
+
+    return (rv_jit_fn)(void*)start;
+}
+
+bool srv32_jit_init(struct rv *rv) {
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+        return false;
+
+    rv->jit_code = (uint8_t*)code;
+    rv->jit_used = 0;
+    return true;
+}
+
+void srv32_jit_free(struct rv *rv) {
+    if (rv->jit_code)
+        munmap(rv->jit_code, JIT_CODE_SIZE);
+    rv->jit_code = NULL;
+}
+
+#endif // JIT_ENABLED
+
@@ -0,0 +1,229 @@
+// Copyright © 2020 Kuoping Hsu
+// librvsim.h
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Interface of the rvsim library (librvsim.a and librvsim.so). Each
+// simulator instance is a handle created by srv32_create(), all of the
+// state is kept in the handle, so that several instances can be run in
+// one process.
+
+#ifndef __LIBRVSIM_H__
+#define __LIBRVSIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// opaque simulator handle
+struct rv;
+
+// results of srv32_step() and srv32_run()
+enum {
+    RV_OKAY = 0,
+    RV_TRAP = 1,
+    RV_EXIT = 2,
+    RV_ROI  = 3,            // srv32_run() stops at the ROI marker, see cfg.roi
+    RV_BREAK = 4            // srv32_run() stops at a breakpoint or a watchpoint
+};
+
+// types of the watchpoints
+enum {
+    SRV32_WATCH_READ   = 1,
+    SRV32_WATCH_WRITE  = 2,
+    SRV32_WATCH_ACCESS = 3
+};
+
+typedef struct srv32_config {
+    int32_t     mem_base;       // memory base
+    int32_t     mem_size;       // memory size for iram and dram (in bytes)
+    int32_t     branch_penalty; // branch penalty
+    bool        branch_predict; // static branch prediction
+    bool        singleram;      // single RAM
+    bool        jit;            // compile the hot blocks to x86-64 code
+    bool        spin;           // fast-forward the spin loops
+    bool        quiet;          // no statistics from srv32_report()
+    bool        roi;            // srv32_run() returns RV_ROI at the first SYS_ROI marker
+    const char *logfile;        // trace log file, binary for .bin, NULL if not generated
+    const char *dumpfile;       // memory dump of SYS_DUMP, dump.txt if NULL
+    const char *outfile;        // console output, stdout if NULL
+    const char *platform;       // memory regions, mem_base/mem_size if NULL
+    const char *profile;        // flat profile written by srv32_destroy(), NULL if not generated
+    uint32_t    profile_period; // profile sample period in cycles, 0 counts each instruction
+    const char *callgraph;      // folded call stacks written by srv32_destroy(), NULL if not generated
+    const char *stats;          // CPI breakdown in JSON written by srv32_destroy(), NULL if not generated
+    const char *record;         // log of the host inputs to replay, NULL if not recorded
+    const char *replay;         // replay the host inputs of the log instead of the host
+} srv32_config;
+
+typedef struct srv32_stat {
+    long long cycle;
+    long long instret;
+    long long overhead;         // RV32C overhead cycles
+    int32_t   pc;
+    int32_t   exitcode;         // valid after srv32_run() returns RV_EXIT
+} srv32_stat;
+
+// causes of the cycles more than one per instruction
+enum {
+    SRV32_STALL_BRANCH = 0,     // taken branches flush the pipeline
+    SRV32_STALL_JUMP,           // jal and jalr
+    SRV32_STALL_TRAP,           // traps redirect to mtvec
+    SRV32_STALL_INTERRUPT,      // interrupts taken
+    SRV32_STALL_MRET,           // mret
+    SRV32_STALL_SINGLERAM,      // single RAM structural stalls of the loads and stores
+    SRV32_STALL_FETCH,          // wait states of the instruction fetch
+    SRV32_STALL_MEMORY,         // wait states of the loads and stores
+    SRV32_STALL_COMPRESSED,     // RV32C instruction type changes
+    SRV32_STALL_WFI,            // idle cycles of wfi
+    SRV32_STALL_MAX
+};
+
+// classes of the executed instructions
+enum {
+    SRV32_CLASS_ALU = 0,        // integer operations, lui and auipc
+    SRV32_CLASS_MUL,            // mul, mulh, mulhsu and mulhu
+    SRV32_CLASS_DIV,            // div, divu, rem and remu
+    SRV32_CLASS_BITMANIP,       // B extension
+    SRV32_CLASS_LOAD,
+    SRV32_CLASS_STORE,
+    SRV32_CLASS_BRANCH,
+    SRV32_CLASS_JAL,
+    SRV32_CLASS_JALR,
+    SRV32_CLASS_CSR,
+    SRV32_CLASS_SYSTEM,         // ecall, ebreak, mret and wfi
+    SRV32_CLASS_FENCE,
+    SRV32_CLASS_ILLEGAL,
+    SRV32_CLASS_MAX
+};
+
+// The cycles are instret plus the stall cycles of all causes. The classes
+// are only counted when cfg.stats is given, since each instruction is
+// counted.
+typedef struct srv32_cpi {
+    long long cycle;
+    long long instret;
+    long long events[SRV32_STALL_MAX];  // the times of each cause
+    long long cycles[SRV32_STALL_MAX];  // the stall cycles of each cause
+    long long iclass[SRV32_CLASS_MAX];  // the instructions of each class
+    long long compressed;               // RV32C instructions
+    long long taken;                    // taken branches, also the predicted ones
+    long long flushes;                  // branch penalties of all causes
+} srv32_cpi;
+
+// kind of the retired instruction
+enum {
+    SRV32_RETIRE_NONE  = 0,     // no register or memory is written
+    SRV32_RETIRE_REG   = 1,     // register rd <= data
+    SRV32_RETIRE_READ  = 2,     // load from addr, register rd <= data
+    SRV32_RETIRE_WRITE = 3      // store data to addr
+};
+
+// a retired instruction, the same fields as its line of the trace log
+typedef struct srv32_retired {
+    uint32_t cycle;             // lower 32 bits of the cycle counter
+    uint32_t pc;
+    uint32_t inst;
+    int32_t  kind;              // SRV32_RETIRE_*
+    int32_t  rd;
+    uint32_t addr;
+    uint32_t data;
+} srv32_retired;
+
+// A memory mapped device of [base, base+size). The callbacks get the offset
+// from base and the access size of 1, 2 or 4 bytes, and return false for an
+// access fault. The data of a store is the register, not masked to the size.
+typedef struct srv32_device {
+    const char *name;
+    uint32_t    base;
+    uint32_t    size;
+    bool      (*read)(struct rv *rv, void *priv, uint32_t offset, int len, int32_t *data);
+    bool      (*write)(struct rv *rv, void *priv, uint32_t offset, int len, int32_t data);
+    void       *priv;
+} srv32_device;
+
+// fill the default configuration
+void srv32_config_default(srv32_config *cfg);
+
+// create a simulator, NULL if the memory can not be allocated
+struct rv *srv32_create(const srv32_config *cfg);
+
+// load an ELF file and reset the simulator, false if it fails
+bool srv32_load(struct rv *rv, const char *file);
+
+// run count instructions, or until the program exits if count < 0,
+// returns RV_EXIT when the program exits, RV_ROI when it stops at the
+// ROI marker of cfg.roi, RV_BREAK when it stops at a breakpoint or a
+// watchpoint, otherwise RV_OKAY
+int srv32_run(struct rv *rv, long long count);
+
+// run until the next instruction is retired and fill r, it is used to
+// check the RTL in lockstep. Returns RV_EXIT when the program exits.
+int srv32_retire(struct rv *rv, srv32_retired *r);
+
+// query the counters and the exit code
+void srv32_get_stat(struct rv *rv, srv32_stat *stat);
+
+// query the CPI breakdown by the stall causes and the instruction classes
+void srv32_get_cpi(struct rv *rv, srv32_cpi *cpi);
+
+// print the statistics
+void srv32_report(struct rv *rv);
+
+// map a device, the devices are found by the 4 KB page of the address, so
+// they can not share a page. Returns false if the device overlaps the
+// memory or the other devices.
+bool srv32_add_device(struct rv *rv, const srv32_device *dev);
+
+// Set or delete a breakpoint of the memory, srv32_run() returns RV_BREAK
+// before the instruction at pc. False if pc is out of the memory.
+bool srv32_set_breakpoint(struct rv *rv, int32_t pc);
+void srv32_del_breakpoint(struct rv *rv, int32_t pc);
+
+// Set or delete a watchpoint of the memory [addr, addr+len), srv32_run()
+// returns RV_BREAK after the instruction accessing it by the type. False if
+// the range is out of the memory or there are 16 watchpoints already.
+bool srv32_set_watchpoint(struct rv *rv, int32_t addr, int32_t len, int type);
+void srv32_del_watchpoint(struct rv *rv, int32_t addr, int32_t len, int type);
+
+// Save the registers, the CSRs, the counters and the memory to the
+// checkpoint file, false if the file can not be written.
+bool srv32_checkpoint_save(struct rv *rv, const char *file);
+
+// Restore the checkpoint instead of srv32_load(), the symbols are read from
+// the ELF file of the checkpoint. The memory and the instruction sets should
+// be the same as the simulator saving it, the timing is of this simulator.
+// Returns false if the checkpoint can not be restored.
+bool srv32_checkpoint_restore(struct rv *rv, const char *file);
+
+// free the simulator
+void srv32_destroy(struct rv *rv);
+
+int32_t srv32_read_regs(struct rv *rv, int n);
+void srv32_write_regs(struct rv *rv, int n, int32_t v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LIBRVSIM_H__
+
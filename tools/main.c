@@ -0,0 +1,445 @@
+// Copyright © 2020 Kuoping Hsu
+// main.c: command line of the Instruction Set Simulator
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+#ifdef GDBSTUB
+extern struct target_ops gdbstub_ops;
+#endif
+
+#define MAXLEN      1024
+
+int debug(struct rv *rv);
+int srv32_batch(const char *list, int jobs, const char *summary,
+                const srv32_config *defaults);
+int srv32_fanout(const char *file, const char *list, int jobs,
+                 const char *summary, const srv32_config *defaults);
+int srv32_compare(const char *file1, const char *file2, int window,
+                  bool nocycle);
+
+void usage(void) {
+// LCOV_EXCL_START
+    printf(
+"Instruction Set Simulator for RV32IM, (c) 2020 Kuoping Hsu\n"
+"Usage: rvsim [-h] [-d] [-g port] [-m n] [-n n] [-b n] [-p] [-l logfile]\n"
+"             [--profile file [--sample n]] [--callgraph file]\n"
+"             [--stats file] [--save-checkpoint n file]\n"
+"             [--record file | --replay file] file\n"
+"       rvsim --restore file [options]\n"
+"       rvsim --batch list [-j n] [--summary file] [-m n] [-n n] [-b n] [-p]\n"
+"       rvsim --fanout list [-j n] [--summary file] [options] file\n"
+"       rvsim --convert file [-l logfile]\n"
+"       rvsim --compare file1 file2 [--window n] [--nocycle]\n\n"
+"       --help, -h              help\n"
+"       --debug, -d             interactive debug mode\n"
+"       --gdb port, -g port     enable gdb debugger with port\n"
+"       --quiet, -q             quite\n"
+"       --membase n, -m n       memory base\n"
+"       --memsize n, -n n       memory size for iram and dram each (in Kb)\n"
+"       --branch n, -b n        branch penalty (default 2)\n"
+"       --single, -s            single RAM\n"
+"       --predict, -p           static branch prediction\n"
+"       --log file, -l file     generate log file, binary trace for .bin\n"
+"       --jit                   compile the hot blocks to x86-64 code\n"
+"       --nospin                do not fast-forward the spin loops\n"
+"       --platform file         memory regions of the platform\n"
+"       --profile file          write the flat profile of the functions\n"
+"       --sample n              sample the profile every n cycles (default 0, each\n"
+"                               instruction is counted)\n"
+"       --callgraph file        write the folded call stacks for the flame graph\n"
+"       --stats file            write the CPI breakdown by the stall causes and the\n"
+"                               instruction classes in JSON\n"
+"       --save-checkpoint n file\n"
+"                               save the checkpoint after n instructions\n"
+"       --restore file          run from the checkpoint instead of the elf file\n"
+"       --record file           record the inputs of the console and the files\n"
+"       --replay file           replay the recorded inputs instead of the host\n"
+"       --batch list            run the elf files of the list file\n"
+"       --fanout list           run to the ROI marker, then fork the runs of the\n"
+"                               list file\n"
+"       --jobs n, -j n          number of the batch threads or the forked runs\n"
+"                               (default all cores)\n"
+"       --summary file          batch summary, JSON for .json, CSV otherwise\n"
+"       --convert file          convert the binary trace to the text log\n"
+"       --compare file1 file2   find the first difference of the trace logs\n"
+"       --window n              lines shown around the difference (default 5)\n"
+"       --nocycle               ignore the cycle column of the trace logs\n"
+"\n"
+"       file                    the elf executable file\n"
+"\n"
+    );
+// LCOV_EXCL_STOP
+}
+
+#ifndef __STDC_WANT_LIB_EXT1__
+char *strncpy_s(char *dest, size_t n, const char *src, size_t count) {
+    int len = (int)strnlen(src, count);
+    if (len > n) len = n;
+    memcpy(dest, src, len);
+    dest[len] = 0;
+    return dest;
+}
+#endif // __STDC_WANT_LIB_EXT1__
+
+int main(int argc, char **argv) {
+    struct rv *rv = NULL;
+    srv32_config cfg;
+    char *file = NULL;
+    char *tfile = NULL;
+    int debug_en = 0;
+    int exitcode;
+    char *batch = NULL;
+    char *fanout = NULL;
+    char *summary = NULL;
+    char *convert = NULL;
+    char *compare = NULL;
+    int window = 5;
+    bool nocycle = false;
+    int jobs = 0;
+    long long ckpt_at = -1;
+    char *ckpt_file = NULL;
+    char *restore = NULL;
+
+    #ifdef GDBSTUB
+    int gdbport = 0;
+    #endif
+
+    const char *optstring = "hdg:b:pl:qm:n:sj:";
+    int c;
+    struct option opts[] = {
+        {"help", 0, NULL, 'h'},
+        {"debug", 0, NULL, 'd'},
+        {"gdb", 1, NULL, 'g'},
+        {"branch", 1, NULL, 'b'},
+        {"predict", 0, NULL, 'p'},
+        {"log", 1, NULL, 'l'},
+        {"quiet", 0, NULL, 'q'},
+        {"membase", 1, NULL, 'm'},
+        {"memsize", 1, NULL, 'n'},
+        {"single", 0, NULL, 's'},
+        {"jit", 0, NULL, 'J'},
+        {"nospin", 0, NULL, 'S'},
+        {"platform", 1, NULL, 'P'},
+        {"batch", 1, NULL, 'B'},
+        {"jobs", 1, NULL, 'j'},
+        {"summary", 1, NULL, 'R'},
+        {"convert", 1, NULL, 'C'},
+        {"compare", 1, NULL, 'D'},
+        {"window", 1, NULL, 'W'},
+        {"nocycle", 0, NULL, 'T'},
+        {"profile", 1, NULL, 'F'},
+        {"sample", 1, NULL, 'A'},
+        {"callgraph", 1, NULL, 'G'},
+        {"stats", 1, NULL, 'X'},
+        {"save-checkpoint", 1, NULL, 'K'},
+        {"restore", 1, NULL, 'E'},
+        {"fanout", 1, NULL, 'U'},
+        {"record", 1, NULL, 'V'},
+        {"replay", 1, NULL, 'Y'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // set default value
+    srv32_config_default(&cfg);
+
+    while((c = getopt_long(argc, argv, optstring, opts, NULL)) != -1) {
+        switch(c) {
+            case 'h':
+                usage();
+                return 1;
+            case 'g':
+                #ifdef GDBSTUB
+                gdbport = atoi(optarg);
+                #else
+                fprintf(stderr, "gdbstub does not support.\n");
+                return 1;
+                #endif
+                break;
+            case 'd':
+                debug_en = 1;
+                break;
+            case 'b':
+                cfg.branch_penalty = atoi(optarg);
+                break;
+            case 'p':
+                cfg.branch_predict = true;
+                break;
+            case 'l':
+                if ((tfile = malloc(MAXLEN)) == NULL) {
+                    // LCOV_EXCL_START
+                    printf("malloc fail\n");
+                    exit(1);
+                    // LCOV_EXCL_STOP
+                }
+                strncpy_s(tfile, MAXLEN-1, optarg, MAXLEN-1);
+                break;
+            case 'q':
+                cfg.quiet = true;
+                break;
+            case 'm':
+                sscanf(optarg, "%i", &cfg.mem_base);
+                break;
+            case 'n':
+                sscanf(optarg, "%i", &cfg.mem_size);
+                // assume instruction and data RAM are the same size
+                // the total size is mem_size * 2 * 1024
+                cfg.mem_size *= (2*1024);
+                break;
+            case 's':
+                cfg.singleram = true;
+                break;
+            case 'J':
+                #ifdef JIT_ENABLED
+                cfg.jit = true;
+                #else
+                fprintf(stderr, "JIT does not support.\n");
+                return 1;
+                #endif
+                break;
+            case 'S':
+                cfg.spin = false;
+                break;
+            case 'P':
+                cfg.platform = optarg;
+                break;
+            case 'B':
+                batch = optarg;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 'R':
+                summary = optarg;
+                break;
+            case 'C':
+                convert = optarg;
+                break;
+            case 'D':
+                compare = optarg;
+                break;
+            case 'W':
+                window = atoi(optarg);
+                break;
+            case 'T':
+                nocycle = true;
+                break;
+            case 'F':
+                cfg.profile = optarg;
+                break;
+            case 'A':
+                cfg.profile_period = (uint32_t)atoi(optarg);
+                break;
+            case 'G':
+                cfg.callgraph = optarg;
+                break;
+            case 'X':
+                cfg.stats = optarg;
+                break;
+            case 'K':
+                // the instructions and the file
+                if (optind >= argc) {
+                    usage();
+                    printf("Error: missing the checkpoint file.\n\n");
+                    return 1;
+                }
+                ckpt_at = atoll(optarg);
+                ckpt_file = argv[optind++];
+                break;
+            case 'E':
+                restore = optarg;
+                break;
+            case 'U':
+                fanout = optarg;
+                break;
+            case 'V':
+                cfg.record = optarg;
+                break;
+            case 'Y':
+                cfg.replay = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (batch) {
+        free(tfile);
+        return srv32_batch(batch, jobs, summary, &cfg);
+    }
+
+    if (fanout) {
+        free(tfile);
+        if (optind >= argc) {
+            usage();
+            printf("Error: missing input file.\n\n");
+            return 1;
+        }
+        return srv32_fanout(argv[optind], fanout, jobs, summary, &cfg);
+    }
+
+    if (convert) {
+        FILE *fp = stdout;
+        if (tfile && (fp = fopen(tfile, "w")) == NULL) {
+            printf("can not open file %s\n", tfile);
+            return 1;
+        }
+        exitcode = trace_convert(convert, fp);
+        if (fp != stdout) fclose(fp);
+        free(tfile);
+        return exitcode;
+    }
+
+    if (compare) {
+        free(tfile);
+        if (optind >= argc) {
+            usage();
+            printf("Error: missing the second trace log.\n\n");
+            return 2;
+        }
+        return srv32_compare(compare, argv[optind], window, nocycle);
+    }
+
+    // the elf file is given by the checkpoint of --restore
+    if (optind < argc && !restore) {
+        if ((file = malloc(MAXLEN)) == NULL) {
+            // LCOV_EXCL_START
+            printf("malloc fail\n");
+            exit(1);
+            // LCOV_EXCL_STOP
+        }
+        strncpy_s(file, MAXLEN-1, argv[optind], MAXLEN-1);
+    } else if (!restore) {
+        usage();
+        printf("Error: missing input file.\n\n");
+        return 1;
+    }
+
+    if (!file && !restore) {
+        usage();
+        return 1;
+    }
+
+    cfg.logfile = tfile;
+
+    if ((rv = srv32_create(&cfg)) == NULL) {
+        // LCOV_EXCL_START
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+
+    rv->debug_en = debug_en;
+
+    if (restore) {
+        if (!srv32_checkpoint_restore(rv, restore)) {
+            srv32_destroy(rv);
+            free(tfile);
+            return 1;
+        }
+    } else if (!srv32_load(rv, file)) {
+        // LCOV_EXCL_START
+        printf("Can not read elf file %s\n", file);
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+
+    #ifdef GDBSTUB
+    // LCOV_EXCL_START
+    if (gdbport != 0) {
+        static char gdbstub_port[] = "127.0.0.1:xxxxxx";
+
+        snprintf(gdbstub_port, sizeof(gdbstub_port)-1, "127.0.0.1:%d", gdbport);
+        gdbstub_port[sizeof(gdbstub_port)-1] = 0; // ensure that the string is end of NULL
+
+        fprintf(stderr, "start gdbstub at %s...\n", gdbstub_port);
+
+        if (!gdbstub_init(&rv->gdbstub, &gdbstub_ops,
+                  (arch_info_t){
+                      .reg_num = REGNUM+1,
+                      .smp = 1,
+                      .target_desc = TARGET_RV32,
+                  }, gdbstub_port)) {
+            fprintf(stderr, "Fail to create socket.\n");
+            goto main_exit;
+        }
+
+        if (!gdbstub_run(&rv->gdbstub, (void *) rv))
+            goto main_exit;
+
+        gdbstub_close(&rv->gdbstub);
+
+        goto main_exit;
+    }
+    // LCOV_EXCL_STOP
+    #endif // GDBSTUB
+
+    // Execution loop
+    if (rv->debug_en) {
+        // the debugger can step back
+        if (!srv32_reverse_init(rv)) {
+            // LCOV_EXCL_START
+            exit(1);
+            // LCOV_EXCL_STOP
+        }
+        do {
+            if (debug(rv) == RV_EXIT)
+                break;
+            if (srv32_step(rv) == RV_EXIT)
+                break;
+        } while(1);
+    } else {
+        // n is counted from the start of the program, also after a restore
+        if (ckpt_file) {
+            if (ckpt_at > rv->csr.instret.c)
+                srv32_run(rv, ckpt_at - rv->csr.instret.c);
+            if (rv->exited)
+                printf("The program exits before the checkpoint\n");
+            else if (!srv32_checkpoint_save(rv, ckpt_file)) {
+                srv32_destroy(rv);
+                free(file);
+                free(tfile);
+                return 1;
+            }
+        }
+        srv32_run(rv, -1);
+    }
+
+main_exit:
+    if (rv->debug_en) {
+        exitcode = 0;
+    } else {
+        srv32_report(rv);
+        exitcode = rv->exitcode;
+    }
+
+    srv32_destroy(rv);
+    free(file);
+    free(tfile);
+
+    return exitcode;
+}
@@ -284,6 +284,9 @@ enum {
     OP_CSRRCI  = 7
 };
 
+// inst[31:20] of WFI, func3 = OP_ECALL
+#define WFI_IMM     0x105
+
 enum {
     OP_CLWSP        = 2,
     OP_CSWSP        = 6,
@@ -353,6 +356,10 @@ enum {
     CSR_MTVAL       = 0x343,    // Machine bad address or instructions
     CSR_MIP         = 0x344,    // Machine interrupt pending
 
+    CSR_MHPMEVENT3  = 0x323,    // Machine performance-monitoring event selector 3..31
+    CSR_MHPMCOUNTER3 = 0xb03,   // Machine performance-monitoring counter 3..31
+    CSR_MHPMCOUNTER3H = 0xb83,  // upper 32-bits of performance-monitoring counter 3..31
+
     CSR_SSTATUS     = 0x100,    // Supervisor status register
     CSR_SIE         = 0x104,    // Supervisor interrupt-enable register
     CSR_STVEC       = 0x105,    // Supervisor trap handler base address
@@ -382,7 +389,8 @@ enum {
     SYS_EXIT        = 0x005d,
     SYS_SBRK        = 0x00d6,
     SYS_DUMP        = 0x0088,
-    SYS_DUMP_BIN    = 0x0099
+    SYS_DUMP_BIN    = 0x0099,
+    SYS_ROI         = 0x00aa    // the region of interest starts
 };
 
 // Exception code
@@ -408,6 +416,27 @@ enum {
     INT_MEI         = (1<<31)|11    // Machine external interrupt
 };
 
+// number of the implemented mhpmcounters from mhpmcounter3, the others
+// are hardwired to zero, the same as HPMCOUNTERS of the RTL
+#ifndef HPM_COUNTERS
+#define HPM_COUNTERS    4
+#endif // HPM_COUNTERS
+
+// events of mhpmevent
+enum {
+    HPM_NONE        = 0,
+    HPM_BRANCH      = 1,        // taken branches
+    HPM_FLUSH       = 2,        // pipeline flushes of the branches, jumps and traps
+    HPM_LOAD        = 3,        // loads
+    HPM_STORE       = 4,        // stores
+    HPM_IMEM_STALL  = 5,        // cycles of the instruction fetch stalls
+    HPM_DMEM_STALL  = 6,        // cycles of the load and store stalls
+    HPM_INTERRUPT   = 7,        // interrupts taken
+    HPM_COMPRESSED  = 8,        // compressed instructions
+    HPM_MULDIV      = 9,        // M extension instructions
+    HPM_EVENTS      = 10
+};
+
 typedef union _counter {
     long long c;
     struct {
@@ -532,14 +561,18 @@ typedef struct _CSR {
 #define MHARTID       0
 #define MISA          ((1<<30)|(RV32M<<12)|(1<<8)|(RV32E<<4)|(RV32B<<1))
 
-#define MMIO_PUTC     0xa000001c /* 32-bits */
-#define MMIO_GETC     0xa0000020 /* 32-bits */
-#define MMIO_EXIT     0xa000002c /* 32-bits */
-#define MMIO_TOHOST   0xa0000030 /* 32-bits */
-#define MMIO_FROMHOST 0xa0000034 /* 32-bits */
-#define MMIO_MTIME    0x90000000 /* 64-bits */
-#define MMIO_MTIMECMP 0x90000008 /* 64-bits */
-#define MMIO_MSIP     0x90000010 /* 32-bits */
+#define MMIO_HOST       0xa0000000
+#define MMIO_HOST_SIZE  0x38
+#define MMIO_PUTC       0xa000001c /* 32-bits */
+#define MMIO_GETC       0xa0000020 /* 32-bits */
+#define MMIO_EXIT       0xa000002c /* 32-bits */
+#define MMIO_TOHOST     0xa0000030 /* 32-bits */
+#define MMIO_FROMHOST   0xa0000034 /* 32-bits */
+#define MMIO_CLINT      0x90000000
+#define MMIO_CLINT_SIZE 0x14
+#define MMIO_MTIME      0x90000000 /* 64-bits */
+#define MMIO_MTIMECMP   0x90000008 /* 64-bits */
+#define MMIO_MSIP       0x90000010 /* 32-bits */
 
 #define STDIN  0
 #define STDOUT 1
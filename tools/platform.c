@@ -0,0 +1,131 @@
+// Copyright © 2020 Kuoping Hsu
+// platform description, shared by rvsim and the Verilator harness
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+
+#define MAXLEN 256
+
+// the number with the suffix K or M, the size can not be zero
+static int parse_size(const char *s, uint32_t *size, bool zero)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 0);
+
+    switch(*end) {
+        case 'k': case 'K': n *= 1024; end++; break;
+        case 'm': case 'M': n *= 1024 * 1024; end++; break;
+    }
+
+    if (*end != 0 || (n == 0 && !zero) || n > 0xffffffffULL)
+        return 0;
+
+    *size = (uint32_t)n;
+    return 1;
+}
+
+int platform_read(platform *p, const char *file)
+{
+    FILE *fp;
+    char line[MAXLEN];
+    int lineno = 0;
+    int i;
+
+    memset(p, 0, sizeof(platform));
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        printf("Can not open file %s\n", file);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        char name[16], base[32], size[32], access[8] = "rw";
+        int latency = 0;
+        platform_region *r;
+        char *c;
+        int n;
+
+        lineno++;
+        if ((c = strchr(line, '#')) != NULL)
+            *c = 0;
+
+        n = sscanf(line, "%15s %31s %31s %d %7s", name, base, size, &latency, access);
+        if (n <= 0)
+            continue;
+
+        if (p->nregions >= PLATFORM_MAX) {
+            printf("%s:%d: too many regions\n", file, lineno);
+            goto fail;
+        }
+
+        r = &p->region[p->nregions];
+        if (n < 3 || !parse_size(base, &r->base, true) ||
+            !parse_size(size, &r->size, false) ||
+            (uint64_t)r->base + r->size > 0x100000000ULL || latency < 0 ||
+            (strcmp(access, "rw") && strcmp(access, "ro"))) {
+            printf("%s:%d: syntax error\n", file, lineno);
+            goto fail;
+        }
+
+        memcpy(r->name, name, sizeof(r->name));
+        r->latency  = latency;
+        r->readonly = !strcmp(access, "ro");
+
+        for(i = 0; i < p->nregions; i++) {
+            const platform_region *o = &p->region[i];
+            if ((uint64_t)r->base < (uint64_t)o->base + o->size &&
+                (uint64_t)o->base < (uint64_t)r->base + r->size) {
+                printf("%s:%d: region %s overlaps %s\n", file, lineno, r->name, o->name);
+                goto fail;
+            }
+        }
+
+        p->nregions++;
+    }
+
+    fclose(fp);
+
+    if (p->nregions == 0) {
+        printf("%s: no memory region\n", file);
+        return 0;
+    }
+
+    return 1;
+
+fail:
+    fclose(fp);
+    return 0;
+}
+
+const platform_region *platform_find(const platform *p, uint32_t addr, uint32_t len)
+{
+    int i;
+
+    for(i = 0; i < p->nregions; i++) {
+        const platform_region *r = &p->region[i];
+        if (addr - r->base < r->size && len <= r->size - (addr - r->base))
+            return r;
+    }
+
+    return NULL;
+}
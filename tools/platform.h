@@ -0,0 +1,64 @@
+// Copyright © 2020 Kuoping Hsu
+// platform description, shared by rvsim and the Verilator harness
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __PLATFORM_H
+#define __PLATFORM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PLATFORM_MAX 8
+
+// A memory region of the platform. Each access, including the instruction
+// fetch, takes the wait states of latency cycles.
+typedef struct platform_region {
+    char     name[16];
+    uint32_t base;
+    uint32_t size;
+    int      latency;
+    bool     readonly;
+} platform_region;
+
+typedef struct platform {
+    int             nregions;
+    platform_region region[PLATFORM_MAX];
+} platform;
+
+// Read the platform description, each line is a region
+//
+//     name  base  size  [latency]  [rw|ro]
+//
+// The size can have the suffix K or M, the text after '#' is a comment.
+// Returns 0 if the file can not be read or the regions overlap.
+int platform_read(platform *p, const char *file);
+
+// the region holding [addr, addr+len), NULL if not found
+const platform_region *platform_find(const platform *p, uint32_t addr, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PLATFORM_H
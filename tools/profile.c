@@ -0,0 +1,585 @@
+// Copyright © 2020 Kuoping Hsu
+// profile.c: flat profile and call graph of the cycles by the ELF symbols
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// The cycles are counted for each halfword of the memory in rv->prof, and
+// resolved against the symbols of the ELF file when the profile is
+// written. When the period is 0, each instruction adds the cycles since
+// the previous one and the instructions are counted, the blocks are
+// committed instruction by instruction as the trace log. Otherwise the
+// program is sampled every period cycles at the block boundaries, which
+// costs nearly nothing, and the sample is placed in the block by the
+// cycles of the instructions.
+//
+// The call graph follows the calls (jal/jalr with rd = ra or t0) and the
+// returns (jalr x0 with rs1 = ra or t0) on a shadow call stack, and adds
+// the cycles between them to the call path on the top. A return pops the
+// frames up to the one of the return address, so the tail calls and
+// longjmp do not break the stack. A trap pushes a pseudo-frame after the
+// stack is saved by sp and mepc, mret restores the stack saved with the
+// new sp and pc, so the tasks switched by the trap handler keep their own
+// stacks. The events are checked after each block, so the JIT and the
+// spin loops are kept.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+typedef struct profile_func {
+    const char *name;
+    uint32_t    addr;
+    uint64_t    cycles;
+    uint64_t    instret;
+} profile_func;
+
+bool srv32_profile_init(struct rv *rv, const char *file, uint32_t period) {
+    rv_profile *p;
+
+    if ((p = (rv_profile*)calloc(1, sizeof(rv_profile))) == NULL) {
+        // LCOV_EXCL_START
+        return false;
+        // LCOV_EXCL_STOP
+    }
+    rv->prof = p;
+
+    p->period = period;
+    p->size   = ((uint32_t)rv->mem_size >> 1) + 1;
+
+    // only the pages of the executed code are committed
+    p->hist = (profile_entry*)mmap(NULL, p->size * sizeof(profile_entry),
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                   -1, 0);
+    if (p->hist == MAP_FAILED) {
+        // LCOV_EXCL_START
+        p->hist = NULL;
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    if ((p->file = strdup(file)) == NULL ||
+        (p->pages = (uint8_t*)calloc((p->size >> PROFILE_PAGE_BITS) + 1, 1)) == NULL) {
+        // LCOV_EXCL_START
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    srv32_profile_reset(rv);
+    return true;
+}
+
+// clear the counts of the last program
+void srv32_profile_reset(struct rv *rv) {
+    rv_profile *p = rv->prof;
+    size_t i;
+
+    for(i = 0; i <= (p->size >> PROFILE_PAGE_BITS); i++) {
+        if (p->pages[i]) {
+            size_t n = (size_t)1 << PROFILE_PAGE_BITS;
+            if ((i << PROFILE_PAGE_BITS) + n > p->size)
+                n = p->size - (i << PROFILE_PAGE_BITS);
+            memset(&p->hist[i << PROFILE_PAGE_BITS], 0, n * sizeof(profile_entry));
+            p->pages[i] = 0;
+        }
+    }
+
+    p->mark = rv->csr.cycle.c;
+    p->next = p->period ? rv->csr.cycle.c + p->period : LLONG_MAX;
+}
+
+// Take the samples up to the cycle counter after the block, or the
+// instruction at prev_pc if blk is NULL, which is executed from the cycle
+// start. The spin iterations of the block are folded by the cycles of the
+// block.
+void srv32_profile_sample(struct rv *rv, const rv_block *blk, long long start) {
+    rv_profile *p = rv->prof;
+
+    for(; p->next <= rv->csr.cycle.c; p->next += p->period) {
+        int32_t pc = rv->prev_pc;
+        uint32_t i;
+
+        if (blk) {
+            long long offset = (p->next > start) ?
+                               (p->next - start - 1) % blk->cycles[blk->n - 1] : 0;
+            int n = 0, k = 0;
+
+            while(n < blk->n - 1 && blk->cycles[n] <= offset)
+                n++;
+
+            // the instructions after a trap are not executed, the block
+            // may jump backward, so prev_pc is searched before n
+            while(k < n && blk->insn[k].pc != pc)
+                k++;
+            if (k == n)
+                pc = blk->insn[n].pc;
+        }
+
+        i = (uint32_t)(pc - rv->mem_base) >> 1;
+        if (i < p->size) {
+            p->hist[i].cycles += p->period;
+            p->pages[i >> PROFILE_PAGE_BITS] = 1;
+        }
+    }
+}
+
+static int func_compare(const void *a, const void *b) {
+    const profile_func *fa = (const profile_func*)a;
+    const profile_func *fb = (const profile_func*)b;
+
+    if (fa->cycles != fb->cycles)
+        return (fa->cycles < fb->cycles) ? 1 : -1;
+    return (fa->addr < fb->addr) ? -1 : (fa->addr > fb->addr);
+}
+
+// Write the flat profile of the functions, sorted by the self cycles. The
+// addresses out of the symbols are listed by themselves.
+static void callgraph_report(struct rv *rv, FILE *fp);
+
+bool srv32_profile_write(struct rv *rv) {
+    rv_profile *p = rv->prof;
+    profile_func *funcs = NULL;
+    int nfuncs = 0;
+    int size = 0;
+    uint64_t total = 0, cumulative = 0, instret = 0;
+    const elf_symbol *last = NULL;
+    FILE *fp;
+    size_t i, j;
+    int n;
+
+    for(i = 0; i <= (p->size >> PROFILE_PAGE_BITS); i++) {
+        if (!p->pages[i])
+            continue;
+
+        for(j = i << PROFILE_PAGE_BITS;
+            j < ((i + 1) << PROFILE_PAGE_BITS) && j < p->size; j++) {
+            const profile_entry *e = &p->hist[j];
+            uint32_t pc = (uint32_t)rv->mem_base + (uint32_t)(j << 1);
+            const elf_symbol *sym;
+
+            if (e->cycles == 0 && e->instret == 0)
+                continue;
+
+            // the addresses are increasing, a new function starts when
+            // the symbol changes
+            sym = elf_find_symbol(rv->elf, pc);
+            if (nfuncs == 0 || !sym || sym != last) {
+                if (nfuncs == size) {
+                    size = size ? size * 2 : 256;
+                    if ((funcs = realloc(funcs, sizeof(profile_func) * size)) == NULL) {
+                        // LCOV_EXCL_START
+                        printf("malloc fail\n");
+                        return false;
+                        // LCOV_EXCL_STOP
+                    }
+                }
+                funcs[nfuncs].name    = sym ? sym->name : NULL;
+                funcs[nfuncs].addr    = sym ? sym->addr : pc;
+                funcs[nfuncs].cycles  = 0;
+                funcs[nfuncs].instret = 0;
+                nfuncs++;
+            }
+            funcs[nfuncs-1].cycles  += e->cycles;
+            funcs[nfuncs-1].instret += e->instret;
+            total   += e->cycles;
+            instret += e->instret;
+            last = sym;
+        }
+    }
+
+    if ((fp = fopen(p->file, "w")) == NULL) {
+        printf("can not open file %s\n", p->file);
+        free(funcs);
+        return false;
+    }
+
+    qsort(funcs, nfuncs, sizeof(profile_func), func_compare);
+
+    fprintf(fp, "Flat profile:\n\n");
+    if (p->period) {
+        fprintf(fp, "Each sample counts as %u cycles.\n", p->period);
+        fprintf(fp, "  %%      cumulative          self\n");
+        fprintf(fp, " cycles       cycles        cycles  name\n");
+    } else {
+        fprintf(fp, "Each instruction is counted.\n");
+        fprintf(fp, "  %%      cumulative          self          self      self\n");
+        fprintf(fp, " cycles       cycles        cycles       instret       CPI  name\n");
+    }
+
+    for(n = 0; n < nfuncs; n++) {
+        const profile_func *f = &funcs[n];
+        char addr[16];
+
+        cumulative += f->cycles;
+        snprintf(addr, sizeof(addr), "0x%08x", f->addr);
+        fprintf(fp, "%6.2f %13llu %13llu", total ? f->cycles * 100.0 / total : 0.0,
+                (unsigned long long)cumulative, (unsigned long long)f->cycles);
+        if (!p->period)
+            fprintf(fp, " %13llu %9.3f", (unsigned long long)f->instret,
+                    f->instret ? (double)f->cycles / f->instret : 0.0);
+        fprintf(fp, "  %s\n", f->name ? f->name : addr);
+    }
+
+    if (p->period)
+        fprintf(fp, "\nTotal: %llu cycles\n", (unsigned long long)total);
+    else
+        fprintf(fp, "\nTotal: %llu cycles, %llu instructions, %1.3f CPI\n",
+                (unsigned long long)total, (unsigned long long)instret,
+                instret ? (double)total / instret : 0.0);
+
+    if (rv->graph)
+        callgraph_report(rv, fp);
+
+    free(funcs);
+    return fclose(fp) == 0;
+}
+
+void srv32_profile_free(struct rv *rv) {
+    rv_profile *p = rv->prof;
+
+    if (!p)
+        return;
+
+    if (p->hist) munmap(p->hist, p->size * sizeof(profile_entry));
+    free(p->pages);
+    free(p->file);
+    free(p);
+    rv->prof = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Call graph
+
+bool srv32_callgraph_init(struct rv *rv, const char *file) {
+    rv_callgraph *g;
+
+    if ((g = (rv_callgraph*)calloc(1, sizeof(rv_callgraph))) == NULL) {
+        // LCOV_EXCL_START
+        return false;
+        // LCOV_EXCL_STOP
+    }
+    rv->graph = g;
+
+    g->size = 1024;
+    if ((g->file = strdup(file)) == NULL ||
+        (g->node = (callgraph_node*)malloc(sizeof(callgraph_node) * g->size)) == NULL) {
+        // LCOV_EXCL_START
+        return false;
+        // LCOV_EXCL_STOP
+    }
+
+    srv32_callgraph_reset(rv);
+    return true;
+}
+
+static const char *callgraph_name(struct rv *rv, uint32_t func, char *buf, int len) {
+    const elf_symbol *sym;
+
+    if (func == CALLGRAPH_TRAP)
+        return "[trap]";
+    if (func == CALLGRAPH_INT)
+        return "[interrupt]";
+    if ((sym = elf_find_symbol(rv->elf, func)) != NULL)
+        return sym->name;
+    snprintf(buf, len, "0x%08x", func);
+    return buf;
+}
+
+// the function of the symbol containing pc
+static uint32_t callgraph_func(struct rv *rv, uint32_t pc) {
+    const elf_symbol *sym = elf_find_symbol(rv->elf, pc);
+
+    return sym ? sym->addr : pc;
+}
+
+// the child path of the parent calling func, -1 if out of memory
+static int32_t callgraph_child(rv_callgraph *g, int32_t parent, uint32_t func) {
+    callgraph_node *n;
+    int32_t i;
+
+    for(i = g->node[parent].child; i >= 0; i = g->node[i].sibling)
+        if (g->node[i].func == func)
+            return i;
+
+    if (g->nnodes == g->size) {
+        callgraph_node *node = (callgraph_node*)realloc(g->node,
+                                   sizeof(callgraph_node) * g->size * 2);
+        if (!node) {
+            // LCOV_EXCL_START
+            return -1;
+            // LCOV_EXCL_STOP
+        }
+        g->node = node;
+        g->size *= 2;
+    }
+
+    i = g->nnodes++;
+    n = &g->node[i];
+    n->func    = func;
+    n->parent  = parent;
+    n->child   = -1;
+    n->sibling = g->node[parent].child;
+    n->self    = 0;
+    n->calls   = 0;
+    g->node[parent].child = i;
+
+    return i;
+}
+
+// add the cycles since the last event to the path on the top
+static void callgraph_account(struct rv *rv, rv_callgraph *g) {
+    g->node[g->frame[g->depth - 1].node].self += rv->csr.cycle.c - g->mark;
+    g->mark = rv->csr.cycle.c;
+}
+
+// the frames deeper than CALLGRAPH_DEPTH are not kept
+static void callgraph_push(rv_callgraph *g, uint32_t func, uint32_t ret) {
+    int32_t node;
+
+    if (g->depth >= CALLGRAPH_DEPTH)
+        return;
+
+    if ((node = callgraph_child(g, g->frame[g->depth - 1].node, func)) < 0)
+        return;
+
+    g->node[node].calls++;
+    g->frame[g->depth].node = node;
+    g->frame[g->depth].ret  = ret;
+    g->depth++;
+}
+
+void srv32_callgraph_reset(struct rv *rv) {
+    rv_callgraph *g = rv->graph;
+    int i;
+
+    // the root is the reset vector
+    g->nnodes = 1;
+    g->node[0].func    = callgraph_func(rv, rv->pc);
+    g->node[0].parent  = -1;
+    g->node[0].child   = -1;
+    g->node[0].sibling = -1;
+    g->node[0].self    = 0;
+    g->node[0].calls   = 1;
+
+    g->depth = 1;
+    g->frame[0].node = 0;
+    g->frame[0].ret  = 0;
+    g->mark = rv->csr.cycle.c;
+    g->pending = 0;
+    g->victim = 0;
+
+    for(i = 0; i < CALLGRAPH_CONTEXTS; i++)
+        g->context[i].depth = 0;
+}
+
+// called by srv32_trap() and srv32_int(), the frame is pushed after the
+// instruction, when the cycles are committed
+void srv32_callgraph_trap(struct rv *rv, uint32_t kind) {
+    rv_callgraph *g = rv->graph;
+
+    g->pending    = kind;
+    g->pending_sp = (uint32_t)rv->regs[SP];
+    g->pending_pc = (uint32_t)rv->csr.mepc;
+}
+
+static void callgraph_enter(struct rv *rv, rv_callgraph *g) {
+    callgraph_context *c = NULL;
+    int i;
+
+    // the stack of sp is replaced if it is not returned by mret, then a
+    // free entry, or the entries in turn
+    for(i = 0; i < CALLGRAPH_CONTEXTS && !c; i++)
+        if (g->context[i].depth && g->context[i].sp == g->pending_sp)
+            c = &g->context[i];
+    for(i = 0; i < CALLGRAPH_CONTEXTS && !c; i++)
+        if (!g->context[i].depth)
+            c = &g->context[i];
+    if (!c) {
+        c = &g->context[g->victim];
+        g->victim = (g->victim + 1) % CALLGRAPH_CONTEXTS;
+    }
+
+    c->sp    = g->pending_sp;
+    c->pc    = g->pending_pc;
+    c->depth = g->depth;
+    memcpy(c->frame, g->frame, sizeof(callgraph_frame) * g->depth);
+
+    callgraph_push(g, g->pending, g->pending_pc);
+    g->pending = 0;
+}
+
+// mret returns to the context trapped with the sp, and the pc after the
+// trapped instruction if the trap handler skips it (e.g. ecall)
+static void callgraph_leave(struct rv *rv, rv_callgraph *g) {
+    uint32_t sp = (uint32_t)rv->regs[SP];
+    uint32_t pc = (uint32_t)rv->pc;
+    int i;
+
+    for(i = 0; i < CALLGRAPH_CONTEXTS; i++) {
+        callgraph_context *c = &g->context[i];
+
+        if (c->depth && c->sp == sp && pc - c->pc <= 4) {
+            g->depth = c->depth;
+            memcpy(g->frame, c->frame, sizeof(callgraph_frame) * c->depth);
+            c->depth = 0;
+            return;
+        }
+    }
+
+    // a new task starts from the function of pc
+    g->depth = 1;
+    callgraph_push(g, callgraph_func(rv, pc), 0);
+}
+
+// check the call, return and mret of the instruction, called after the
+// cycles of the instruction are committed
+void srv32_callgraph_step(struct rv *rv, const rv_insn *ir) {
+    rv_callgraph *g = rv->graph;
+    int op = ir->inst.r.op;
+    int i;
+
+    callgraph_account(rv, g);
+
+    if (g->pending)
+        callgraph_enter(rv, g);
+
+    if ((op == OP_JAL || op == OP_JALR) && (ir->rd == RA || ir->rd == T0)) {
+        callgraph_push(g, callgraph_func(rv, rv->pc), (uint32_t)rv->regs[ir->rd]);
+    } else if (op == OP_JALR && ir->rd == ZERO && (ir->rs1 == RA || ir->rs1 == T0)) {
+        for(i = g->depth - 1; i > 0; i--) {
+            if (g->frame[i].ret == (uint32_t)rv->pc) {
+                g->depth = i;
+                break;
+            }
+        }
+    } else if (ir->system && ir->inst.i.func3 == OP_ECALL && (ir->inst.i.imm & 3) == 2) {
+        callgraph_leave(rv, g);
+    }
+}
+
+// Write the folded stacks, "root;caller;callee cycles" of each path with
+// the exclusive cycles, which can be read by flamegraph.pl or speedscope.
+bool srv32_callgraph_write(struct rv *rv) {
+    rv_callgraph *g = rv->graph;
+    int32_t path[CALLGRAPH_DEPTH];
+    char buf[16];
+    FILE *fp;
+    int32_t i, j, n;
+
+    callgraph_account(rv, g);
+
+    if ((fp = fopen(g->file, "w")) == NULL) {
+        printf("can not open file %s\n", g->file);
+        return false;
+    }
+
+    for(i = 0; i < g->nnodes; i++) {
+        if (g->node[i].self == 0)
+            continue;
+
+        // the path is not deeper than the shadow stack
+        n = 0;
+        for(j = i; j >= 0 && n < CALLGRAPH_DEPTH; j = g->node[j].parent)
+            path[n++] = j;
+        while(n-- > 0)
+            fprintf(fp, "%s%c", callgraph_name(rv, g->node[path[n]].func, buf, sizeof(buf)),
+                    n ? ';' : ' ');
+        fprintf(fp, "%llu\n", (unsigned long long)g->node[i].self);
+    }
+
+    return fclose(fp) == 0;
+}
+
+static int inclusive_compare(const void *a, const void *b) {
+    const uint64_t *ia = (const uint64_t*)a;
+    const uint64_t *ib = (const uint64_t*)b;
+
+    // the inclusive cycles, then the node
+    if (ia[0] != ib[0])
+        return (ia[0] < ib[0]) ? 1 : -1;
+    return (ia[1] < ib[1]) ? -1 : (ia[1] > ib[1]);
+}
+
+// the paths taking 0.1% of the cycles at least, by the inclusive cycles
+static void callgraph_report(struct rv *rv, FILE *fp) {
+    rv_callgraph *g = rv->graph;
+    uint64_t *incl;
+    uint64_t *order;
+    char buf[16];
+    int32_t i, j;
+
+    callgraph_account(rv, g);
+
+    if ((incl = (uint64_t*)calloc(g->nnodes, sizeof(uint64_t))) == NULL ||
+        (order = (uint64_t*)malloc(sizeof(uint64_t) * 2 * g->nnodes)) == NULL) {
+        // LCOV_EXCL_START
+        free(incl);
+        return;
+        // LCOV_EXCL_STOP
+    }
+
+    // the children are created after the parents
+    for(i = g->nnodes - 1; i >= 0; i--) {
+        incl[i] += g->node[i].self;
+        if (g->node[i].parent >= 0)
+            incl[g->node[i].parent] += incl[i];
+        order[i*2]   = incl[i];
+        order[i*2+1] = i;
+    }
+    qsort(order, g->nnodes, sizeof(uint64_t) * 2, inclusive_compare);
+
+    fprintf(fp, "\nCall graph:\n\n");
+    fprintf(fp, "  %%        inclusive          self         calls  caller > function\n");
+    for(j = 0; j < g->nnodes && order[j*2] * 1000 >= incl[0]; j++) {
+        const callgraph_node *n = &g->node[order[j*2+1]];
+        int32_t k;
+
+        fprintf(fp, "%6.2f %13llu %13llu %13llu  ",
+                incl[0] ? order[j*2] * 100.0 / incl[0] : 0.0,
+                (unsigned long long)order[j*2], (unsigned long long)n->self,
+                (unsigned long long)n->calls);
+
+        // the caller and the callee
+        if ((k = n->parent) >= 0)
+            fprintf(fp, "%s > ", callgraph_name(rv, g->node[k].func, buf, sizeof(buf)));
+        fprintf(fp, "%s\n", callgraph_name(rv, n->func, buf, sizeof(buf)));
+    }
+
+    free(incl);
+    free(order);
+}
+
+void srv32_callgraph_free(struct rv *rv) {
+    rv_callgraph *g = rv->graph;
+
+    if (!g)
+        return;
+
+    free(g->node);
+    free(g->file);
+    free(g);
+    rv->graph = NULL;
+}
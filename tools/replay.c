@@ -0,0 +1,230 @@
+// Copyright © 2020 Kuoping Hsu
+// replay.c: record and replay the inputs of the host
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+// The simulation is deterministic except the inputs of the host: the
+// characters of MMIO_GETC and the results of the file syscalls. The timer
+// is counted by the cycles, not the wall clock. The record mode logs each
+// input with the instret of the instruction, and the replay mode returns
+// them from the log without calling the host, so the run is repeated
+// exactly, also an interactive session.
+//
+// The log is the magic and the version, followed by the records of LEB128
+// varints
+//
+//     kind, instret delta, zigzag result, [data]
+//
+// The kind is REPLAY_GETC or the syscall number, and the data of SYS_READ
+// is the result bytes read. The replay skips the records before the
+// current instret, so it can also start from a checkpoint of the recorded
+// run. A record of another kind or instret means the program does not
+// follow the log, and the simulation is stopped.
+//
+// The same hooks keep the inputs in the history of the reverse debugger,
+// see reverse.c.
+
+#define REPLAY_MAGIC    "SRV32RPL"
+#define REPLAY_VERSION  1
+
+#define ZIGZAG(v)       (((uint32_t)(v) << 1) ^ (uint32_t)((int32_t)(v) >> 31))
+#define UNZIGZAG(v)     ((int32_t)(((v) >> 1) ^ -((v) & 1)))
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static bool get_varint(FILE *fp, uint64_t *v) {
+    uint64_t r = 0;
+    int shift, c;
+
+    for(shift = 0; shift < 64; shift += 7) {
+        if ((c = fgetc(fp)) == EOF)
+            return false;
+        r |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            *v = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the data bytes of the record
+static int replay_data(const rv_replay *r) {
+    return (r->kind == SYS_READ && r->result > 0) ? r->result : 0;
+}
+
+// read ahead the next record, r->next is false at the end of the log
+static void replay_read(rv_replay *r) {
+    uint64_t kind, delta, result;
+
+    r->next = get_varint(r->fp, &kind) && get_varint(r->fp, &delta) &&
+              get_varint(r->fp, &result);
+    if (r->next) {
+        r->kind   = (int32_t)kind;
+        r->stamp  = r->instret + (long long)delta;
+        r->result = UNZIGZAG((uint32_t)result);
+        r->instret = r->stamp;
+    }
+}
+
+bool srv32_replay_open(struct rv *rv, const char *file, bool record) {
+    rv_replay *r;
+    char magic[9];
+
+    if ((r = (rv_replay*)calloc(1, sizeof(rv_replay))) == NULL ||
+        (r->file = strdup(file)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        free(r);
+        return false;
+        // LCOV_EXCL_STOP
+    }
+    r->record = record;
+    rv->rr = r;
+
+    if ((r->fp = fopen(file, record ? "wb" : "rb")) == NULL) {
+        printf("can not open file %s\n", file);
+        return false;
+    }
+
+    if (record) {
+        fwrite(REPLAY_MAGIC, 1, 8, r->fp);
+        fputc(REPLAY_VERSION, r->fp);
+        return true;
+    }
+
+    if (fread(magic, 1, 9, r->fp) != 9 || memcmp(magic, REPLAY_MAGIC, 8) != 0 ||
+        magic[8] != REPLAY_VERSION) {
+        printf("%s is not a replay log\n", file);
+        return false;
+    }
+    replay_read(r);
+
+    return true;
+}
+
+bool srv32_replay_close(struct rv *rv) {
+    rv_replay *r = rv->rr;
+    bool ok = true;
+
+    if (!r)
+        return true;
+
+    if (r->fp) {
+        ok = !ferror(r->fp);
+        if (fclose(r->fp) != 0)
+            ok = false;
+        if (!ok && r->record)
+            printf("can not write the replay log %s\n", r->file);
+    }
+    free(r->file);
+    free(r);
+    rv->rr = NULL;
+
+    return ok;
+}
+
+// Returns true if the input is replayed to result and data (at most len
+// bytes), false if the host is called.
+bool srv32_replay_input(struct rv *rv, int kind, int32_t *result, void *data, int len) {
+    rv_replay *r = rv->rr;
+    long long instret = rv->csr.instret.c;
+    int n;
+
+    // the steps executed again by the debugger take the inputs it keeps
+    if (srv32_reverse_input(rv, kind, result, data, len))
+        return true;
+
+    if (!r || r->record)
+        return false;
+
+    // the inputs before a restored checkpoint
+    while (r->next && r->stamp < instret) {
+        fseek(r->fp, replay_data(r), SEEK_CUR);
+        replay_read(r);
+    }
+
+    *result = -1;
+    if (r->diverged)
+        return true;
+
+    if (!r->next || r->stamp != instret || r->kind != kind) {
+        printf("The replay diverges from %s at instret %lld\n", r->file, instret);
+        r->diverged = true;
+        rv->exitcode = 1;
+        rv->exited = true;
+        rv->block_break = 1;
+        return true;
+    }
+
+    *result = r->result;
+
+    n = replay_data(r);
+    if (n > 0) {
+        int m = !data ? 0 : (n < len) ? n : len;
+        if (fread(data, 1, m, r->fp) != (size_t)m)
+            *result = -1;
+        fseek(r->fp, n - m, SEEK_CUR);
+    }
+    replay_read(r);
+
+    return true;
+}
+
+void srv32_record_input(struct rv *rv, int kind, int32_t result, const void *data) {
+    rv_replay *r = rv->rr;
+    uint8_t buf[32];
+    uint8_t *p = buf;
+    int len = (kind == SYS_READ && result > 0) ? result : 0;
+
+    // the inputs are kept once, at the first execution
+    if (REV_REPLAY(rv))
+        return;
+    srv32_reverse_save_input(rv, kind, result, data, len);
+
+    if (!r || !r->record)
+        return;
+
+    p = put_varint(p, (uint32_t)kind);
+    p = put_varint(p, (uint64_t)(rv->csr.instret.c - r->instret));
+    p = put_varint(p, ZIGZAG(result));
+    fwrite(buf, 1, p - buf, r->fp);
+    if (len > 0)
+        fwrite(data, 1, len, r->fp);
+
+    // the log is kept when an interactive session is killed
+    fflush(r->fp);
+
+    r->instret = rv->csr.instret.c;
+}
@@ -0,0 +1,290 @@
+// Copyright © 2020 Kuoping Hsu
+// reverse.c: reverse execution of the debugger
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opcode.h"
+#include "rvsim.h"
+
+// The debugger steps back by the snapshots of the processor state and an
+// undo log of the memory. Each store to the memory logs the word before
+// it, and a snapshot is taken every REV_INTERVAL instructions with the
+// position of the log. To go back to an instruction, the log is undone to
+// the snapshot before it, then the instructions are executed again up to
+// it.
+//
+// The simulation is deterministic except the inputs of the host, so they
+// are kept in the history by the hooks of the replay log (see replay.c),
+// and the instructions before the last one executed, also the steps
+// forward from the past, take their inputs from the history and do not
+// write the console again.
+//
+// The history is bounded by the rings of the snapshots, the undo log and
+// the inputs, the snapshots whose entries are overwritten are dropped. The
+// devices other than the timer and the host are not restored.
+
+#define REV_SNAPSHOTS   1024        // must be the power of 2
+#define REV_INTERVAL    4096        // instructions between the snapshots
+#define REV_LOG_SIZE    (1 << 20)   // entries of the undo log, must be the power of 2
+#define REV_INPUTS      4096        // inputs of the host, must be the power of 2
+
+#define SNAP(r, i)      (&(r)->snap[(i) & (REV_SNAPSHOTS - 1)])
+#define INPUT(r, i)     (&(r)->input[(i) & (REV_INPUTS - 1)])
+
+bool srv32_reverse_init(struct rv *rv) {
+    rv_reverse *r;
+
+    if ((r = (rv_reverse*)calloc(1, sizeof(rv_reverse))) == NULL ||
+        (r->undo = (rv_undo*)malloc(REV_LOG_SIZE * sizeof(rv_undo))) == NULL ||
+        (r->snap = (rv_snapshot*)malloc(REV_SNAPSHOTS * sizeof(rv_snapshot))) == NULL ||
+        (r->input = (rv_input*)calloc(REV_INPUTS, sizeof(rv_input))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        if (r) {
+            free(r->undo);
+            free(r->snap);
+        }
+        free(r);
+        return false;
+        // LCOV_EXCL_STOP
+    }
+    rv->rev = r;
+
+    return true;
+}
+
+void srv32_reverse_free(struct rv *rv) {
+    rv_reverse *r = rv->rev;
+    int i;
+
+    if (!r)
+        return;
+
+    for(i = 0; i < REV_INPUTS; i++)
+        free(r->input[i].data);
+    free(r->input);
+    free(r->undo);
+    free(r->snap);
+    free(r);
+    rv->rev = NULL;
+}
+
+// called before each step of srv32_step()
+void srv32_reverse_record(struct rv *rv) {
+    rv_reverse *r = rv->rev;
+
+    if (r->first == r->last || r->step - SNAP(r, r->last - 1)->step >= REV_INTERVAL) {
+        rv_snapshot *s;
+
+        if (r->last - r->first == REV_SNAPSHOTS)
+            r->first++;
+
+        s = SNAP(r, r->last++);
+        s->step  = r->step;
+        s->log   = r->log;
+        s->input = r->next;
+        srv32_save_state(rv, &s->state);
+    }
+
+    // the step is executed again
+    r->replay = r->step < r->end;
+    if (++r->step > r->end)
+        r->end = r->step;
+}
+
+// the snapshots can not be restored without their entries
+static void reverse_prune(rv_reverse *r) {
+    while (r->first < r->last &&
+           (r->log - SNAP(r, r->first)->log > REV_LOG_SIZE ||
+            r->inputs - SNAP(r, r->first)->input > REV_INPUTS))
+        r->first++;
+}
+
+// log the memory words of addr to addr+len-1 before they are written
+void srv32_reverse_mem(struct rv *rv, int32_t addr, int32_t len) {
+    rv_reverse *r = rv->rev;
+    uint32_t offset, end;
+
+    if (!r || len <= 0)
+        return;
+
+    offset = ((uint32_t)addr - rv->mem_base) & ~3;
+    end = (uint32_t)addr - rv->mem_base + len;
+    for(; offset < end && offset <= (uint32_t)rv->mem_size - 4; offset += 4) {
+        rv_undo *u = &r->undo[r->log++ & (REV_LOG_SIZE - 1)];
+        u->offset = offset;
+        memcpy(&u->data, (char*)rv->mem + offset, 4);
+    }
+
+    reverse_prune(r);
+}
+
+// Returns true if the input of the step executed again is taken from the
+// history to result and data (at most len bytes).
+bool srv32_reverse_input(struct rv *rv, int kind, int32_t *result, void *data, int len) {
+    rv_reverse *r = rv->rev;
+    const rv_input *in;
+
+    if (!r || !r->replay || r->next >= r->inputs)
+        return false;
+
+    in = INPUT(r, r->next);
+    if (in->step != r->step - 1 || in->kind != kind)
+        return false;
+
+    r->next++;
+    *result = in->result;
+    if (data && in->len > 0)
+        memcpy(data, in->data, in->len < len ? in->len : len);
+
+    return true;
+}
+
+// keep the input of the host, len bytes of data
+void srv32_reverse_save_input(struct rv *rv, int kind, int32_t result, const void *data, int len) {
+    rv_reverse *r = rv->rev;
+    rv_input *in;
+
+    if (!r)
+        return;
+
+    in = INPUT(r, r->inputs);
+    in->step   = r->step - 1;
+    in->kind   = kind;
+    in->result = result;
+    in->len    = 0;
+    free(in->data);
+    in->data   = NULL;
+    if (data && len > 0 && (in->data = malloc(len)) != NULL) {
+        memcpy(in->data, data, len);
+        in->len = len;
+    }
+    r->next = ++r->inputs;
+
+    reverse_prune(r);
+}
+
+// the first step in the history
+long long srv32_reverse_oldest(struct rv *rv) {
+    rv_reverse *r = rv->rev;
+
+    if (!r || r->first == r->last)
+        return r ? r->step : 0;
+
+    return SNAP(r, r->first)->step;
+}
+
+// restore the snapshot i, the newer snapshots are dropped
+static void reverse_restore(struct rv *rv, uint64_t i) {
+    rv_reverse *r = rv->rev;
+    const rv_snapshot *s = SNAP(r, i);
+
+    while (r->log > s->log) {
+        const rv_undo *u = &r->undo[--r->log & (REV_LOG_SIZE - 1)];
+        memcpy((char*)rv->mem + u->offset, &u->data, 4);
+        if (rv->code_map[u->offset >> CODE_PAGE_BITS])
+            srv32_flush_icache(rv, rv->mem_base + u->offset, 4);
+    }
+    srv32_load_state(rv, &s->state);
+
+    r->step = s->step;
+    r->next = s->input;
+    r->last = i + 1;
+}
+
+// the latest snapshot before the step, false if it is not in the history
+static bool reverse_find(rv_reverse *r, long long step, uint64_t *i) {
+    uint64_t n;
+
+    for(n = r->last; n > r->first; n--) {
+        if (SNAP(r, n - 1)->step <= step) {
+            *i = n - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// execute again up to the step, the trace log is not written twice
+static void reverse_replay(struct rv *rv, long long step,
+                           bool (*stop)(struct rv *rv, void *arg), void *arg,
+                           long long *found) {
+    rv_reverse *r = rv->rev;
+    bool log = rv->log;
+
+    rv->log = false;
+    while (r->step < step) {
+        if (stop && stop(rv, arg))
+            *found = r->step;
+        if (srv32_step(rv) == RV_EXIT)
+            break;
+    }
+    rv->log = log;
+}
+
+// Go back to the state before the step. Returns false if the step is not
+// in the history.
+bool srv32_reverse_goto(struct rv *rv, long long step) {
+    rv_reverse *r = rv->rev;
+    uint64_t i;
+
+    if (!r || step > r->step || !reverse_find(r, step, &i))
+        return false;
+
+    if (step == r->step)
+        return true;
+
+    reverse_restore(rv, i);
+    reverse_replay(rv, step, NULL, NULL, NULL);
+
+    return true;
+}
+
+// Go back to the last step where stop() is true, the current step is not
+// checked. Returns false and goes to the oldest step if it is not found.
+bool srv32_reverse_cont(struct rv *rv, bool (*stop)(struct rv *rv, void *arg), void *arg) {
+    rv_reverse *r = rv->rev;
+    long long end, found;
+    uint64_t i;
+
+    if (!r)
+        return false;
+
+    // the segments between the snapshots are searched backward
+    for(end = r->step; end > 0 && reverse_find(r, end - 1, &i); ) {
+        long long start = SNAP(r, i)->step;
+
+        found = -1;
+        reverse_restore(rv, i);
+        reverse_replay(rv, end, stop, arg, &found);
+        if (found >= 0)
+            return srv32_reverse_goto(rv, found);
+        end = start;
+    }
+
+    srv32_reverse_goto(rv, srv32_reverse_oldest(rv));
+
+    return false;
+}
@@ -22,37 +22,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
-#include <getopt.h>
 #include <sys/time.h>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include "opcode.h"
 #include "rvsim.h"
 
-#ifdef GDBSTUB
-extern struct target_ops gdbstub_ops;
-#endif
-
-#define PRINT_TIMELOG 1
-#define MAXLEN      1024
-
-#define TIME_LOG    if (rv->ft && PRINT_TIMELOG) fprintf(rv->ft, "%10d ", rv->csr.cycle.d.lo)
-#define TRACE_LOG   if (rv->ft) fprintf(rv->ft,
-#define TRACE_END   )
-
-struct timeval time_start;
-struct timeval time_end;
-
-#ifdef RV32C_ENABLED
-int overhead = 0;
-#endif // RV32C_ENABLED
-
-int quiet = 0;
+// The trace events are encoded into rv->ft, the writer thread of trace.c
+// prints them as "cycle pc inst [register write | memory access]". The
+// event of the retired instruction is also kept in rv->retired for
+// srv32_retire().
+#define LOG_PC(nl)  if (rv->log) log_pc(rv, ir->inst.inst, (nl) ? TRACE_F_NL : 0, 0)
+#define LOG_RD      if (rv->log) log_pc(rv, ir->inst.inst, TRACE_F_RD, ir->rd)
+#define LOG_REG(rd) if (rv->log) log_reg(rv, rd)
+#define LOG_READ(addr, rd, val) \
+                    if (rv->log) log_mem(rv, TRACE_READ, addr, rd, val)
+#define LOG_WRITE(addr, val) \
+                    if (rv->log) log_mem(rv, TRACE_WRITE, addr, 0, val)
+#define LOG_NL      if (rv->ft) trace_newline(rv->ft)
 
 const char *regname[32] = {
     "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
@@ -61,31 +55,7 @@ const char *regname[32] = {
     "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
 };
 
-int elfloader(char *file, struct rv *rv);
 int getch(void);
-int debug(struct rv *rv);
-
-void usage(void) {
-// LCOV_EXCL_START
-    printf(
-"Instruction Set Simulator for RV32IM, (c) 2020 Kuoping Hsu\n"
-"Usage: rvsim [-h] [-d] [-g port] [-m n] [-n n] [-b n] [-p] [-l logfile] file\n\n"
-"       --help, -h              help\n"
-"       --debug, -d             interactive debug mode\n"
-"       --gdb port, -g port     enable gdb debugger with port\n"
-"       --quiet, -q             quite\n"
-"       --membase n, -m n       memory base\n"
-"       --memsize n, -n n       memory size for iram and dram each (in Kb)\n"
-"       --branch n, -b n        branch penalty (default 2)\n"
-"       --single, -s            single RAM\n"
-"       --predict, -p           static branch prediction\n"
-"       --log file, -l file     generate log file\n"
-"\n"
-"       file                    the elf executable file\n"
-"\n"
-    );
-// LCOV_EXCL_STOP
-}
 
 #ifdef MACOX
 void *aligned_malloc(int align, size_t size )
@@ -109,15 +79,20 @@ void aligned_free( void *mem )
 #define aligned_free free
 #endif // MACOX
 
-#ifndef __STDC_WANT_LIB_EXT1__
-char *strncpy_s(char *dest, size_t n, const char *src, size_t count) {
-    int len = (int)strnlen(src, count);
-    if (len > n) len = n;
-    memcpy(dest, src, len);
-    dest[len] = 0;
-    return dest;
+// The guest memory is reserved by mmap without the swap space. The host
+// commits a zero page on the first touch, so only the pages loaded by the
+// ELF file or touched by the program cost memory. Mapping again at the same
+// address gives the pages back and clears them in O(1).
+static void *mem_map(void *addr, size_t size) {
+    void *ptr = mmap(addr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                     (addr ? MAP_FIXED : 0), -1, 0);
+
+    return (ptr == MAP_FAILED) ? NULL : ptr;
 }
-#endif // __STDC_WANT_LIB_EXT1__
+
+#define CODE_MAP_SIZE(rv) (((rv)->mem_size >> CODE_PAGE_BITS) + 1)
+
 
 static inline int to_imm_i(uint32_t n) {
     return (int)((n & (1<<11)) ? (n | 0xfffff000) : n);
@@ -172,55 +147,83 @@ static inline int to_imm_u(uint32_t n) {
     return (int)(n << 12);
 }
 
-void prog_exit(struct rv *rv) {
-    double diff;
-    int exitcode = rv->exitcode;
-
-    if (rv->debug_en)
-        exit(0);
+#define UPDATE_CSR(update,mode,reg,val) { \
+    if (update) { \
+        if ((mode) == OP_CSRRW) reg = (val); \
+        if ((mode) == OP_CSRRS) reg = (reg) |  (val); \
+        if ((mode) == OP_CSRRC) reg = (reg) & ~(val); \
+    } \
+}
 
-    gettimeofday(&time_end, NULL);
+// mhpmcounter3..31, mhpmcounter3h..31h or mhpmevent3..31 of the base
+#define CSR_HPM(regs, base) \
+    (((regs) & ~0x1f) == ((base) & ~0x1f) && ((regs) & 0x1f) >= 3)
+
+// the count of the event of mhpmevent, see srv32_get_cpi()
+static long long hpm_event(struct rv *rv, uint32_t event) {
+    switch(event) {
+        case HPM_BRANCH     : return rv->cpi.taken;
+        case HPM_FLUSH      : return rv->cpi.flushes;
+        case HPM_LOAD       : return rv->cpi.iclass[SRV32_CLASS_LOAD];
+        case HPM_STORE      : return rv->cpi.iclass[SRV32_CLASS_STORE];
+        case HPM_IMEM_STALL : return rv->cpi.cycles[SRV32_STALL_FETCH] +
+                                     rv->cpi.cycles[SRV32_STALL_SINGLERAM];
+        case HPM_DMEM_STALL : return rv->cpi.cycles[SRV32_STALL_MEMORY];
+        case HPM_INTERRUPT  : return rv->cpi.events[SRV32_STALL_INTERRUPT];
+        case HPM_COMPRESSED : return rv->cpi.compressed;
+        case HPM_MULDIV     : return rv->cpi.iclass[SRV32_CLASS_MUL] +
+                                     rv->cpi.iclass[SRV32_CLASS_DIV];
+    }
+    return 0;
+}
 
-    diff = (double)(time_end.tv_sec-time_start.tv_sec) +
-                   (time_end.tv_usec-time_start.tv_usec)/1000000.0;
+// The hardware performance counters are not counted by the instructions,
+// a counter is the count of its event since hpm_base, which is moved when
+// the counter or the event is written. The counters after HPM_COUNTERS
+// are hardwired to zero.
+static int csr_hpm(struct rv *rv, int regs, int mode, int val, int update) {
+    int n = (regs & 0x1f) - 3;
+    uint32_t event;
+    COUNTER counter;
+    int result;
 
-    if (!quiet && rv) {
-#ifdef RV32C_ENABLED
-        printf("\nExcuting %lld instructions, %lld cycles, %1.3f CPI, %1.3f%% overhead\n",
-               rv->csr.instret.c, rv->csr.cycle.c,
-               ((float)rv->csr.cycle.c)/rv->csr.instret.c, (overhead*100.0)/rv->csr.instret.c);
-#else
-        printf("\nExcuting %lld instructions, %lld cycles, %1.3f CPI\n", rv->csr.instret.c,
-               rv->csr.cycle.c, ((float)rv->csr.cycle.c)/rv->csr.instret.c);
-#endif // RV32C_ENABLED
+    if (n >= HPM_COUNTERS)
+        return 0;
 
-        printf("Program terminate\n");
+    event = rv->mhpmevent[n];
+    counter.c = hpm_event(rv, event) - rv->hpm_base[n];
 
-        printf("\n");
-        printf("Simulation statistics\n");
-        printf("=====================\n");
-        printf("Simulation time  : %0.3f s\n", (float)diff);
-        printf("Simulation cycles: %lld\n", rv->csr.cycle.c);
-        printf("Simulation speed : %0.3f MHz\n", (float)(rv->csr.cycle.c / diff / 1000000.0));
-        printf("\n");
+    if (CSR_HPM(regs, CSR_MHPMEVENT3)) {
+        result = event;
+        UPDATE_CSR(update, mode, event, (uint32_t)val);
+    } else if (CSR_HPM(regs, CSR_MHPMCOUNTER3)) {
+        result = counter.d.lo;
+        UPDATE_CSR(update, mode, counter.d.lo, val);
+    } else {
+        result = counter.d.hi;
+        UPDATE_CSR(update, mode, counter.d.hi, val);
     }
 
-    aligned_free(rv);
-    exit(exitcode);
-}
-
-#define UPDATE_CSR(update,mode,reg,val) { \
-    if (update) { \
-        if ((mode) == OP_CSRRW) reg = (val); \
-        if ((mode) == OP_CSRRS) reg = (reg) |  (val); \
-        if ((mode) == OP_CSRRC) reg = (reg) & ~(val); \
-    } \
+    if (update) {
+        // the instruction classes are counted from now on
+        if (event == HPM_LOAD || event == HPM_STORE ||
+            event == HPM_COMPRESSED || event == HPM_MULDIV)
+            rv->count_class = true;
+        rv->mhpmevent[n] = event;
+        rv->hpm_base[n]  = hpm_event(rv, event) - counter.c;
+    }
+    return result;
 }
 
 int csr_rw(struct rv *rv, int regs, int mode, int val, int update, int *legal) {
     COUNTER counter;
     int result = 0;
     *legal = 1;
+
+    if (CSR_HPM(regs, CSR_MHPMEVENT3) || CSR_HPM(regs, CSR_MHPMCOUNTER3) ||
+        CSR_HPM(regs, CSR_MHPMCOUNTER3H))
+        return csr_hpm(rv, regs, mode, val, update);
+
     switch(regs) {
         case CSR_RDCYCLE    : counter.c = rv->csr.cycle.c - 1;
                               result = counter.d.lo;
@@ -340,8 +343,40 @@ static inline void srv32_cycle_add(struct rv *rv, int count) {
     if (!rv->mtime_update) rv->csr.mtime.c = rv->csr.mtime.c + count;
 }
 
+// the cycles more than one of an instruction, counted by the cause
+static inline void srv32_stall(struct rv *rv, int cause, int count) {
+    if (cause <= SRV32_STALL_MRET) rv->cpi.flushes++;
+    rv->cpi.events[cause]++;
+    rv->cpi.cycles[cause] += count;
+    srv32_cycle_add(rv, count);
+}
+
+// Compute the mtime at which an interrupt may be taken. The interrupt
+// conditions are evaluated only when mtime reaches this deadline, and it
+// must be re-armed when mstatus, mie, mtimecmp, msip or the pending state
+// between the instructions are changed.
+static inline void srv32_irq_schedule(struct rv *rv) {
+    long long deadline = LLONG_MAX;
+
+    if (rv->csr.mstatus & (1 << MIE)) {
+        if (rv->csr.mie & (1 << MTIE))
+            deadline = rv->csr.mtimecmp.c;
+        if ((rv->csr.mie & (1 << MSIE)) &&
+            (rv->sw_irq || (rv->csr.msip & (1<<0))))
+            deadline = LLONG_MIN;
+        if ((rv->csr.mie & (1 << MEIE)) &&
+            (rv->ext_irq || (rv->csr.msip & (1<<16))))
+            deadline = LLONG_MIN;
+    }
+
+    if (rv->timer_irq || rv->sw_irq_next || rv->ext_irq_next)
+        deadline = LLONG_MIN;
+
+    rv->irq_deadline = deadline;
+}
+
 static inline void srv32_trap(struct rv *rv, int cause, int val) {
-    srv32_cycle_add(rv, rv->branch_penalty);
+    srv32_stall(rv, SRV32_STALL_TRAP, rv->branch_penalty);
     rv->csr.mcause = cause;
     rv->csr.mstatus = (rv->csr.mstatus &  (1<<MIE)) ?
             (rv->csr.mstatus | (1<<MPIE)) : (rv->csr.mstatus & ~(1<<MPIE));
@@ -350,13 +385,18 @@ static inline void srv32_trap(struct rv *rv, int cause, int val) {
     rv->csr.mtval = (val);
     rv->pc = (rv->csr.mtvec & 1) ?
             (rv->csr.mtvec & 0xfffffffe) + cause * 4 : rv->csr.mtvec;
+    srv32_irq_schedule(rv);
+    if (rv->graph)
+        srv32_callgraph_trap(rv, CALLGRAPH_TRAP);
 }
 
 static inline void srv32_int(struct rv *rv, int cause, int src, int compressed) {
     /* When the branch instruction is interrupted, do not accumulate cycles, */
     /* which has been added when the branch instruction is executed. */
     if (rv->pc == (compressed ? rv->prev_pc+2 : rv->prev_pc+4))
-        srv32_cycle_add(rv, rv->branch_penalty);
+        srv32_stall(rv, SRV32_STALL_INTERRUPT, rv->branch_penalty);
+    else
+        rv->cpi.events[SRV32_STALL_INTERRUPT]++;
 
     rv->csr.mcause = cause;
     rv->csr.mstatus = (rv->csr.mstatus &  (1<<MIE)) ?
@@ -366,6 +406,9 @@ static inline void srv32_int(struct rv *rv, int cause, int src, int compressed)
     rv->csr.mepc = rv->pc;
     rv->pc = (rv->csr.mtvec & 1) ?
             (rv->csr.mtvec & 0xfffffffe) + (cause & (~(1<<31))) * 4 : rv->csr.mtvec;
+    srv32_irq_schedule(rv);
+    if (rv->graph)
+        srv32_callgraph_trap(rv, CALLGRAPH_INT);
 }
 
 
@@ -386,6 +429,80 @@ void srv32_write_regs(struct rv *rv, int n, int32_t v) {
     }
 }
 
+static inline void log_pc(struct rv *rv, uint32_t inst, int flags, int rd) {
+    uint32_t val = (flags & TRACE_F_RD) ? srv32_read_regs(rv, rd) : 0;
+    uint32_t cycle = rv->csr.cycle.d.lo + rv->log_cycles;
+
+    if (rv->ft)
+        trace_pc(rv->ft, cycle, rv->pc, inst, flags, rd, val);
+
+    if (rv->retired) {
+        srv32_retired *r = rv->retired;
+        r->cycle = cycle;
+        r->pc    = rv->pc;
+        r->inst  = inst;
+        r->kind  = (flags & TRACE_F_RD) ? SRV32_RETIRE_REG : SRV32_RETIRE_NONE;
+        r->rd    = rd;
+        r->addr  = 0;
+        r->data  = val;
+    }
+}
+
+static inline void log_reg(struct rv *rv, int rd) {
+    uint32_t val = srv32_read_regs(rv, rd);
+
+    if (rv->ft)
+        trace_reg(rv->ft, rd, val);
+
+    if (rv->retired) {
+        rv->retired->kind = SRV32_RETIRE_REG;
+        rv->retired->rd   = rd;
+        rv->retired->data = val;
+    }
+}
+
+static inline void log_mem(struct rv *rv, int kind, uint32_t addr, int rd,
+                           uint32_t val) {
+    if (rv->ft)
+        trace_mem(rv->ft, kind, addr, rd, val);
+
+    if (rv->retired) {
+        rv->retired->kind = (kind == TRACE_READ) ? SRV32_RETIRE_READ :
+                                                   SRV32_RETIRE_WRITE;
+        rv->retired->rd   = rd;
+        rv->retired->addr = addr;
+        rv->retired->data = val;
+    }
+}
+
+// the instruction class histogram, see srv32_get_cpi()
+static inline void srv32_count_class(struct rv *rv, const rv_insn *ir) {
+    rv->cpi.iclass[ir->iclass]++;
+    rv->cpi.compressed += ir->compressed;
+}
+
+// count the cycles since the last instruction to the instruction at pc,
+// see profile.c
+static inline void srv32_profile_count(struct rv *rv, int32_t pc) {
+    rv_profile *p = rv->prof;
+    uint32_t i = (uint32_t)(pc - rv->mem_base) >> 1;
+
+    if (i < p->size) {
+        p->hist[i].cycles += rv->csr.cycle.c - p->mark;
+        p->hist[i].instret++;
+        p->pages[i >> PROFILE_PAGE_BITS] = 1;
+    }
+    p->mark = rv->csr.cycle.c;
+}
+
+// the call graph is updated after the calls, returns, mret and traps,
+// which end the blocks
+static inline void srv32_callgraph_check(struct rv *rv, const rv_insn *ir) {
+    if (rv->graph && (rv->graph->pending || ir->inst.r.op == OP_JAL ||
+                      ir->inst.r.op == OP_JALR || ir->system))
+        srv32_callgraph_step(rv, ir);
+}
+
 void *srv32_get_memptr(struct rv *rv, int32_t addr) {
     if (addr < rv->mem_base || addr > (rv->mem_base + rv->mem_size))
         return NULL;
@@ -395,37 +512,281 @@ void *srv32_get_memptr(struct rv *rv, int32_t addr) {
 
 bool srv32_write_mem(struct rv *rv, int32_t addr, int32_t len, void *ptr)
 {
-    int i;
-    char *src = (char*)ptr;
     char *dst = (char*)&((char*)rv->mem)[addr - rv->mem_base];
 
     if (addr < rv->mem_base || (addr + len) > (rv->mem_base + rv->mem_size))
         return false;
 
-    for(i = 0; i < len; i++)
-        dst[i] = src[i];
+    memcpy(dst, ptr, len);
+
+    srv32_flush_icache(rv, addr, len);
 
     return true;
 }
 
 bool srv32_read_mem(struct rv *rv, int32_t addr, int32_t len, void *ptr)
 {
-    int i;
     char *src = (char*)&((char*)rv->mem)[addr - rv->mem_base];
-    char *dst = (char*)ptr;
 
     if (addr < rv->mem_base || (addr + len) > (rv->mem_base + rv->mem_size))
         return false;
 
-    for(i = 0; i < len; i++)
-        dst[i] = src[i];
+    memcpy(ptr, src, len);
 
     return true;
 }
 
-static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val) {
+////////////////////////////////////////////////////////////////////////////
+// Memory mapped devices
+//
+// The loads and stores go to the memory first, the device is looked up
+// only when the address is out of the memory.
+
+static inline srv32_device *srv32_find_device(struct rv *rv, uint32_t addr) {
+    uint8_t *tbl = rv->device_map[addr >> (32 - DEVICE_DIR_BITS)];
+    srv32_device *dev;
+    int n;
+
+    if (!tbl || (n = tbl[(addr >> DEVICE_PAGE_BITS) & (DEVICE_TBL_SIZE - 1)]) == 0)
+        return NULL;
+
+    dev = &rv->devices[n - 1];
+
+    return (addr - dev->base < dev->size) ? dev : NULL;
+}
+
+bool srv32_add_device(struct rv *rv, const srv32_device *dev) {
+    uint64_t first = dev->base >> DEVICE_PAGE_BITS;
+    uint64_t last  = ((uint64_t)dev->base + dev->size - 1) >> DEVICE_PAGE_BITS;
+    uint64_t page;
+
+    if (dev->size == 0 || (uint64_t)dev->base + dev->size > (1ULL << 32) ||
+        rv->ndevices >= DEVICE_MAX) {
+        printf("Can not add device %s\n", dev->name);
+        return false;
+    }
+
+    if ((uint64_t)dev->base + dev->size > (uint32_t)rv->mem_base &&
+        dev->base < (uint64_t)(uint32_t)rv->mem_base + rv->mem_size) {
+        printf("Device %s overlaps the memory\n", dev->name);
+        return false;
+    }
+
+    for(page = first; page <= last; page++) {
+        uint8_t *tbl = rv->device_map[page >> (32 - DEVICE_DIR_BITS - DEVICE_PAGE_BITS)];
+        if (tbl && tbl[page & (DEVICE_TBL_SIZE - 1)]) {
+            printf("Device %s overlaps device %s\n", dev->name,
+                   rv->devices[tbl[page & (DEVICE_TBL_SIZE - 1)] - 1].name);
+            return false;
+        }
+    }
+
+    for(page = first; page <= last; page++) {
+        uint8_t **tbl = &rv->device_map[page >> (32 - DEVICE_DIR_BITS - DEVICE_PAGE_BITS)];
+        if (!*tbl && (*tbl = (uint8_t*)calloc(DEVICE_TBL_SIZE, 1)) == NULL) {
+            // LCOV_EXCL_START
+            printf("malloc fail\n");
+            return false;
+            // LCOV_EXCL_STOP
+        }
+        (*tbl)[page & (DEVICE_TBL_SIZE - 1)] = rv->ndevices + 1;
+    }
+
+    rv->devices[rv->ndevices++] = *dev;
+
+    return true;
+}
+
+// the mask of the stored bytes
+#define STORE_MASK(len) ((len) == 1 ? 0xff : (len) == 2 ? 0xffff : 0xffffffff)
+
+// console, exit and HTIF of the host
+static bool host_read(struct rv *rv, void *priv, uint32_t offset, int len, int32_t *data) {
+    switch(MMIO_HOST + offset) {
+        case MMIO_PUTC:
+            *data = 0;
+            break;
+        case MMIO_GETC:
+            if (!srv32_replay_input(rv, REPLAY_GETC, data, NULL, 0))
+                *data = getch();
+            srv32_record_input(rv, REPLAY_GETC, *data, NULL);
+            break;
+        case MMIO_EXIT:
+            *data = 0;
+            break;
+        case MMIO_FROMHOST:
+            *data = srv32_fromhost(rv);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+static bool host_write(struct rv *rv, void *priv, uint32_t offset, int len, int32_t data) {
+    uint32_t address = MMIO_HOST + offset;
+    int mask = STORE_MASK(len);
+
+    switch(address) {
+        case MMIO_PUTC:
+            // written at the first execution
+            if (REV_REPLAY(rv))
+                break;
+            if (rv->fo) {
+                fputc((char)data, rv->fo);
+            } else {
+                putchar((char)data);
+                fflush(stdout);
+            }
+            break;
+        case MMIO_GETC:
+            break;
+        case MMIO_EXIT:
+            LOG_WRITE(address, data & mask);
+            rv->exitcode = data;
+            rv->exited = true;
+            break;
+        case MMIO_TOHOST:
+            {
+                int htif_mem = 0;
+                srv32_read_mem(rv, data, sizeof(int), (void*)&htif_mem);
+                if (htif_mem == SYS_EXIT) {
+                    LOG_WRITE(address, data & mask);
+                }
+            }
+            srv32_tohost(rv, (int32_t)data);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// machine timer and software interrupt
+static bool clint_read(struct rv *rv, void *priv, uint32_t offset, int len, int32_t *data) {
     COUNTER counter;
 
+    switch(MMIO_CLINT + offset) {
+        case MMIO_MTIME:
+            counter.c = rv->csr.mtime.c - 1;
+            *data = counter.d.lo;
+            break;
+        case MMIO_MTIME+4:
+            counter.c = rv->csr.mtime.c - 1;
+            *data = counter.d.hi;
+            break;
+        case MMIO_MTIMECMP:
+            *data = rv->csr.mtimecmp.d.lo;
+            break;
+        case MMIO_MTIMECMP+4:
+            *data = rv->csr.mtimecmp.d.hi;
+            break;
+        case MMIO_MSIP:
+            *data = rv->csr.msip;
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+static bool clint_write(struct rv *rv, void *priv, uint32_t offset, int len, int32_t data) {
+    int mask = STORE_MASK(len);
+
+    switch(MMIO_CLINT + offset) {
+        case MMIO_MTIME:
+            rv->csr.mtime.d.lo = (rv->csr.mtime.d.lo & ~mask) | data;
+            rv->csr.mtime.c--;
+            rv->mtime_update = 1;
+            break;
+        case MMIO_MTIME+4:
+            rv->csr.mtime.d.hi = (rv->csr.mtime.d.hi & ~mask) | data;
+            rv->csr.mtime.c--;
+            rv->mtime_update = 1;
+            break;
+        case MMIO_MTIMECMP:
+            rv->csr.mtimecmp.d.lo = (rv->csr.mtimecmp.d.lo & ~mask) | data;
+            srv32_irq_schedule(rv);
+            break;
+        case MMIO_MTIMECMP+4:
+            rv->csr.mtimecmp.d.hi = (rv->csr.mtimecmp.d.hi & ~mask) | data;
+            srv32_irq_schedule(rv);
+            break;
+        case MMIO_MSIP:
+            rv->csr.msip = (rv->csr.msip & ~mask) | data;
+            srv32_irq_schedule(rv);
+            break;
+        default:
+            return false;
+    }
+
+    // the interrupt state is changed
+    rv->block_break = 1;
+
+    return true;
+}
+
+static const srv32_device builtin_devices[] = {
+    { "host",  MMIO_HOST,  MMIO_HOST_SIZE,  host_read,  host_write,  NULL },
+    { "clint", MMIO_CLINT, MMIO_CLINT_SIZE, clint_read, clint_write, NULL }
+};
+
+// The access of len bytes at addr is in the memory. One unsigned compare
+// covers both bounds, the access is aligned to len, so it is a single host
+// load or store at the offset.
+#define MEM_OFFSET(rv, addr)  ((uint32_t)((addr) - (rv)->mem_base))
+#define IN_MEM(rv, addr, len) (MEM_OFFSET(rv, addr) <= (uint32_t)((rv)->mem_size - (len)))
+
+// The access of the memory of a platform takes the wait states of the
+// region, false if it is in a hole or writes to a read-only region.
+static bool srv32_region_access(struct rv *rv, int32_t addr, int len, bool write) {
+    const platform_region *r = platform_find(&rv->platform, addr, len);
+
+    if (!r || (write && r->readonly))
+        return false;
+
+    if (r->latency)
+        srv32_stall(rv, SRV32_STALL_MEMORY, r->latency);
+
+    return true;
+}
+
+static inline int32_t mem_load(const char *ptr, int len) {
+    uint16_t h;
+    int32_t w;
+
+    switch(len) {
+        case 1:
+            return *(const uint8_t*)ptr;
+        case 2:
+            memcpy(&h, ptr, sizeof(h));
+            return h;
+        default:
+            memcpy(&w, ptr, sizeof(w));
+            return w;
+    }
+}
+
+static inline void mem_store(char *ptr, int len, int32_t data) {
+    uint16_t h = (uint16_t)data;
+
+    switch(len) {
+        case 1:
+            *(uint8_t*)ptr = (uint8_t)data;
+            break;
+        case 2:
+            memcpy(ptr, &h, sizeof(h));
+            break;
+        default:
+            memcpy(ptr, &data, sizeof(data));
+            break;
+    }
+}
+
+static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val) {
     if (type == OP_LOAD) {
         int32_t data = 0;
         int32_t len = 0;
@@ -467,43 +828,24 @@ static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val)
                 return TRAP_INST_ILL;
         }
 
-        if (!srv32_read_mem(rv, address, len, (void*)&data)) {
-            switch(address) {
-                case MMIO_PUTC:
-                    data = 0;
-                    break;
-                case MMIO_GETC:
-                    data = getch();
-                    break;
-                case MMIO_EXIT:
-                    data = 0;
-                    break;
-                case MMIO_FROMHOST:
-                    data = srv32_fromhost(rv);
-                    break;
-                case MMIO_MTIME:
-                    counter.c = rv->csr.mtime.c - 1;
-                    data = counter.d.lo;
-                    break;
-                case MMIO_MTIME+4:
-                    counter.c = rv->csr.mtime.c - 1;
-                    data = counter.d.hi;
-                    break;
-                case MMIO_MTIMECMP:
-                    //rv->csr.mip = rv->csr.mip & ~(1 << MTIP);
-                    data = rv->csr.mtimecmp.d.lo;
-                    break;
-                case MMIO_MTIMECMP+4:
-                    //rv->csr.mip = rv->csr.mip & ~(1 << MTIP);
-                    data = rv->csr.mtimecmp.d.hi;
-                    break;
-                case MMIO_MSIP:
-                    data = rv->csr.msip;
-                    break;
-                default:
-                    printf("Unknown address 0x%08x to read at PC 0x%08x\n",
-                           address, rv->pc);
-                    return TRAP_LD_FAIL;
+        if (IN_MEM(rv, address, len) &&
+            (rv->flat || srv32_region_access(rv, address, len, false))) {
+            uint32_t offset = MEM_OFFSET(rv, address);
+
+            data = mem_load((char*)rv->mem + offset, len);
+
+            if (rv->watch_map && WATCH_TEST(rv, offset, SRV32_WATCH_READ))
+                srv32_watch_access(rv, address, len, SRV32_WATCH_READ);
+        } else {
+            srv32_device *dev;
+
+            srv32_sync(rv);
+            dev = srv32_find_device(rv, address);
+            if (!dev || !dev->read ||
+                !dev->read(rv, dev->priv, address - dev->base, len, &data)) {
+                printf("Unknown address 0x%08x to read at PC 0x%08x\n",
+                       address, rv->pc);
+                return TRAP_LD_FAIL;
             }
         }
 
@@ -526,10 +868,6 @@ static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val)
     if (type == OP_STORE) {
         int data = *val;
         int len  = 0;
-        int mask = (op == OP_SB) ? 0xff :
-                   (op == OP_SH) ? 0xffff :
-                   (op == OP_SW) ? 0xffffffff :
-                   0xffffffff;
 
         switch(op) {
             case OP_SB:
@@ -556,56 +894,31 @@ static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val)
                 return TRAP_INST_ILL;
         }
 
-        if (!srv32_write_mem(rv, address, len, (void*)&data)) {
-            switch(address) {
-                case MMIO_PUTC:
-                    putchar((char)data);
-                    fflush(stdout);
-                    break;
-                case MMIO_GETC:
-                    break;
-                case MMIO_EXIT:
-                    TRACE_LOG " write 0x%08x <= 0x%08x\n",
-                              address, (data & mask)
-                    TRACE_END;
-                    rv->exitcode = data;
-                    return RV_EXIT;
-                    break;
-                case MMIO_TOHOST:
-                    {
-                        int htif_mem = 0;
-                        srv32_read_mem(rv, data, sizeof(int), (void*)&htif_mem);
-                        if (htif_mem == SYS_EXIT) {
-                            TRACE_LOG " write 0x%08x <= 0x%08x\n",
-                                      address, (data & mask)
-                            TRACE_END;
-                        }
-                    }
-                    srv32_tohost(rv, (int32_t)data);
-                    break;
-                case MMIO_MTIME:
-                    rv->csr.mtime.d.lo = (rv->csr.mtime.d.lo & ~mask) | data;
-                    rv->csr.mtime.c--;
-                    rv->mtime_update = 1;
-                    break;
-                case MMIO_MTIME+4:
-                    rv->csr.mtime.d.hi = (rv->csr.mtime.d.hi & ~mask) | data;
-                    rv->csr.mtime.c--;
-                    rv->mtime_update = 1;
-                    break;
-                case MMIO_MTIMECMP:
-                    rv->csr.mtimecmp.d.lo = (rv->csr.mtimecmp.d.lo & ~mask) | data;
-                    break;
-                case MMIO_MTIMECMP+4:
-                    rv->csr.mtimecmp.d.hi = (rv->csr.mtimecmp.d.hi & ~mask) | data;
-                    break;
-                case MMIO_MSIP:
-                    rv->csr.msip = (rv->csr.msip & ~mask) | data;
-                    break;
-                default:
-                    printf("Unknown address 0x%08x to write at PC 0x%08x\n",
-                           address, rv->pc);
-                    return TRAP_ST_FAIL;
+        if (IN_MEM(rv, address, len) &&
+            (rv->flat || srv32_region_access(rv, address, len, true))) {
+            uint32_t offset = MEM_OFFSET(rv, address);
+
+            if (rv->rev)
+                srv32_reverse_mem(rv, address, len);
+
+            mem_store((char*)rv->mem + offset, len, data);
+
+            if (rv->watch_map && WATCH_TEST(rv, offset, SRV32_WATCH_WRITE))
+                srv32_watch_access(rv, address, len, SRV32_WATCH_WRITE);
+
+            // the aligned store is in one code page
+            if (rv->code_map[offset >> CODE_PAGE_BITS])
+                srv32_flush_icache(rv, address, len);
+        } else {
+            srv32_device *dev;
+
+            srv32_sync(rv);
+            dev = srv32_find_device(rv, address);
+            if (!dev || !dev->write ||
+                !dev->write(rv, dev->priv, address - dev->base, len, data)) {
+                printf("Unknown address 0x%08x to write at PC 0x%08x\n",
+                       address, rv->pc);
+                return TRAP_ST_FAIL;
             }
         }
     }
@@ -613,250 +926,941 @@ static int memrw(struct rv *rv, int type, int op, int32_t address, int32_t *val)
     return 0;
 }
 
-int main(int argc, char **argv) {
-    int i;
-    struct rv *rv = NULL;
-    char *file = NULL;
-    char *tfile = NULL;
-
-    #ifdef GDBSTUB
-    int gdbport = 0;
-    #endif
-
-    const char *optstring = "hdg:b:pl:qm:n:s";
-    int c;
-    struct option opts[] = {
-        {"help", 0, NULL, 'h'},
-        {"debug", 0, NULL, 'd'},
-        {"gdb", 1, NULL, 'g'},
-        {"branch", 1, NULL, 'b'},
-        {"predict", 0, NULL, 'p'},
-        {"log", 1, NULL, 'l'},
-        {"quiet", 0, NULL, 'q'},
-        {"membase", 1, NULL, 'm'},
-        {"memsize", 1, NULL, 'n'},
-        {"single", 0, NULL, 's'}
-    };
+////////////////////////////////////////////////////////////////////////////
+// Instruction handlers
+//
+// Each instruction is decoded once into a rv_insn entry of the instruction
+// cache, which keeps the handler, the register indices and the sign-extended
+// immediate. srv32_step() calls the handler directly for the cached entry.
+
+#define RS1         srv32_read_regs(rv, ir->rs1)
+#define RS2         srv32_read_regs(rv, ir->rs2)
+#define IMM         (ir->imm)
+#define NEXT_PC     rv->pc = ir->compressed ? rv->pc + 2 : rv->pc + 4
+
+// register-register or register-immediate operation
+#define EXEC_ALU(name, expr) \
+static int exec_##name(struct rv *rv, const rv_insn *ir) { \
+    srv32_write_regs(rv, ir->rd, (expr)); \
+    LOG_RD; \
+    NEXT_PC; \
+    return RV_OKAY; \
+}
 
-    if ((rv = (struct rv*)aligned_malloc(sizeof(int), sizeof(struct rv))) == NULL) {
-        // LCOV_EXCL_START
-        printf("malloc fail\n");
-        exit(1);
-        // LCOV_EXCL_STOP
-    }
+static int exec_unknown(struct rv *rv, const rv_insn *ir) {
+    printf("Unknown instruction at PC 0x%08x\n", rv->pc);
+    srv32_trap(rv, TRAP_INST_ILL, ir->inst.inst);
+    return RV_TRAP;
+}
 
-    // clear rv data structure
-    memset(rv, 0, sizeof(struct rv));
+static int exec_illegal(struct rv *rv, const rv_insn *ir) {
+    printf("Illegal instruction at PC 0x%08x\n", rv->pc);
+    LOG_PC(true);
+    srv32_trap(rv, TRAP_INST_ILL, ir->inst.inst);
+    return RV_TRAP;
+}
 
-    // set default value
-    rv->branch_penalty = BRANCH_PENALTY;
-    rv->mem_size = (MEMSIZE)*2*1024; // default memory size
-    rv->mem_base = MEMBASE;
-
-    while((c = getopt_long(argc, argv, optstring, opts, NULL)) != -1) {
-        switch(c) {
-            case 'h':
-                usage();
-                return 1;
-            case 'g':
-                #ifdef GDBSTUB
-                gdbport = atoi(optarg);
-                #else
-                fprintf(stderr, "gdbstub does not support.\n");
-                return 1;
-                #endif
-                break;
-            case 'd':
-                rv->debug_en = 1;
-                break;
-            case 'b':
-                rv->branch_penalty = atoi(optarg);
-                break;
-            case 'p':
-                rv->branch_predict = 1;
-                break;
-            case 'l':
-                if ((tfile = malloc(MAXLEN)) == NULL) {
-                    // LCOV_EXCL_START
-                    printf("malloc fail\n");
-                    exit(1);
-                    // LCOV_EXCL_STOP
-                }
-                strncpy_s(tfile, MAXLEN-1, optarg, MAXLEN-1);
-                break;
-            case 'q':
-                quiet = 1;
-                break;
-            case 'm':
-                sscanf(optarg, "%i", (int32_t*)&rv->mem_base);
-                break;
-            case 'n':
-                sscanf(optarg, "%i", (int32_t*)&rv->mem_size);
-                // assume instruction and data RAM are the same size
-                // the total size is mem_size * 2 * 1024
-                rv->mem_size *= (2*1024);
-                break;
-            case 's':
-                rv->singleram = true;
-                break;
-            default:
-                usage();
-                return 1;
-        }
-    }
+#ifdef RV32C_ENABLED
+// illegal compressed instruction, the immediate keeps the 16-bit instruction
+static int exec_cillegal(struct rv *rv, const rv_insn *ir) {
+    srv32_trap(rv, TRAP_INST_ILL, ir->imm);
+    return RV_TRAP;
+}
+#endif // RV32C_ENABLED
 
-    if (optind < argc) {
-        if ((file = malloc(MAXLEN)) == NULL) {
-            // LCOV_EXCL_START
-            printf("malloc fail\n");
-            exit(1);
-            // LCOV_EXCL_STOP
-        }
-        strncpy_s(file, MAXLEN-1, argv[optind], MAXLEN-1);
-    } else {
-        usage();
-        printf("Error: missing input file.\n\n");
-        return 1;
-    }
+EXEC_ALU(auipc, rv->pc + IMM)
+EXEC_ALU(lui,   IMM)
 
-    if (!file) {
-        usage();
-        return 1;
-    }
+static int exec_jal(struct rv *rv, const rv_insn *ir) {
+    int pc_old = rv->pc;
+    int pc_off = IMM;
 
-    if (tfile) {
-        if ((rv->ft=fopen(tfile, "w")) == NULL) {
-            // LCOV_EXCL_START
-            printf("can not open file %s\n", tfile);
-            exit(1);
-            // LCOV_EXCL_STOP
-        }
-    }
+    LOG_PC(false);
 
-    if ((rv->mem = (int*)aligned_malloc(sizeof(int), rv->mem_size)) == NULL) {
-        // LCOV_EXCL_START
-        printf("malloc fail\n");
-        exit(1);
-        // LCOV_EXCL_STOP
+    rv->pc += pc_off;
+
+    // LCOV_EXCL_START
+    if (pc_off == 0) {
+        printf("Warning: forever loop detected at PC 0x%08x\n", rv->pc);
+        rv->exitcode = 1;
+        return RV_EXIT;
     }
+    // LCOV_EXCL_STOP
 
-    // clear the data memory
-    memset(rv->mem, 0, rv->mem_size);
+    rv->pc = rv->pc & ~1; // setting the least-signicant bit of the result to zero
 
-    // load elf file
-    if (!elfloader(file, rv)) {
-        // LCOV_EXCL_START
-        printf("Can not read elf file %s\n", file);
-        exit(1);
-        // LCOV_EXCL_STOP
+    #ifndef RV32C_ENABLED
+    if ((rv->pc & 3) != 0) {
+        // Instruction address misaligned
+        LOG_NL;
+        return RV_OKAY;
     }
+    #endif // RV32C_ENABLED
 
-    // Registers initialize
-    for(i=0; i<REGNUM; i++) {
-        srv32_write_regs(rv, i, 0);
-    }
+    srv32_write_regs(rv, ir->rd, ir->compressed ? pc_old + 2 : pc_old + 4);
+    LOG_REG(ir->rd);
 
-    rv->csr.mvendorid  = MVENDORID;
-    rv->csr.marchid    = MARCHID;
-    rv->csr.mimpid     = MIMPID;
-    rv->csr.mhartid    = MHARTID;
-    rv->csr.misa       = MISA;
-    rv->csr.time.c     = 0;
-    rv->csr.cycle.c    = 0;
-    rv->csr.instret.c  = 0;
-    rv->csr.mtime.c    = 0;
-    rv->csr.mtimecmp.c = 0;
-    rv->pc             = rv->mem_base;
-    rv->prev_pc        = rv->pc;
+    srv32_stall(rv, SRV32_STALL_JUMP, rv->branch_penalty);
+    return RV_OKAY;
+}
+
+static int exec_jalr(struct rv *rv, const rv_insn *ir) {
+    int pc_old = rv->pc;
+    int pc_new = RS1 + IMM;
 
-    gettimeofday(&time_start, NULL);
+    LOG_PC(false);
+
+    rv->pc = pc_new;
 
-    #ifdef GDBSTUB
     // LCOV_EXCL_START
-    if (gdbport != 0) {
-        static char gdbstub_port[] = "127.0.0.1:xxxxxx";
-
-        snprintf(gdbstub_port, sizeof(gdbstub_port)-1, "127.0.0.1:%d", gdbport);
-        gdbstub_port[sizeof(gdbstub_port)-1] = 0; // ensure that the string is end of NULL
-
-        fprintf(stderr, "start gdbstub at %s...\n", gdbstub_port);
-
-        if (!gdbstub_init(&rv->gdbstub, &gdbstub_ops,
-                  (arch_info_t){
-                      .reg_num = REGNUM+1,
-                      .smp = 1,
-                      .target_desc = TARGET_RV32,
-                  }, gdbstub_port)) {
-            fprintf(stderr, "Fail to create socket.\n");
-            goto main_exit;
-        }
+    if (pc_new == pc_old) {
+        LOG_NL;
+        printf("Warning: forever loop detected at PC 0x%08x\n", rv->pc);
+        rv->exitcode = 1;
+        return RV_EXIT;
+    }
+    // LCOV_EXCL_STOP
+
+    rv->pc = rv->pc & ~1; // setting the least-signicant bit of the result to zero
+
+    #ifndef RV32C_ENABLED
+    if ((rv->pc & 3) != 0) {
+        // Instruction address misaligned
+        LOG_NL;
+        return RV_OKAY;
+    }
+    #endif // RV32C_ENABLED
 
-        if (!gdbstub_run(&rv->gdbstub, (void *) rv))
-            goto main_exit;
+    srv32_write_regs(rv, ir->rd, ir->compressed ? pc_old + 2 : pc_old + 4);
+    LOG_REG(ir->rd);
 
-        gdbstub_close(&rv->gdbstub);
+    srv32_stall(rv, SRV32_STALL_JUMP, rv->branch_penalty);
+    return RV_OKAY;
+}
+
+#define EXEC_BRANCH(name, cond) \
+static int exec_##name(struct rv *rv, const rv_insn *ir) { \
+    LOG_PC(true); \
+    if (cond) { \
+        rv->cpi.taken++; \
+        rv->block_break = 1; \
+        rv->pc += IMM; \
+        if ((!rv->branch_predict || IMM > 0) && (rv->pc & 3) == 0) \
+            srv32_stall(rv, SRV32_STALL_BRANCH, rv->branch_penalty); \
+        return RV_OKAY; \
+    } \
+    NEXT_PC; \
+    return RV_OKAY; \
+}
+
+EXEC_BRANCH(beq,  RS1 == RS2)
+EXEC_BRANCH(bne,  RS1 != RS2)
+EXEC_BRANCH(blt,  RS1 <  RS2)
+EXEC_BRANCH(bge,  RS1 >= RS2)
+EXEC_BRANCH(bltu, ((uint32_t)RS1) <  ((uint32_t)RS2))
+EXEC_BRANCH(bgeu, ((uint32_t)RS1) >= ((uint32_t)RS2))
+
+static int exec_branch_illegal(struct rv *rv, const rv_insn *ir) {
+    LOG_PC(true);
+    printf("Illegal branch instruction at PC 0x%08x\n", rv->pc);
+    srv32_trap(rv, TRAP_INST_ILL, ir->inst.inst);
+    return RV_TRAP;
+}
 
-        goto main_exit;
+static int exec_load(struct rv *rv, const rv_insn *ir) {
+    int32_t data;
+    int32_t address = RS1 + IMM;
+
+    LOG_PC(false);
+
+    int result = memrw(rv, OP_LOAD, ir->inst.i.func3, address, &data);
+
+    if (rv->singleram) srv32_stall(rv, SRV32_STALL_SINGLERAM, 1);
+
+    switch(result) {
+        case TRAP_LD_FAIL:
+             LOG_NL;
+             srv32_trap(rv, TRAP_LD_FAIL, address);
+             return RV_TRAP;
+        case TRAP_LD_ALIGN:
+             LOG_NL;
+             srv32_trap(rv, TRAP_LD_ALIGN, address);
+             return RV_TRAP;
+        case TRAP_INST_ILL:
+             LOG_READ(address, ir->rd, 0);
+             srv32_trap(rv, TRAP_INST_ILL, ir->inst.inst);
+             return RV_TRAP;
     }
-    // LCOV_EXCL_STOP
-    #endif // GDBSTUB
 
-    // Execution loop
-    do {
-        if (rv->debug_en)
-            if (debug(rv) == RV_EXIT)
-                break;
-        if (srv32_step(rv) == RV_EXIT)
+    srv32_write_regs(rv, ir->rd, data);
+    LOG_READ(address, ir->rd, srv32_read_regs(rv, ir->rd));
+
+    NEXT_PC;
+    return RV_OKAY;
+}
+
+static int exec_store(struct rv *rv, const rv_insn *ir) {
+    int address = RS1 + IMM;
+    int data = RS2;
+
+    int mask = (ir->inst.s.func3 == OP_SB) ? 0xff :
+               (ir->inst.s.func3 == OP_SH) ? 0xffff :
+               (ir->inst.s.func3 == OP_SW) ? 0xffffffff :
+               0xffffffff;
+
+    LOG_PC(false);
+
+    int result = memrw(rv, OP_STORE, ir->inst.s.func3, address, &data);
+
+    // the program is terminated by MMIO_EXIT or HTIF
+    if (rv->exited)
+        return RV_EXIT;
+
+    if (rv->singleram) srv32_stall(rv, SRV32_STALL_SINGLERAM, 1);
+
+    switch(result) {
+        case TRAP_ST_FAIL:
+             LOG_NL;
+             srv32_trap(rv, TRAP_ST_FAIL, address);
+             return RV_TRAP;
+        case TRAP_ST_ALIGN:
+             LOG_NL;
+             srv32_trap(rv, TRAP_ST_ALIGN, address);
+             return RV_TRAP;
+        case TRAP_INST_ILL:
+             LOG_NL;
+             srv32_trap(rv, TRAP_INST_ILL, ir->inst.inst);
+             return RV_TRAP;
+    }
+
+    LOG_WRITE(address, data & mask);
+
+    NEXT_PC;
+    return RV_OKAY;
+}
+
+// I-Type
+EXEC_ALU(addi,  RS1 + IMM)
+EXEC_ALU(slti,  RS1 < IMM ? 1 : 0)
+//FIXME: to pass compliance test, the IMM should be singed
+//extension, and compare with unsigned.
+EXEC_ALU(sltiu, ((uint32_t)RS1) < ((uint32_t)IMM) ? 1 : 0)
+EXEC_ALU(xori,  RS1 ^ IMM)
+EXEC_ALU(ori,   RS1 | IMM)
+EXEC_ALU(andi,  RS1 & IMM)
+EXEC_ALU(slli,  RS1 << (IMM&0x1f))
+EXEC_ALU(srli,  ((uint32_t)RS1) >> (IMM&0x1f))
+EXEC_ALU(srai,  RS1 >> (IMM&0x1f))
+
+// R-Type
+EXEC_ALU(add,   RS1 + RS2)
+EXEC_ALU(sub,   RS1 - RS2)
+EXEC_ALU(sll,   RS1 << RS2)
+EXEC_ALU(slt,   RS1 < RS2 ? 1 : 0)
+EXEC_ALU(sltu,  ((uint32_t)RS1) < ((uint32_t)RS2) ? 1 : 0)
+EXEC_ALU(xor,   RS1 ^ RS2)
+EXEC_ALU(srl,   ((uint32_t)RS1) >> RS2)
+EXEC_ALU(sra,   RS1 >> RS2)
+EXEC_ALU(or,    RS1 | RS2)
+EXEC_ALU(and,   RS1 & RS2)
+
+#ifdef RV32M_ENABLED
+EXEC_ALU(mul,   RS1 * RS2)
+EXEC_ALU(mulh,  (int32_t)(((int64_t)RS1 * (int64_t)RS2) >> 32))
+EXEC_ALU(mulhsu,(int32_t)(((int64_t)RS1 * (int64_t)(uint32_t)RS2) >> 32))
+EXEC_ALU(mulhu, (int32_t)(((uint64_t)(uint32_t)RS1 * (uint64_t)(uint32_t)RS2) >> 32))
+EXEC_ALU(div,   RS2 ? (int32_t)(((int64_t)RS1) / RS2) : (int32_t)0xffffffff)
+EXEC_ALU(divu,  RS2 ? (int32_t)(((uint32_t)RS1) / ((uint32_t)RS2)) : (int32_t)0xffffffff)
+EXEC_ALU(rem,   RS2 ? (int32_t)(((int64_t)RS1) % RS2) : RS1)
+EXEC_ALU(remu,  RS2 ? (int32_t)(((uint32_t)RS1) % ((uint32_t)RS2)) : RS1)
+#endif // RV32M_ENABLED
+
+#ifdef RV32B_ENABLED
+EXEC_ALU(bseti, RS1 | (1 << (IMM&0x1f)))
+EXEC_ALU(bclri, RS1 & ~(1 << (IMM&0x1f)))
+EXEC_ALU(binvi, RS1 ^ (1 << (IMM&0x1f)))
+EXEC_ALU(bexti, (RS1 >> (IMM&0x1f)) & 1)
+EXEC_ALU(sextb, (RS1 & 0x80) ? (RS1 | 0xffffff00) : (RS1 & 0xff))
+EXEC_ALU(sexth, (RS1 & 0x8000) ? (RS1 | 0xffff0000) : (RS1 & 0xffff))
+EXEC_ALU(andn,  RS1 & ~(RS2))
+EXEC_ALU(orn,   RS1 | ~(RS2))
+EXEC_ALU(xnor,  ~(RS1 ^ RS2))
+EXEC_ALU(zexth, RS1 & 0xffff)
+EXEC_ALU(max,   RS1 > RS2 ? RS1 : RS2)
+EXEC_ALU(maxu,  ((uint32_t)RS1) > ((uint32_t)RS2) ? RS1 : RS2)
+EXEC_ALU(min,   RS1 < RS2 ? RS1 : RS2)
+EXEC_ALU(minu,  ((uint32_t)RS1) < ((uint32_t)RS2) ? RS1 : RS2)
+EXEC_ALU(sh1add, RS2 + (RS1 << 1))
+EXEC_ALU(sh2add, RS2 + (RS1 << 2))
+EXEC_ALU(sh3add, RS2 + (RS1 << 3))
+EXEC_ALU(bset,  RS1 | (1 << (RS2 & 0x1f)))
+EXEC_ALU(bclr,  RS1 & ~(1 << (RS2 & 0x1f)))
+EXEC_ALU(bext,  (RS1 >> (RS2 & 0x1f)) & 1)
+EXEC_ALU(binv,  RS1 ^ (1 << (RS2 & 0x1f)))
+
+static inline int32_t rv_clz(int32_t x) {
+    int32_t r = 0;
+    if (!x) {
+        r = 32;
+    } else {
+        if (!(x & 0xffff0000)) { x <<= 16; r += 16; }
+        if (!(x & 0xff000000)) { x <<=  8; r +=  8; }
+        if (!(x & 0xf0000000)) { x <<=  4; r +=  4; }
+        if (!(x & 0xc0000000)) { x <<=  2; r +=  2; }
+        if (!(x & 0x80000000)) {           r +=  1; }
+    }
+    return r;
+}
+
+static inline int32_t rv_ctz(int32_t x) {
+    static const uint8_t table[32] = {
+      0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+      31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return (!x) ? 32 :
+        (int32_t)table[((uint32_t)((x & -x) * 0x077CB531U)) >> 27];
+}
+
+static inline int32_t rv_cpop(int32_t n) {
+    uint32_t c = 0;
+    while (n) {
+        n &= (n - 1);
+        c++;
+    }
+    return c;
+}
+
+static inline int32_t rv_orcb(int32_t v) {
+    int32_t n = 0;
+    if (v & 0x000000ff) n |= 0x000000ff;
+    if (v & 0x0000ff00) n |= 0x0000ff00;
+    if (v & 0x00ff0000) n |= 0x00ff0000;
+    if (v & 0xff000000) n |= 0xff000000;
+    return n;
+}
+
+static inline int32_t rv_rev8(uint32_t n) {
+    return ((n >> 24) & 0x000000ff) |
+           ((n >>  8) & 0x0000ff00) |
+           ((n <<  8) & 0x00ff0000) |
+           ((n << 24) & 0xff000000);
+}
+
+static inline int32_t rv_clmul(int32_t a, int32_t b) {
+    int32_t n = 0;
+    for(int i = 0; i <= 31; i++)
+        if ((b >> i) & 1) n ^= (a << i);
+    return n;
+}
+
+static inline int32_t rv_clmulh(uint32_t a, uint32_t b) {
+    int32_t n = 0;
+    for(int i = 1; i < 32; i++)
+        if ((b >> i) & 1) n ^= (a >> (32 - i));
+    return n;
+}
+
+static inline int32_t rv_clmulr(uint32_t a, uint32_t b) {
+    int32_t n = 0;
+    for(int i = 0; i < 32; i++)
+        if ((b >> i) & 1) n ^= (a >> (32 - i - 1));
+    return n;
+}
+
+EXEC_ALU(clz,    rv_clz(RS1))
+EXEC_ALU(ctz,    rv_ctz(RS1))
+EXEC_ALU(cpop,   rv_cpop(RS1))
+EXEC_ALU(orcb,   rv_orcb(RS1))
+EXEC_ALU(rev8,   rv_rev8(RS1))
+EXEC_ALU(rori,   (((uint32_t)RS1) >> (IMM&0x1f)) | (((uint32_t)RS1) << (32 - (IMM&0x1f))))
+EXEC_ALU(rol,    (RS1 << (RS2 & 0x1f)) | ((uint32_t)RS1 >> (32 - (RS2 & 0x1f))))
+EXEC_ALU(ror,    ((uint32_t)RS1 >> (RS2 & 0x1f)) | (RS1 << (32 - (RS2 & 0x1f))))
+EXEC_ALU(clmul,  rv_clmul(RS1, RS2))
+EXEC_ALU(clmulh, rv_clmulh(RS1, RS2))
+EXEC_ALU(clmulr, rv_clmulr(RS1, RS2))
+#endif // RV32B_ENABLED
+
+static int exec_fence(struct rv *rv, const rv_insn *ir) {
+    LOG_PC(true);
+    NEXT_PC;
+    return RV_OKAY;
+}
+
+// Wait for interrupt. The core is idle until the timer interrupt, so mtime
+// and the cycle counter are moved to mtimecmp directly. The software and
+// external interrupts are raised by the program itself, WFI is a nop when
+// one of them is pending, or when no interrupt is enabled to wake up.
+static int exec_wfi(struct rv *rv, const rv_insn *ir) {
+    int pending = ((rv->csr.mie & (1 << MSIE)) && (rv->csr.msip & (1<<0))) ||
+                  ((rv->csr.mie & (1 << MEIE)) && (rv->csr.msip & (1<<16)));
+
+    if (!pending && (rv->csr.mie & (1 << MTIE)) &&
+        rv->csr.mtimecmp.c > rv->csr.mtime.c) {
+        long long idle = rv->csr.mtimecmp.c - rv->csr.mtime.c;
+        rv->csr.cycle.c += idle;
+        rv->csr.mtime.c += idle;
+        rv->cpi.events[SRV32_STALL_WFI]++;
+        rv->cpi.cycles[SRV32_STALL_WFI] += idle;
+    }
+
+    LOG_PC(true);
+    NEXT_PC;
+    return RV_OKAY;
+}
+
+static int exec_system(struct rv *rv, const rv_insn *ir) {
+    INST inst = ir->inst;
+    int val;
+    int update;
+    int csr_op = 0;
+    int csr_type;
+    // RDCYCLE, RDTIME and RDINSTRET are read only
+    switch(inst.i.func3) {
+        case OP_ECALL:
+            LOG_PC(true);
+            switch (inst.i.imm & 3) {
+               case 0: // ecall
+                   if (1) { // syscall, to compatible FreeRTOS usage, don't use it.
+                       int res;
+                       res = srv32_syscall(rv,
+                                           srv32_read_regs(rv, SYS),
+                                           srv32_read_regs(rv, A0),
+                                           srv32_read_regs(rv, A1),
+                                           srv32_read_regs(rv, A2),
+                                           srv32_read_regs(rv, A3),
+                                           srv32_read_regs(rv, A4),
+                                           srv32_read_regs(rv, A5));
+                       if (rv->exited)
+                           return RV_EXIT;
+                       // Notes: FreeRTOS will use ecall to perform context switching.
+                       // The syscall of newlib will confict with the syscall of
+                       // FreeRTOS.
+                       #if 0
+                       // FIXME: if it is prefined syscall, excute it.
+                       // otherwise raising a trap
+                       if (res != -1) {
+                            srv32_write_regs(rv, A0, res);
+                       } else {
+                            srv32_trap(rv, TRAP_ECALL, 0);
+                            return RV_TRAP;
+                       }
+                       break;
+                       #else
+                       if (res != -1)
+                            srv32_write_regs(rv, A0, res);
+                       srv32_trap(rv, TRAP_ECALL, 0);
+                       return RV_TRAP;
+                       #endif
+                   } else {
+                       srv32_trap(rv, TRAP_ECALL, 0);
+                       return RV_TRAP;
+                   }
+               case 1: // ebreak
+                   srv32_trap(rv, TRAP_BREAK, rv->pc);
+                   return RV_TRAP;
+               case 2: // mret
+                   rv->pc = rv->csr.mepc;
+                   // rv->csr.mstatus.mie = rv->csr.mstatus.mpie
+                   rv->csr.mstatus = (rv->csr.mstatus & (1 << MPIE)) ?
+                                      (rv->csr.mstatus | (1 << MIE)) :
+                                      (rv->csr.mstatus & ~(1 << MIE));
+                   // rv->csr.mstatus.mpie = 1
+                   srv32_irq_schedule(rv);
+
+                   #ifndef RV32C_ENABLED
+                   if ((rv->pc & 3) != 0) {
+                       // Instruction address misaligned
+                       return RV_OKAY;
+                   }
+                   #endif // RV32C_ENABLED
+                   srv32_stall(rv, SRV32_STALL_MRET, rv->branch_penalty);
+                   return RV_OKAY;
+               default:
+                   printf("Illegal system call at PC 0x%08x\n", rv->pc);
+                   srv32_trap(rv, TRAP_INST_ILL, 0);
+                   return RV_TRAP;
+            }
+            break;
+        case OP_CSRRWI:
+            csr_op   = 1;
+            val      = inst.i.rs1;
+            update   = 1;
+            csr_type = OP_CSRRW;
+            break;
+        // If the zimm[4:0] field is zero, then these instructions will not write
+        // to the CSR
+        case OP_CSRRW:
+            csr_op   = 1;
+            val      = srv32_read_regs(rv, inst.i.rs1);
+            update   = 1;
+            csr_type = OP_CSRRW;
+            break;
+        // For both CSRRS and CSRRC, if rs1=x0, then the instruction will not
+        // write to the CSR at all
+        case OP_CSRRSI:
+            csr_op   = 1;
+            val      = inst.i.rs1;
+            update   = (inst.i.rs1 == 0) ? 0 : 1;
+            csr_type = OP_CSRRS;
+            break;
+        case OP_CSRRS:
+            csr_op   = 1;
+            val      = srv32_read_regs(rv, inst.i.rs1);
+            update   = (inst.i.rs1 == 0) ? 0 : 1;
+            csr_type = OP_CSRRS;
+            break;
+        case OP_CSRRCI:
+            csr_op   = 1;
+            val      = inst.i.rs1;
+            update   = (inst.i.rs1 == 0) ? 0 : 1;
+            csr_type = OP_CSRRC;
+            break;
+        case OP_CSRRC:
+            csr_op   = 1;
+            val      = srv32_read_regs(rv, inst.i.rs1);
+            update   = (inst.i.rs1 == 0) ? 0 : 1;
+            csr_type = OP_CSRRC;
+            break;
+        default:
+            printf("Unknown system instruction at PC 0x%08x\n", rv->pc);
+            LOG_PC(true);
+            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
+            return RV_TRAP;
+    }
+    if (csr_op) {
+        int legal = 0;
+        int result = csr_rw(rv, inst.i.imm, csr_type, val, update, &legal);
+        if (legal) {
+            srv32_write_regs(rv, inst.i.rd, result);
+        }
+        // mstatus and mie may be changed
+        if (update)
+            srv32_irq_schedule(rv);
+        LOG_PC(false);
+        if (!legal) {
+           LOG_NL;
+           srv32_trap(rv, TRAP_INST_ILL, 0);
+           return RV_TRAP;
+        }
+        LOG_REG(inst.i.rd);
+    }
+
+    NEXT_PC;
+    return RV_OKAY;
+}
+
+static rv_handler decode_arithi(INST inst) {
+    switch(inst.i.func3) {
+        case OP_ADD:  return exec_addi;
+        case OP_SLT:  return exec_slti;
+        case OP_SLTU: return exec_sltiu;
+        case OP_XOR:  return exec_xori;
+        case OP_OR:   return exec_ori;
+        case OP_AND:  return exec_andi;
+        case OP_SLL:
+            switch (inst.r.func7) {
+                case FN_RV32I: return exec_slli;
+                #ifdef RV32B_ENABLED
+                case FN_BSET:  return exec_bseti;
+                case FN_BCLR:  return exec_bclri;
+                case FN_BINV:  return exec_binvi;
+                case FN_CLZ:
+                    switch (inst.r.rs2) {
+                        case 0: return exec_clz;
+                        case 1: return exec_ctz;
+                        case 2: return exec_cpop;
+                        case 4: return exec_sextb;
+                        case 5: return exec_sexth;
+                    }
+                    break;
+                #endif // RV32B_ENABLED
+            }
+            break;
+        case OP_SR:
+            switch (inst.r.func7) {
+                case FN_SRL: return exec_srli;
+                case FN_SRA: return exec_srai;
+                #ifdef RV32B_ENABLED
+                case FN_BSET:
+                    if (inst.r.rs2 == 7) return exec_orcb;
+                    break;
+                case FN_BCLR: return exec_bexti;
+                case FN_CLZ:  return exec_rori;
+                case FN_REV:
+                    if ((inst.i.imm&0x1f) == 0x18) return exec_rev8;
+                    break;
+                #endif // RV32B_ENABLED
+            }
+            break;
+    }
+    return exec_unknown;
+}
+
+static rv_handler decode_arithr(INST inst) {
+    switch (inst.r.func7) {
+        #ifdef RV32M_ENABLED
+        case FN_RV32M: // RV32M Multiply Extension
+            switch(inst.r.func3) {
+                case OP_MUL:   return exec_mul;
+                case OP_MULH:  return exec_mulh;
+                case OP_MULSU: return exec_mulhsu;
+                case OP_MULU:  return exec_mulhu;
+                case OP_DIV:   return exec_div;
+                case OP_DIVU:  return exec_divu;
+                case OP_REM:   return exec_rem;
+                case OP_REMU:  return exec_remu;
+            }
+            break;
+        #endif // RV32M_ENABLED
+        case FN_RV32I:
+            switch(inst.r.func3) {
+                case OP_ADD:  return exec_add;
+                case OP_SLL:  return exec_sll;
+                case OP_SLT:  return exec_slt;
+                case OP_SLTU: return exec_sltu;
+                case OP_XOR:  return exec_xor;
+                case OP_SR:   return exec_srl;
+                case OP_OR:   return exec_or;
+                case OP_AND:  return exec_and;
+            }
+            break;
+        case FN_ANDN:
+            switch(inst.r.func3) {
+                case OP_ADD:  return exec_sub;
+                case OP_SR:   return exec_sra;
+                #ifdef RV32B_ENABLED
+                case OP_AND:  return exec_andn;
+                case OP_OR:   return exec_orn;
+                case OP_XOR:  return exec_xnor;
+                #endif // RV32B_ENABLED
+            }
             break;
-    } while(1);
+        #ifdef RV32B_ENABLED
+        case FN_ZEXT:
+            return exec_zexth;
+        case FN_MINMAX:
+            switch(inst.r.func3) {
+                case OP_CLMUL:  return exec_clmul;
+                case OP_CLMULH: return exec_clmulh;
+                case OP_CLMULR: return exec_clmulr;
+                case OP_MAX:    return exec_max;
+                case OP_MAXU:   return exec_maxu;
+                case OP_MIN:    return exec_min;
+                case OP_MINU:   return exec_minu;
+            }
+            break;
+        case FN_SHADD:
+            switch(inst.r.func3) {
+                case OP_SH1ADD: return exec_sh1add;
+                case OP_SH2ADD: return exec_sh2add;
+                case OP_SH3ADD: return exec_sh3add;
+            }
+            break;
+        case FN_BSET:
+            return exec_bset;
+        case FN_BCLR:
+            switch(inst.r.func3) {
+                case OP_BCLR: return exec_bclr;
+                case OP_BEXT: return exec_bext;
+            }
+            break;
+        case FN_CLZ:
+            switch(inst.r.func3) {
+                case OP_ROL: return exec_rol;
+                case OP_ROR: return exec_ror;
+            }
+            break;
+        case FN_BINV:
+            return exec_binv;
+        #endif // RV32B_ENABLED
+    }
+    return exec_unknown;
+}
 
-main_exit:
-    aligned_free(rv->mem);
-    if (rv->ft) fclose(rv->ft);
+// the class of the decoded instruction, see srv32_get_cpi()
+static int decode_class(const rv_insn *ir) {
+    INST inst = ir->inst;
 
-    prog_exit(rv);
+    if (ir->handler == exec_unknown || ir->handler == exec_illegal ||
+        ir->handler == exec_branch_illegal)
+        return SRV32_CLASS_ILLEGAL;
+
+    switch(inst.r.op) {
+        case OP_JAL:    return SRV32_CLASS_JAL;
+        case OP_JALR:   return SRV32_CLASS_JALR;
+        case OP_BRANCH: return SRV32_CLASS_BRANCH;
+        case OP_LOAD:   return SRV32_CLASS_LOAD;
+        case OP_STORE:  return SRV32_CLASS_STORE;
+        case OP_FENCE:  return SRV32_CLASS_FENCE;
+        case OP_SYSTEM:
+            return inst.i.func3 == OP_ECALL ? SRV32_CLASS_SYSTEM : SRV32_CLASS_CSR;
+        case OP_ARITHI:
+            if ((inst.i.func3 == OP_SLL && inst.r.func7 != FN_RV32I) ||
+                (inst.i.func3 == OP_SR && inst.r.func7 != FN_SRL &&
+                 inst.r.func7 != FN_SRA))
+                return SRV32_CLASS_BITMANIP;
+            break;
+        case OP_ARITHR:
+            if (inst.r.func7 == FN_RV32M)
+                return inst.r.func3 >= OP_DIV ? SRV32_CLASS_DIV : SRV32_CLASS_MUL;
+            if (inst.r.func7 == FN_RV32I ||
+                (inst.r.func7 == FN_ANDN &&
+                 (inst.r.func3 == OP_ADD || inst.r.func3 == OP_SR)))
+                break;
+            return SRV32_CLASS_BITMANIP;
+    }
+    return SRV32_CLASS_ALU;
 }
 
-int srv32_step(struct rv *rv) {
+static void srv32_decode(struct rv *rv, rv_insn *ir, int32_t pc) {
+    INST inst;
     int compressed = 0;
+
 #ifdef RV32C_ENABLED
-    static int compressed_prev = 0;
+    INSTC instc;
+    int illegal = 0;
 #endif // RV32C_ENABLED
-    static int timer_irq = 0;
-    static int sw_irq = 0;
-    static int sw_irq_next = 0;
-    static int ext_irq = 0;
-    static int ext_irq_next = 0;
 
-    INST inst;
+    inst.inst = 0;
+    srv32_read_mem(rv, pc, sizeof(int32_t), (void*)&inst.inst);
+
+    // do not interrupt when system call and CSR R/W
+    ir->system = (inst.r.op == OP_SYSTEM) ? 1 : 0;
 
 #ifdef RV32C_ENABLED
-    INSTC instc;
-    int illegal;
+    instc.inst = 0;
+    srv32_read_mem(rv, pc, sizeof(int16_t), (void*)&instc.inst);
+    compressed = compressed_decoder(instc, &inst, &illegal);
+#endif // RV32C_ENABLED
 
-    illegal = 0;
+    // memory pages of the decoded instructions, see srv32_flush_icache()
+    if (pc >= rv->mem_base && pc < rv->mem_base + rv->mem_size) {
+        rv->code_map[(pc - rv->mem_base) >> CODE_PAGE_BITS] = 1;
+        rv->code_map[(pc + 3 - rv->mem_base) >> CODE_PAGE_BITS] = 1;
+    }
+
+    ir->pc         = pc;
+    ir->inst       = inst;
+    ir->imm        = 0;
+    ir->rd         = inst.r.rd;
+    ir->rs1        = inst.r.rs1;
+    ir->rs2        = inst.r.rs2;
+    ir->compressed = compressed;
+    ir->sync       = (inst.r.op == OP_SYSTEM) ? 1 : 0;
+    ir->memop      = (inst.r.op == OP_LOAD || inst.r.op == OP_STORE) ? 1 : 0;
+
+#ifdef RV32C_ENABLED
+    if (illegal) {
+        ir->inst.inst = 0;
+        ir->imm     = (int)instc.inst;
+        ir->handler = exec_cillegal;
+        ir->iclass  = SRV32_CLASS_ILLEGAL;
+        return;
+    }
 #endif // RV32C_ENABLED
 
+    switch(inst.r.op) {
+        case OP_AUIPC: // U-Type
+            ir->imm     = to_imm_u(inst.u.imm);
+            ir->handler = exec_auipc;
+            break;
+        case OP_LUI: // U-Type
+            ir->imm     = to_imm_u(inst.u.imm);
+            ir->handler = exec_lui;
+            break;
+        case OP_JAL: // J-Type
+            ir->imm     = to_imm_j(inst.j.imm);
+            ir->handler = exec_jal;
+            break;
+        case OP_JALR: // I-Type
+            ir->imm     = to_imm_i(inst.i.imm);
+            ir->handler = exec_jalr;
+            break;
+        case OP_BRANCH: // B-Type
+            ir->imm = to_imm_b(inst.b.imm2, inst.b.imm1);
+            switch(inst.b.func3) {
+                case OP_BEQ:  ir->handler = exec_beq;  break;
+                case OP_BNE:  ir->handler = exec_bne;  break;
+                case OP_BLT:  ir->handler = exec_blt;  break;
+                case OP_BGE:  ir->handler = exec_bge;  break;
+                case OP_BLTU: ir->handler = exec_bltu; break;
+                case OP_BGEU: ir->handler = exec_bgeu; break;
+                default:      ir->handler = exec_branch_illegal;
+            }
+            break;
+        case OP_LOAD: // I-Type
+            ir->imm     = to_imm_i(inst.i.imm);
+            ir->handler = exec_load;
+            break;
+        case OP_STORE: // S-Type
+            ir->imm     = to_imm_s(inst.s.imm2, inst.s.imm1);
+            ir->handler = exec_store;
+            break;
+        case OP_ARITHI: // I-Type
+            ir->imm     = to_imm_i(inst.i.imm);
+            ir->handler = decode_arithi(inst);
+            break;
+        case OP_ARITHR: // R-Type
+            ir->handler = decode_arithr(inst);
+            break;
+        case OP_FENCE:
+            ir->handler = exec_fence;
+            break;
+        case OP_SYSTEM: // I-Type
+            ir->handler = (inst.i.func3 == OP_ECALL && inst.i.imm == WFI_IMM) ?
+                          exec_wfi : exec_system;
+            break;
+        default:
+            ir->handler = exec_illegal;
+    }
+
+    ir->iclass = decode_class(ir);
+}
+
+// Empty the instruction cache and the basic blocks in O(1), see mem_map().
+// A zero entry has the tag of pc 0, which is only valid at the index of
+// pc 0, so that entry is the only one to invalidate. The running block is
+// cleared as well, so it is only called between the runs.
+static void srv32_clear_cache(struct rv *rv) {
+    mem_map(rv->icache, sizeof(rv_insn) * ICACHE_SIZE);
+    mem_map(rv->bcache, sizeof(rv_block) * BCACHE_SIZE);
+    mem_map(rv->code_map, CODE_MAP_SIZE(rv));
+    rv->icache[ICACHE_INDEX(0)].pc = ICACHE_INVALID;
+    rv->bcache[BCACHE_INDEX(0)].pc = ICACHE_INVALID;
+    rv->nblocks = 0;
+    #ifdef JIT_ENABLED
+    rv->jit_used = 0;
+    #endif // JIT_ENABLED
+}
+
+// invalidate the blocks, only the valid tags are written, so the pages of
+// the empty entries are not committed
+static void srv32_flush_blocks(struct rv *rv) {
+    int i;
+
+    // the running block may be modified
+    rv->block_break = 1;
+
+    if (rv->nblocks == 0)
+        return;
+
+    for(i = 0; i < BCACHE_SIZE; i++) {
+        int32_t pc = rv->bcache[i].pc;
+        if (pc != ICACHE_INVALID && BCACHE_INDEX(pc) == (uint32_t)i)
+            rv->bcache[i].pc = ICACHE_INVALID;
+    }
+    rv->nblocks = 0;
+}
+
+void srv32_flush_icache(struct rv *rv, int32_t addr, int32_t len) {
+    int32_t pc;
+
+    if (!rv->icache)
+        return;
+
+    // flush all for a large block, the decoded instructions are found by
+    // the code pages
+    if (len >= ICACHE_SIZE) {
+        int32_t page;
+
+        for(page = 0; page < CODE_MAP_SIZE(rv); page++) {
+            if (!rv->code_map[page])
+                continue;
+            for(pc = rv->mem_base + (page << CODE_PAGE_BITS);
+                pc < rv->mem_base + ((page + 1) << CODE_PAGE_BITS); pc += 2) {
+                rv_insn *ir = &rv->icache[ICACHE_INDEX(pc)];
+                if (ir->pc == pc)
+                    ir->pc = ICACHE_INVALID;
+            }
+        }
+        mem_map(rv->code_map, CODE_MAP_SIZE(rv));
+        srv32_flush_blocks(rv);
+        return;
+    }
+
+    // nothing to do if no instruction is decoded in the pages of
+    // [addr, addr+len)
+    if (len > 0 && addr >= rv->mem_base && addr < rv->mem_base + rv->mem_size) {
+        int32_t first = (addr - rv->mem_base) >> CODE_PAGE_BITS;
+        int32_t last  = (addr + len - 1 - rv->mem_base) >> CODE_PAGE_BITS;
+        int32_t page;
+
+        if (last > (rv->mem_size >> CODE_PAGE_BITS))
+            last = rv->mem_size >> CODE_PAGE_BITS;
+
+        for(page = first; page <= last; page++)
+            if (rv->code_map[page])
+                break;
+
+        if (page > last)
+            return;
+
+        srv32_flush_blocks(rv);
+    }
+
+    // any 32-bit instruction fetch overlapping [addr, addr+len)
+    for(pc = (addr - 2) & ~1; pc < addr + len; pc += 2) {
+        rv_insn *ir = &rv->icache[ICACHE_INDEX(pc)];
+        if (ir->pc == pc)
+            ir->pc = ICACHE_INVALID;
+    }
+}
+
+// wait states of the instruction fetch, -1 if pc is not in a region
+static inline int srv32_fetch_latency(struct rv *rv, int32_t pc) {
+    const platform_region *r;
+
+    if (rv->flat)
+        return 0;
+
+    r = platform_find(&rv->platform, pc, 2);
+
+    return r ? r->latency : -1;
+}
+
+static inline const rv_insn *srv32_fetch(struct rv *rv, int32_t pc) {
+    rv_insn *ir = &rv->icache[ICACHE_INDEX(pc)];
+
+    if (ir->pc != pc)
+        srv32_decode(rv, ir, pc);
+
+    return ir;
+}
+
+int srv32_step(struct rv *rv) {
+    int compressed = 0;
+    int latency;
+    int result;
+    const rv_insn *ir;
+    // no interrupt can be taken before the deadline, see srv32_irq_schedule()
+    bool irq_check = (rv->csr.mtime.c >= rv->irq_deadline);
+
+    if (rv->rev)
+        srv32_reverse_record(rv);
+
     rv->mtime_update = 0;
 
     // keep x0 always zero
     srv32_write_regs(rv, 0, 0);
 
-    if (timer_irq && (rv->csr.mstatus & (1 << MIE))) {
-        srv32_int(rv, INT_MTIME, MTIP, compressed);
-    }
+    if (irq_check) {
+        if (rv->timer_irq && (rv->csr.mstatus & (1 << MIE))) {
+            srv32_int(rv, INT_MTIME, MTIP, compressed);
+        }
 
-    // software interrupt
-    if (sw_irq_next && (rv->csr.mstatus & (1 << MIE))) {
-        srv32_int(rv, INT_MSI, MSIP, compressed);
-    }
+        // software interrupt
+        if (rv->sw_irq_next && (rv->csr.mstatus & (1 << MIE))) {
+            srv32_int(rv, INT_MSI, MSIP, compressed);
+        }
 
-    // external interrupt
-    if (ext_irq_next && (rv->csr.mstatus & (1 << MIE))) {
-        srv32_int(rv, INT_MEI, MEIP, compressed);
+        // external interrupt
+        if (rv->ext_irq_next && (rv->csr.mstatus & (1 << MIE))) {
+            srv32_int(rv, INT_MEI, MEIP, compressed);
+        }
     }
 
-    if (rv->pc >= rv->mem_base + rv->mem_size || rv->pc < rv->mem_base) {
+    if (rv->pc >= rv->mem_base + rv->mem_size || rv->pc < rv->mem_base ||
+        srv32_fetch_latency(rv, rv->pc) < 0) {
         printf("PC 0x%08x out of range\n", rv->pc);
         srv32_trap(rv, TRAP_INST_FAIL, rv->pc);
     }
@@ -873,966 +1877,1070 @@ int srv32_step(struct rv *rv) {
     }
 #endif // RV32C_ENABLED
 
-    srv32_read_mem(rv, rv->pc, sizeof(int32_t), (void*)&inst.inst);
+    ir = srv32_fetch(rv, rv->pc);
 
-#ifdef RV32C_ENABLED
-    srv32_read_mem(rv, rv->pc, sizeof(int16_t), (void*)&instc.inst);
-#endif // RV32C_ENABLED
+    if (irq_check) {
+        if ((rv->csr.mtime.c >= rv->csr.mtimecmp.c) &&
+            (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MTIE)) &&
+            !ir->system) { // do not interrupt when system call and CSR R/W
+            rv->timer_irq = 1;
+        } else {
+            rv->timer_irq = 0;
+        }
 
-    if ((rv->csr.mtime.c >= rv->csr.mtimecmp.c) &&
-        (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MTIE)) &&
-        (inst.r.op != OP_SYSTEM)) { // do not interrupt when system call and CSR R/W
-        timer_irq = 1;
-    } else {
-        timer_irq = 0;
-    }
+        if (rv->sw_irq &&
+            (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MSIE)) &&
+            !ir->system) { // do not interrupt when system call and CSR R/W
+            rv->sw_irq_next = 1;
+        } else {
+            rv->sw_irq_next = 0;
+        }
 
-    if (sw_irq &&
-        (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MSIE)) &&
-        (inst.r.op != OP_SYSTEM)) { // do not interrupt when system call and CSR R/W
-        sw_irq_next = 1;
-    } else {
-        sw_irq_next = 0;
+        if (rv->ext_irq &&
+            (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MEIE)) &&
+            !ir->system) { // do not interrupt when system call and CSR R/W
+            rv->ext_irq_next = 1;
+        } else {
+            rv->ext_irq_next = 0;
+        }
     }
-    sw_irq = (rv->csr.msip & (1<<0)) ? 1 : 0;
+    rv->sw_irq  = (rv->csr.msip & (1<<0)) ? 1 : 0;
+    rv->ext_irq = (rv->csr.msip & (1<<16)) ? 1 : 0;
 
-    if (ext_irq &&
-        (rv->csr.mstatus & (1 << MIE)) && (rv->csr.mie & (1 << MEIE)) &&
-        (inst.r.op != OP_SYSTEM)) { // do not interrupt when system call and CSR R/W
-        ext_irq_next = 1;
-    } else {
-        ext_irq_next = 0;
-    }
-    ext_irq = (rv->csr.msip & (1<<16)) ? 1 : 0;
+    if (irq_check)
+        srv32_irq_schedule(rv);
 
     rv->csr.time.c++;
     rv->csr.instret.c++;
     srv32_cycle_add(rv, 1);
 
+    // the wait states of the fetch
+    if ((latency = srv32_fetch_latency(rv, rv->pc)) > 0) {
+        rv->cpi.events[SRV32_STALL_FETCH]++;
+        rv->cpi.cycles[SRV32_STALL_FETCH] += latency;
+        srv32_cycle_add(rv, latency);
+    }
+
+    if (rv->count_class)
+        srv32_count_class(rv, ir);
+
     rv->prev_pc = rv->pc;
 
 #ifdef RV32C_ENABLED
-    compressed = compressed_decoder(instc, &inst, &illegal);
+    compressed = ir->compressed;
 
     // one more cycle when the instruction type changes
-    if (compressed_prev != compressed) {
+    if (rv->compressed_prev != compressed) {
         srv32_cycle_add(rv, 1);
-        overhead++;
+        rv->overhead++;
+        rv->cpi.events[SRV32_STALL_COMPRESSED]++;
     }
 
-    compressed_prev = compressed;
+    rv->compressed_prev = compressed;
+#endif // RV32C_ENABLED
 
-    if (compressed && 0)
-        TRACE_LOG "           Translate 0x%04x => 0x%08x\n", (uint16_t)instc.inst, inst.inst
-        TRACE_END;
+    result = ir->handler(rv, ir);
 
-    if (illegal) {
-        srv32_trap(rv, TRAP_INST_ILL, (int)instc.inst);
-        return RV_TRAP;
+    srv32_callgraph_check(rv, ir);
+
+    if (rv->prof) {
+        if (!rv->prof->period)
+            srv32_profile_count(rv, rv->prev_pc);
+        else if (rv->csr.cycle.c >= rv->prof->next)
+            srv32_profile_sample(rv, NULL, 0);
     }
+
+    return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Basic blocks
+//
+// A basic block runs the instructions up to a jalr, a branch back to its
+// start or a system instruction other than a CSR read. It goes on at the
+// target of a jal, and at the next instruction of the other branches, which
+// leave the block when taken. The cycles of the instructions are accumulated
+// when the block is built, and they are committed to the counters only
+// before a system instruction, when a load or store accesses a device or
+// hits a watchpoint (see srv32_sync()), or when the block is left. Interrupts are checked at the block boundaries against the
+// deadline of srv32_irq_schedule(), the instructions are executed by
+// srv32_step() when any interrupt may be taken inside of the block, so the
+// cycles are the same as executed one by one.
+
+// The jal to an aligned target in the memory, other than the start of the
+// block, is executed in the block, so the short functions and the loops of
+// RTOS code, e.g. the idle task, take fewer blocks.
+static inline bool srv32_follow_jal(struct rv *rv, const rv_block *blk,
+                                    const rv_insn *ir) {
+    int32_t target = ir->pc + ir->imm;
+
+    if (ir->inst.r.op != OP_JAL || ir->imm == 0 || rv->graph ||
+        target == blk->pc || !IN_MEM(rv, target, 4))
+        return false;
+
+#ifdef RV32C_ENABLED
+    return (target & 1) == 0;
+#else
+    return (target & 3) == 0;
 #endif // RV32C_ENABLED
+}
 
-    switch(inst.r.op) {
-        case OP_AUIPC: { // U-Type
-            srv32_write_regs(rv, inst.u.rd, rv->pc + to_imm_u(inst.u.imm));
-            TIME_LOG; TRACE_LOG "%08x %08x x%02u (%s) <= 0x%08x\n", rv->pc, inst.inst,
-                       inst.u.rd, regname[inst.u.rd], srv32_read_regs(rv, inst.u.rd)
-            TRACE_END;
-            break;
-        }
-        case OP_LUI: { // U-Type
-            srv32_write_regs(rv, inst.u.rd, to_imm_u(inst.u.imm));
-            TIME_LOG; TRACE_LOG "%08x %08x x%02u (%s) <= 0x%08x\n", rv->pc, inst.inst,
-                      inst.u.rd, regname[inst.u.rd], srv32_read_regs(rv, inst.u.rd)
-            TRACE_END;
-            break;
-        }
-        case OP_JAL: { // J-Type
-            int pc_old = rv->pc;
-            int pc_off = to_imm_j(inst.j.imm);
+// The CSR reads, e.g. rdcycle in a polling loop, change neither the PC nor
+// the interrupts, so they do not end the block. An illegal CSR traps out of
+// the block as a load does.
+static inline bool srv32_csr_read(const rv_insn *ir) {
+    switch(ir->inst.i.func3) {
+        case OP_CSRRS:
+        case OP_CSRRC:
+        case OP_CSRRSI:
+        case OP_CSRRCI:
+            return ir->inst.i.rs1 == 0;
+        default:
+            return false;
+    }
+}
 
-            TIME_LOG; TRACE_LOG "%08x %08x", rv->pc, inst.inst
-            TRACE_END;
+static void srv32_build_block(struct rv *rv, rv_block *blk, int32_t pc) {
+    int n = 0;
+    int cycles = 0;
+    int stalls = 0;
+    int fetches = 0;
+    int latency;
+#ifdef RV32C_ENABLED
+    int ovh = 0;
+#endif // RV32C_ENABLED
 
-            rv->pc += pc_off;
+    rv->nblocks++;
 
-            // LCOV_EXCL_START
-            if (pc_off == 0) {
-                printf("Warning: forever loop detected at PC 0x%08x\n", rv->pc);
-                rv->exitcode = 1;
-                return RV_EXIT;
-            }
-            // LCOV_EXCL_STOP
+    blk->pc      = pc;
+    blk->next[0] = NULL;
+    blk->next[1] = NULL;
+    blk->spin    = 0;
+#ifdef JIT_ENABLED
+    blk->code    = NULL;
+    blk->hits    = 0;
+#endif // JIT_ENABLED
 
-            rv->pc = rv->pc & ~1; // setting the least-signicant bit of the result to zero
+    do {
+        const rv_insn *ir = srv32_fetch(rv, pc);
 
-            #ifndef RV32C_ENABLED
-            if ((rv->pc & 3) != 0) {
-                // Instruction address misaligned
-                TRACE_LOG "\n" TRACE_END;
-                return RV_OKAY;
-            }
-            #endif // RV32C_ENABLED
+#ifdef RV32C_ENABLED
+        // one more cycle when the instruction type changes
+        if (n > 0 && blk->insn[n-1].compressed != ir->compressed) {
+            cycles++;
+            ovh++;
+        }
+        blk->overhead[n] = ovh;
+#endif // RV32C_ENABLED
 
-            srv32_write_regs(rv, inst.j.rd, compressed ? pc_old + 2 : pc_old + 4);
-            TRACE_LOG " x%02u (%s) <= 0x%08x\n",
-                      inst.j.rd, regname[inst.j.rd], srv32_read_regs(rv, inst.j.rd)
-            TRACE_END;
+        // worst-case cycles before the last instruction, the type of
+        // the first instruction may change, and single RAM stalls
+        if (n > 0) blk->max_cycles = cycles + 1 + stalls;
+        if (rv->singleram && (ir->sync || ir->memop)) stalls++;
+        if (ir->sync || ir->memop) stalls += rv->max_latency;
 
-            srv32_cycle_add(rv, rv->branch_penalty);
-            return RV_OKAY;
+        // the wait states of the fetch
+        if ((latency = srv32_fetch_latency(rv, pc)) > 0) {
+            cycles += latency;
+            fetches++;
         }
-        case OP_JALR: { // I-Type
-            int pc_old = rv->pc;
-            int pc_new = srv32_read_regs(rv, inst.i.rs1) + to_imm_i(inst.i.imm);
 
-            TIME_LOG; TRACE_LOG "%08x %08x", rv->pc, inst.inst
-            TRACE_END;
+        blk->insn[n]  = *ir;
+        blk->cycles[n] = ++cycles;
+        blk->fetches[n] = fetches;
 
-            rv->pc = pc_new;
+        pc += ir->compressed ? 2 : 4;
+        n++;
 
-            // LCOV_EXCL_START
-            if (pc_new == pc_old) {
-                TRACE_LOG "\n" TRACE_END;
-                printf("Warning: forever loop detected at PC 0x%08x\n", rv->pc);
-                rv->exitcode = 1;
-                return RV_EXIT;
-            }
-            // LCOV_EXCL_STOP
+        // the block goes on at the target of a jump, or of a call without
+        // the call graph, see srv32_callgraph_check()
+        if (srv32_follow_jal(rv, blk, ir)) {
+            pc = ir->pc + ir->imm;
+            stalls += rv->branch_penalty;
+            continue;
+        }
 
-            rv->pc = rv->pc & ~1; // setting the least-signicant bit of the result to zero
+        // a taken branch leaves the block, except the branch back to the
+        // start of the block, which may be a spin loop
+        if (ir->inst.r.op == OP_BRANCH && ir->pc + ir->imm != blk->pc &&
+            ir->handler != exec_branch_illegal) {
+            stalls += rv->branch_penalty;
+            continue;
+        }
 
-            #ifndef RV32C_ENABLED
-            if ((rv->pc & 3) != 0) {
-                // Instruction address misaligned
-                TRACE_LOG "\n" TRACE_END;
-                return RV_OKAY;
-            }
-            #endif // RV32C_ENABLED
+        if (ir->inst.r.op == OP_JAL || ir->inst.r.op == OP_JALR ||
+            ir->inst.r.op == OP_BRANCH ||
+            (ir->inst.r.op == OP_SYSTEM && !srv32_csr_read(ir)))
+            break;
+    } while(n < BLOCK_MAX && pc + 4 <= rv->mem_base + rv->mem_size &&
+            srv32_fetch_latency(rv, pc) >= 0 && !(rv->bp_map && BP_TEST(rv, pc)));
 
-            srv32_write_regs(rv, inst.i.rd, compressed ? pc_old + 2 : pc_old + 4);
-            TRACE_LOG " x%02u (%s) <= 0x%08x\n",
-                      inst.i.rd, regname[inst.i.rd], srv32_read_regs(rv, inst.i.rd)
-            TRACE_END;
+    if (n == 1) blk->max_cycles = 0;
 
-            srv32_cycle_add(rv, rv->branch_penalty);
-            return RV_OKAY;
-        }
-        case OP_BRANCH: { // B-Type
-            TIME_LOG; TRACE_LOG "%08x %08x\n", rv->pc, inst.inst
-            TRACE_END;
-            int offset = to_imm_b(inst.b.imm2, inst.b.imm1);
-            switch(inst.b.func3) {
-                case OP_BEQ:
-                    if (srv32_read_regs(rv, inst.b.rs1) == srv32_read_regs(rv, inst.b.rs2)) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                case OP_BNE:
-                    if (srv32_read_regs(rv, inst.b.rs1) != srv32_read_regs(rv, inst.b.rs2)) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                case OP_BLT:
-                    if (srv32_read_regs(rv, inst.b.rs1) < srv32_read_regs(rv, inst.b.rs2)) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                case OP_BGE:
-                    if (srv32_read_regs(rv, inst.b.rs1) >= srv32_read_regs(rv, inst.b.rs2)) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                case OP_BLTU:
-                    if (((uint32_t)srv32_read_regs(rv, inst.b.rs1)) <
-                        ((uint32_t)srv32_read_regs(rv, inst.b.rs2))) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                case OP_BGEU:
-                    if (((uint32_t)srv32_read_regs(rv, inst.b.rs1)) >=
-                        ((uint32_t)srv32_read_regs(rv, inst.b.rs2))) {
-                        rv->pc += offset;
-                        if ((!rv->branch_predict || offset > 0) && (rv->pc & 3) == 0)
-                            srv32_cycle_add(rv, rv->branch_penalty);
-                        return RV_OKAY;
-                    }
-                    break;
-                default:
-                    printf("Illegal branch instruction at PC 0x%08x\n", rv->pc);
-                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                    return RV_TRAP;
-            }
-            break;
-        }
-        case OP_LOAD: { // I-Type
-            int32_t data;
-            int32_t address = srv32_read_regs(rv, inst.i.rs1) + to_imm_i(inst.i.imm);
-
-            TIME_LOG; TRACE_LOG "%08x %08x", rv->pc, inst.inst
-            TRACE_END;
-
-            int result = memrw(rv, OP_LOAD, inst.i.func3, address, &data);
-
-            if (rv->singleram) srv32_cycle_add(rv, 1);
-
-            switch(result) {
-                case TRAP_LD_FAIL:
-                     TRACE_LOG "\n" TRACE_END;
-                     srv32_trap(rv, TRAP_LD_FAIL, address);
-                     return RV_TRAP;
-                case TRAP_LD_ALIGN:
-                     TRACE_LOG "\n" TRACE_END;
-                     srv32_trap(rv, TRAP_LD_ALIGN, address);
-                     return RV_TRAP;
-                case TRAP_INST_ILL:
-                     TRACE_LOG " read 0x%08x, x%02u (%s) <= 0x%08x\n",
-                                 address, inst.i.rd,
-                                 regname[inst.i.rd], 0
-                     TRACE_END;
-                     srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                     return RV_TRAP;
-            }
+    blk->n   = n;
+    blk->end = pc;
+}
 
-            srv32_write_regs(rv, inst.i.rd, data);
-            TRACE_LOG " read 0x%08x, x%02u (%s) <= 0x%08x\n",
-                      address, inst.i.rd,
-                      regname[inst.i.rd], srv32_read_regs(rv, inst.i.rd)
-            TRACE_END;
-            break;
+// commit the counters of the instructions (ex->done, upto] of the block
+void srv32_commit(struct rv *rv, rv_exec *ex, int upto) {
+    const rv_block *blk = ex->blk;
+    int n = upto - ex->done;
+    int cycles = blk->cycles[upto] + ex->entry;
+#ifdef RV32C_ENABLED
+    int ovh = blk->overhead[upto] + ex->entry;
+#endif // RV32C_ENABLED
+
+    if (ex->done >= 0) {
+        cycles -= blk->cycles[ex->done] + ex->entry;
+#ifdef RV32C_ENABLED
+        ovh -= blk->overhead[ex->done] + ex->entry;
+#endif // RV32C_ENABLED
+    }
+
+    rv->csr.time.c += n;
+    rv->csr.instret.c += n;
+    srv32_cycle_add(rv, cycles);
+
+    // the static cycles more than one are the fetch wait states and the
+    // instruction type changes
+#ifdef RV32C_ENABLED
+    rv->overhead += ovh;
+    rv->compressed_prev = blk->insn[upto].compressed;
+    rv->cpi.events[SRV32_STALL_COMPRESSED] += ovh;
+    cycles -= ovh;
+#endif // RV32C_ENABLED
+    rv->cpi.events[SRV32_STALL_FETCH] += blk->fetches[upto] -
+                                         (ex->done >= 0 ? blk->fetches[ex->done] : 0);
+    rv->cpi.cycles[SRV32_STALL_FETCH] += cycles - n;
+
+    if (rv->count_class) {
+        int i;
+        for(i = ex->done + 1; i <= upto; i++)
+            srv32_count_class(rv, &blk->insn[i]);
+    }
+
+    ex->done = upto;
+}
+
+// Commit the counters up to the running instruction of the interpreter
+// before they are read by a device or a watchpoint. The JIT code commits
+// before its calls of the handlers, so rv->ex is not set for it.
+void srv32_sync(struct rv *rv) {
+    rv_exec *ex = rv->ex;
+
+    if (ex && ex->done < ex->count) {
+        srv32_commit(rv, ex, ex->count);
+        rv->log_cycles = 0;
+    }
+}
+
+// check if no interrupt can be taken inside of the block
+static inline bool srv32_block_ready(struct rv *rv, const rv_block *blk) {
+    return rv->csr.mtime.c + blk->max_cycles < rv->irq_deadline;
+}
+
+static inline int srv32_exec_block(struct rv *rv, rv_block *blk) {
+    rv_exec ex;
+    int result = RV_OKAY;
+    int32_t msip = rv->csr.msip;
+    // the exact profile needs the cycles of each instruction
+    bool exact = rv->prof && !rv->prof->period;
+
+    ex.blk   = blk;
+    ex.entry = 0;
+    ex.done  = -1;
+    ex.count = 0;
+
+#ifdef RV32C_ENABLED
+    ex.entry = (rv->compressed_prev != blk->insn[0].compressed) ? 1 : 0;
+#endif // RV32C_ENABLED
+
+    rv->block_break  = 0;
+    rv->mtime_update = 0;
+
+#ifdef JIT_ENABLED
+    // compile the hot block, the trace log is written by the interpreter
+    if (rv->jit && !rv->log && !exact) {
+        if (!blk->code && ++blk->hits >= JIT_THRESHOLD)
+            blk->code = srv32_jit_compile(rv, blk);
+        if (blk->code) {
+            result = blk->code(rv, &ex);
+            goto block_exit;
         }
-        case OP_STORE: { // S-Type
-            int address = srv32_read_regs(rv, inst.s.rs1) +
-                          to_imm_s(inst.s.imm2, inst.s.imm1);
-            int data = srv32_read_regs(rv, inst.s.rs2);
-
-            int mask = (inst.i.func3 == OP_SB) ? 0xff :
-                       (inst.i.func3 == OP_SH) ? 0xffff :
-                       (inst.i.func3 == OP_SW) ? 0xffffffff :
-                       0xffffffff;
-
-            TIME_LOG; TRACE_LOG "%08x %08x", rv->pc, inst.inst
-            TRACE_END;
-
-            int result = memrw(rv, OP_STORE, inst.i.func3, address, &data);
-
-            if (rv->singleram) srv32_cycle_add(rv, 1);
-
-            switch(result) {
-                case TRAP_ST_FAIL:
-                     TRACE_LOG "\n" TRACE_END;
-                     srv32_trap(rv, TRAP_ST_FAIL, address);
-                     return RV_TRAP;
-                case TRAP_ST_ALIGN:
-                     TRACE_LOG "\n" TRACE_END;
-                     srv32_trap(rv, TRAP_ST_ALIGN, address);
-                     return RV_TRAP;
-                case TRAP_INST_ILL:
-                     TRACE_LOG "\n" TRACE_END;
-                     srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                     return RV_TRAP;
-            }
+    }
+#endif // JIT_ENABLED
+
+    rv->ex = &ex;
+    while(ex.count < blk->n) {
+        const rv_insn *ir = &blk->insn[ex.count];
+
+        if (ir->sync || exact)
+            srv32_commit(rv, &ex, ex.count);
 
-            TRACE_LOG " write 0x%08x <= 0x%08x\n", address, (data & mask)
-            TRACE_END;
+        // the trace log has the cycles up to the instruction, they are
+        // committed at the next sync instruction or the end of the block
+        if (rv->log)
+            rv->log_cycles = blk->cycles[ex.count] -
+                             (ex.done >= 0 ? blk->cycles[ex.done] : -ex.entry);
 
+        // keep x0 always zero
+        rv->regs[0] = 0;
+        rv->prev_pc = rv->pc;
+
+        result = ir->handler(rv, ir);
+        rv->mtime_update = 0;
+        ex.count++;
+
+        if (rv->prof && !rv->prof->period)
+            srv32_profile_count(rv, rv->prev_pc);
+
+        // trap, exit, or the interrupt sources and the code are changed
+        if (result != RV_OKAY || rv->block_break)
             break;
+    }
+    rv->ex = NULL;
+
+#ifdef JIT_ENABLED
+block_exit:
+#endif // JIT_ENABLED
+    rv->log_cycles = 0;
+    if (ex.done < ex.count - 1)
+        srv32_commit(rv, &ex, ex.count - 1);
+
+    srv32_callgraph_check(rv, &blk->insn[ex.count - 1]);
+
+    // no interrupt is pending, see srv32_block_ready()
+    rv->timer_irq    = 0;
+    rv->sw_irq_next  = 0;
+    rv->ext_irq_next = 0;
+    rv->sw_irq       = (msip & (1<<0)) ? 1 : 0;
+    rv->ext_irq      = (msip & (1<<16)) ? 1 : 0;
+    srv32_irq_schedule(rv);
+
+    return result;
+}
+
+// Spin loops
+//
+// A block branching back to itself without stores and system instructions,
+// whose only changing input is mtime, is a polling loop. Each iteration
+// takes the same cycles and adds the same step to the registers loaded from
+// mtime, so the iterations before the branch falls through, or an interrupt
+// may be taken, are skipped by updating the counters and the registers at
+// once. The values are tracked by the classes below.
+enum {
+    SPIN_UNK,               // the same in each iteration, but not known
+    SPIN_KNOWN,             // the same in each iteration, with the value
+    SPIN_MTIME              // mtime plus an offset
+};
+
+typedef struct spin_val {
+    int     cls;
+    int32_t val;
+} spin_val;
+
+// the iterations that can be skipped, -1 if the block can not be a spin loop
+static long long srv32_spin_count(struct rv *rv, const rv_block *blk,
+                                  long long step, uint32_t *mtime_regs) {
+    spin_val v[32];
+    uint32_t wr = 0;
+    uint32_t live = 0;
+    long long count = LLONG_MAX;
+    long long left;
+    int i;
+
+    // the registers written by the block
+    for(i = 0; i < blk->n; i++) {
+        int op = blk->insn[i].inst.r.op;
+        if (op != OP_BRANCH && op != OP_STORE && op != OP_FENCE)
+            wr |= 1 << blk->insn[i].rd;
+    }
+
+    #define SPIN_GET(x, r) \
+        if ((r) == 0) { \
+            (x).cls = SPIN_KNOWN; (x).val = 0; \
+        } else if (live & (1 << (r))) { \
+            (x) = v[r]; \
+        } else if (wr & (1 << (r))) { \
+            return -1; /* carried from the last iteration */ \
+        } else { \
+            (x).cls = SPIN_KNOWN; (x).val = rv->regs[r]; \
         }
-        case OP_ARITHI: { // I-Type
-            switch(inst.i.func3) {
-                case OP_ADD:
-                    srv32_write_regs(rv, inst.i.rd,
-                            srv32_read_regs(rv, inst.i.rs1) + to_imm_i(inst.i.imm));
-                    break;
-                case OP_SLT:
-                    srv32_write_regs(rv, inst.i.rd,
-                            srv32_read_regs(rv, inst.i.rs1) < to_imm_i(inst.i.imm) ? 1 : 0);
-                    break;
-                case OP_SLTU:
-                    //FIXME: to pass compliance test, the IMM should be singed
-                    //extension, and compare with unsigned.
-                    //srv32_write_regs(rv, inst.i.rd,
-                    //      ((uint32_t)srv32_read_regs(rv, inst.i.rs1)) <
-                    //      ((uint32_t)to_imm_iu(inst.i.imm)) ? 1 : 0);
-                    srv32_write_regs(rv, inst.i.rd,
-                            ((uint32_t)srv32_read_regs(rv, inst.i.rs1)) <
-                            ((uint32_t)to_imm_i(inst.i.imm)) ? 1 : 0);
-                    break;
-                case OP_XOR:
-                    srv32_write_regs(rv, inst.i.rd,
-                            srv32_read_regs(rv, inst.i.rs1) ^ to_imm_i(inst.i.imm));
-                    break;
-                case OP_OR:
-                    srv32_write_regs(rv, inst.i.rd,
-                            srv32_read_regs(rv, inst.i.rs1) | to_imm_i(inst.i.imm));
-                    break;
-                case OP_AND:
-                    srv32_write_regs(rv, inst.i.rd,
-                            srv32_read_regs(rv, inst.i.rs1) & to_imm_i(inst.i.imm));
-                    break;
-                case OP_SLL:
-                    switch (inst.r.func7) {
-                        case FN_RV32I:
-                            srv32_write_regs(rv, inst.i.rd,
-                                srv32_read_regs(rv, inst.i.rs1) << (inst.i.imm&0x1f));
-                            break;
-                        #ifdef RV32B_ENABLED
-                        case FN_BSET:
-                            srv32_write_regs(rv, inst.i.rd,
-                                srv32_read_regs(rv, inst.i.rs1) | (1 << (inst.i.imm&0x1f)));
-                            break;
-                        case FN_BCLR:
-                            srv32_write_regs(rv, inst.i.rd,
-                                srv32_read_regs(rv, inst.i.rs1) & ~(1 << (inst.i.imm&0x1f)));
-                            break;
-                        case FN_CLZ:
-                            switch (inst.r.rs2) {
-                                case 0: // CLZ
-                                    {
-                                        int32_t r = 0;
-                                        int32_t x = srv32_read_regs(rv, inst.i.rs1);
-                                        if (!x) {
-                                            r = 32;
-                                        } else {
-                                            if (!(x & 0xffff0000)) { x <<= 16; r += 16; }
-                                            if (!(x & 0xff000000)) { x <<=  8; r +=  8; }
-                                            if (!(x & 0xf0000000)) { x <<=  4; r +=  4; }
-                                            if (!(x & 0xc0000000)) { x <<=  2; r +=  2; }
-                                            if (!(x & 0x80000000)) {           r +=  1; }
-                                        }
-                                        srv32_write_regs(rv, inst.i.rd, r);
-                                    }
-                                    break;
-                                case 2: // CPOP
-                                    {
-                                        uint32_t c = 0;
-                                        int32_t n = srv32_read_regs(rv, inst.i.rs1);
-                                        while (n) {
-                                            n &= (n - 1);
-                                            c++;
-                                        }
-                                        srv32_write_regs(rv, inst.i.rd, c);
-                                    }
-                                    break;
-                                case 1: // CTZ
-                                    {
-                                        int32_t x = srv32_read_regs(rv, inst.i.rs1);
-                                        static const uint8_t table[32] = {
-                                          0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
-                                          31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
-                                        };
-                                        int32_t n = (!x) ? 32 :
-                                            (int32_t)table[((uint32_t)((x & -x) * 0x077CB531U)) >> 27];
-                                        srv32_write_regs(rv, inst.i.rd, n);
-                                    }
-                                    break;
-                                case 4: // SEXT.B
-                                    {
-                                        uint32_t n = srv32_read_regs(rv, inst.i.rs1) & 0xff;
-                                        if (n&0x80)
-                                            n |= 0xffffff00;
-                                        srv32_write_regs(rv, inst.i.rd, n);
-                                    }
-                                    break;
-                                case 5: // SEXT.H
-                                    {
-                                        uint32_t n = srv32_read_regs(rv, inst.i.rs1) & 0xffff;
-                                        if (n&0x8000)
-                                            n |= 0xffff0000;
-                                        srv32_write_regs(rv, inst.i.rd, n);
-                                    }
-                                    break;
-                                default:
-                                    printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                                    return RV_TRAP;
-                            }
-                            break;
-                        case FN_BINV:
-                            srv32_write_regs(rv, inst.i.rd,
-                                srv32_read_regs(rv, inst.i.rs1) ^ (1 << (inst.i.imm&0x1f)));
-                            break;
-                        #endif // RV32B_ENABLED
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
-                case OP_SR:
-                    switch (inst.r.func7) {
-                        case FN_SRL: // SRLI
-                            srv32_write_regs(rv, inst.i.rd,
-                                ((uint32_t)srv32_read_regs(rv, inst.i.rs1)) >> (inst.i.imm&0x1f));
-                            break;
-                        case FN_SRA: // SRAI
-                            srv32_write_regs(rv, inst.i.rd,
-                                srv32_read_regs(rv, inst.i.rs1) >> (inst.i.imm&0x1f));
-                            break;
-                        #ifdef RV32B_ENABLED
-                        case FN_BSET:
-                            if (inst.r.rs2 == 7) { // ORC.B
-                                int32_t n = 0;
-                                int32_t v = srv32_read_regs(rv, inst.i.rs1);
-                                if (v & 0x000000ff) n |= 0x000000ff;
-                                if (v & 0x0000ff00) n |= 0x0000ff00;
-                                if (v & 0x00ff0000) n |= 0x00ff0000;
-                                if (v & 0xff000000) n |= 0xff000000;
-                                srv32_write_regs(rv, inst.i.rd, n);
-                            } else {
-                                printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                                srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                                return RV_TRAP;
-                            }
-                            break;
-                        case FN_BCLR: // BCLRI
-                            srv32_write_regs(rv, inst.i.rd,
-                                (srv32_read_regs(rv, inst.i.rs1) >> (inst.i.imm&0x1f)) & 1);
-                            break;
-                        case FN_CLZ: // RORI
-                            {
-                                uint32_t n = srv32_read_regs(rv, inst.i.rs1);
-                                srv32_write_regs(rv, inst.i.rd, (n >> (inst.i.imm&0x1f)) |
-                                                  (n << (32 - (inst.i.imm&0x1f))));
-                            }
-                            break;
-                        case FN_REV:
-                            switch(inst.i.imm&0x1f) {
-                                case 0x18: // REV.8
-                                    {
-                                        uint32_t n = srv32_read_regs(rv, inst.i.rs1);
-                                        srv32_write_regs(rv, inst.i.rd,
-                                               ((n >> 24) & 0x000000ff) |
-                                               ((n >>  8) & 0x0000ff00) |
-                                               ((n <<  8) & 0x00ff0000) |
-                                               ((n << 24) & 0xff000000));
-                                    }
-                                    break;
-                                default:
-                                    printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                                    return RV_TRAP;
-                            }
-                            break;
-                        #endif // RV32B_ENABLED
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
-                default:
-                    printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                    return RV_TRAP;
+
+    for(i = 0; i < blk->n; i++) {
+        const rv_insn *ir = &blk->insn[i];
+        spin_val a, b, d;
+
+        switch(ir->inst.r.op) {
+            case OP_LUI:
+                d.cls = SPIN_KNOWN;
+                d.val = ir->imm;
+                break;
+            case OP_AUIPC:
+                d.cls = SPIN_KNOWN;
+                d.val = ir->pc + ir->imm;
+                break;
+            case OP_JAL:
+                if (ir->pc + ir->imm != blk->pc)
+                    return -1;
+                d.cls = SPIN_KNOWN;
+                d.val = ir->pc + (ir->compressed ? 2 : 4);
+                break;
+            case OP_LOAD: {
+                int32_t address;
+                SPIN_GET(a, ir->rs1);
+                if (a.cls != SPIN_KNOWN)
+                    return -1;
+                address = a.val + ir->imm;
+                d.cls = SPIN_UNK;
+                d.val = 0;
+                if (address == MMIO_MTIME && ir->inst.i.func3 == OP_LW) {
+                    d.cls = SPIN_MTIME;
+                } else if (address < rv->mem_base ||
+                           address + 4 > rv->mem_base + rv->mem_size) {
+                    return 0;
+                }
+                break;
             }
-            TIME_LOG; TRACE_LOG "%08x %08x x%02u (%s) <= 0x%08x\n",
-                      rv->pc, inst.inst, inst.i.rd, regname[inst.i.rd],
-                      srv32_read_regs(rv, inst.i.rd)
-            TRACE_END;
-            break;
-        }
-        case OP_ARITHR: { // R-Type
-            switch (inst.r.func7) {
-                #ifdef RV32M_ENABLED
-                case FN_RV32M: // RV32M Multiply Extension
-                    switch(inst.r.func3) {
-                        case OP_MUL:
-                            srv32_write_regs(rv, inst.r.rd, srv32_read_regs(rv, inst.r.rs1) *
-                                              srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_MULH:
-                            {
-                            union {
-                                int64_t l;
-                                struct { int32_t l, h; } n;
-                            } a, b, r;
-                            a.l = (int64_t)srv32_read_regs(rv, inst.r.rs1);
-                            b.l = (int64_t)srv32_read_regs(rv, inst.r.rs2);
-                            r.l = a.l * b.l;
-                            srv32_write_regs(rv, inst.r.rd, r.n.h);
-                            }
-                            break;
-                        case OP_MULSU:
-                            {
-                            union {
-                                int64_t l;
-                                struct { int32_t l, h; } n;
-                            } a, b, r;
-                            a.l = (int64_t)srv32_read_regs(rv, inst.r.rs1);
-                            b.n.l = srv32_read_regs(rv, inst.r.rs2);
-                            b.n.h = 0;
-                            r.l = a.l * b.l;
-                            srv32_write_regs(rv, inst.r.rd, r.n.h);
-                            }
-                            break;
-                        case OP_MULU:
-                            {
-                            union {
-                                int64_t l;
-                                struct { int32_t l, h; } n;
-                            } a, b, r;
-                            a.n.l = srv32_read_regs(rv, inst.r.rs1); a.n.h = 0;
-                            b.n.l = srv32_read_regs(rv, inst.r.rs2); b.n.h = 0;
-                            r.l = ((uint64_t)a.l) *
-                                  ((uint64_t)b.l);
-                            srv32_write_regs(rv, inst.r.rd, r.n.h);
-                            }
-                            break;
-                        case OP_DIV:
-                            if (srv32_read_regs(rv, inst.r.rs2))
-                                srv32_write_regs(rv, inst.r.rd,
-                                    (int32_t)(((int64_t)srv32_read_regs(rv, inst.r.rs1)) /
-                                    srv32_read_regs(rv, inst.r.rs2)));
-                            else
-                                srv32_write_regs(rv, inst.r.rd, 0xffffffff);
-                            break;
-                        case OP_DIVU:
-                            if (srv32_read_regs(rv, inst.r.rs2))
-                                srv32_write_regs(rv, inst.r.rd,
-                                    (int32_t)(((uint32_t)srv32_read_regs(rv, inst.r.rs1)) /
-                                    ((uint32_t)srv32_read_regs(rv, inst.r.rs2))));
-                            else
-                                srv32_write_regs(rv, inst.r.rd, 0xffffffff);
-                            break;
-                        case OP_REM:
-                            if (srv32_read_regs(rv, inst.r.rs2))
-                                srv32_write_regs(rv, inst.r.rd,
-                                    (int32_t)(((int64_t)srv32_read_regs(rv, inst.r.rs1)) %
-                                    srv32_read_regs(rv, inst.r.rs2)));
-                            else
-                                srv32_write_regs(rv, inst.r.rd, srv32_read_regs(rv, inst.r.rs1));
-                            break;
-                        case OP_REMU:
-                            if (srv32_read_regs(rv, inst.r.rs2))
-                                srv32_write_regs(rv, inst.r.rd,
-                                    (int32_t)(((uint32_t)srv32_read_regs(rv, inst.r.rs1)) %
-                                    ((uint32_t)srv32_read_regs(rv, inst.r.rs2))));
-                            else
-                                srv32_write_regs(rv, inst.r.rd, srv32_read_regs(rv, inst.r.rs1));
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
+            case OP_ARITHI:
+                SPIN_GET(a, ir->rs1);
+                d = a;
+                if (ir->handler == exec_addi) {
+                    d.val = a.val + ir->imm;
+                } else if (a.cls == SPIN_MTIME) {
+                    return -1;
+                } else {
+                    d.cls = SPIN_UNK;
+                }
                 break;
-                #endif // RV32M_ENABLED
-
-                case FN_RV32I:
-                    switch(inst.r.func3) {
-                        case OP_ADD:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) + srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_SLL:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) << srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_SLT:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) < srv32_read_regs(rv, inst.r.rs2) ?
-                                1 : 0);
-                            break;
-                        case OP_SLTU:
-                            srv32_write_regs(rv, inst.r.rd,
-                                ((uint32_t)srv32_read_regs(rv, inst.r.rs1)) <
-                                ((uint32_t)srv32_read_regs(rv, inst.r.rs2)) ? 1 : 0);
-                            break;
-                        case OP_XOR:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) ^ srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_SR:
-                            srv32_write_regs(rv, inst.r.rd,
-                                ((uint32_t)srv32_read_regs(rv, inst.r.rs1)) >>
-                                srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_OR:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) | srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_AND:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) & srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
+            case OP_ARITHR:
+                SPIN_GET(a, ir->rs1);
+                SPIN_GET(b, ir->rs2);
+                d.cls = SPIN_UNK;
+                d.val = 0;
+                if (ir->handler == exec_add || ir->handler == exec_sub) {
+                    if (a.cls == SPIN_MTIME && b.cls == SPIN_KNOWN) {
+                        d.cls = SPIN_MTIME;
+                    } else if (b.cls == SPIN_MTIME && a.cls == SPIN_KNOWN &&
+                               ir->handler == exec_add) {
+                        d.cls = SPIN_MTIME;
+                    } else if (a.cls == SPIN_KNOWN && b.cls == SPIN_KNOWN) {
+                        d.cls = SPIN_KNOWN;
+                        d.val = (ir->handler == exec_add) ?
+                                a.val + b.val : a.val - b.val;
+                    } else if (a.cls == SPIN_MTIME || b.cls == SPIN_MTIME) {
+                        return -1;
                     }
+                } else if (a.cls == SPIN_MTIME || b.cls == SPIN_MTIME) {
+                    return -1;
+                }
                 break;
+            case OP_BRANCH: {
+                uint64_t u, t, limit, s;
+                int form;
+
+                SPIN_GET(a, ir->rs1);
+                SPIN_GET(b, ir->rs2);
+                if (ir->pc + ir->imm != blk->pc)
+                    return -1;
+                if (a.cls != SPIN_MTIME && b.cls != SPIN_MTIME)
+                    break; // taken until interrupted
+                if (a.cls == SPIN_MTIME && b.cls == SPIN_MTIME)
+                    return -1;
+
+                // the branch has been taken with the current registers,
+                // compare them as unsigned, taken if u < limit (form 0),
+                // or u >= limit (form 1)
+                u = (uint32_t)rv->regs[(a.cls == SPIN_MTIME) ? ir->rs1 : ir->rs2];
+                t = (uint32_t)rv->regs[(a.cls == SPIN_MTIME) ? ir->rs2 : ir->rs1];
+                switch(ir->inst.b.func3) {
+                    case OP_BLT:
+                    case OP_BGE:
+                        u ^= 0x80000000;
+                        t ^= 0x80000000;
+                        break;
+                    case OP_BLTU:
+                    case OP_BGEU:
+                        break;
+                    default:
+                        return -1;
+                }
+                form = (ir->inst.b.func3 == OP_BGE || ir->inst.b.func3 == OP_BGEU);
+                if (a.cls == SPIN_MTIME) {
+                    limit = t;
+                } else {
+                    limit = t + 1;
+                    form = !form;
+                }
 
-                case FN_ANDN:
-                    switch(inst.r.func3) {
-                        case OP_ADD: // SUB
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) - srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        case OP_SR: // SRA
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) >> srv32_read_regs(rv, inst.r.rs2));
-                            break;
-                        #ifdef RV32B_ENABLED
-                        case OP_AND: // ANDN
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) & ~(srv32_read_regs(rv, inst.r.rs2)));
-                            break;
-                        case OP_OR: // ORN
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) | ~(srv32_read_regs(rv, inst.r.rs2)));
-                            break;
-                        case OP_XOR: // XNOR
-                            srv32_write_regs(rv, inst.r.rd,
-                                ~(srv32_read_regs(rv, inst.r.rs1) ^ srv32_read_regs(rv, inst.r.rs2)));
-                            break;
-                        #endif // RV32B_ENABLED
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
+                // the iterations until the branch falls through
+                if (form == 0) {
+                    s = (limit - u + step - 1) / step;
+                    if (u + s * step >= (1ULL << 32))
+                        return 0;
+                } else {
+                    s = ((1ULL << 32) - u + step - 1) / step;
+                    if (u + s * step - (1ULL << 32) >= limit)
+                        return 0;
+                }
+                count = (long long)s - 1;
+                break;
+            }
+            case OP_FENCE:
+                continue;
+            default:
+                return -1;
+        }
 
-                #ifdef RV32B_ENABLED
-                case FN_ZEXT:
-                    srv32_write_regs(rv, inst.r.rd, srv32_read_regs(rv, inst.r.rs1) & 0xffff);
-                    break;
+        if (ir->rd != 0 && ir->inst.r.op != OP_BRANCH) {
+            v[ir->rd] = d;
+            live |= 1 << ir->rd;
+        }
+    }
 
-                case FN_MINMAX:
-                    switch(inst.r.func3) {
-                        case OP_CLMUL:
-                            {
-                                int32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                int32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                int32_t n = 0;
-
-                                for(int i = 0; i <= 31; i++)
-                                    if ((b >> i) & 1) n ^= (a << i);
-
-                                srv32_write_regs(rv, inst.r.rd, n);
-                            }
-                            break;
-                        case OP_CLMULH:
-                            {
-                                uint32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                uint32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                int32_t n = 0;
-
-                                for(int i = 1; i < 32; i++)
-                                    if ((b >> i) & 1) n ^= (a >> (32 - i));
-
-                                srv32_write_regs(rv, inst.r.rd, n);
-                            }
-                            break;
-                        case OP_CLMULR:
-                            {
-                                uint32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                uint32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                int32_t n = 0;
-
-                                for(int i = 0; i < 32; i++)
-                                    if ((b >> i) & 1) n ^= (a >> (32 - i - 1));
-
-                                srv32_write_regs(rv, inst.r.rd, n);
-                            }
-                            break;
-                        case OP_MAX:
-                            {
-                                int32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                int32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                srv32_write_regs(rv, inst.r.rd, a > b ? a : b);
-                            }
-                            break;
-                        case OP_MAXU:
-                            {
-                                uint32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                uint32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                srv32_write_regs(rv, inst.r.rd, a > b ? a : b);
-                            }
-                            break;
-                        case OP_MIN:
-                            {
-                                int32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                int32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                srv32_write_regs(rv, inst.r.rd, a < b ? a : b);
-                            }
-                            break;
-                        case OP_MINU:
-                            {
-                                uint32_t a = srv32_read_regs(rv, inst.r.rs1);
-                                uint32_t b = srv32_read_regs(rv, inst.r.rs2);
-                                srv32_write_regs(rv, inst.r.rd, a < b ? a : b);
-                            }
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
+    #undef SPIN_GET
 
-                case FN_SHADD:
-                    switch(inst.r.func3) {
-                        case OP_SH1ADD:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs2) +
-                                (srv32_read_regs(rv, inst.r.rs1) << 1));
-                            break;
-                        case OP_SH2ADD:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs2) +
-                                (srv32_read_regs(rv, inst.r.rs1) << 2));
-                            break;
-                        case OP_SH3ADD:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs2) +
-                                (srv32_read_regs(rv, inst.r.rs1) << 3));
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
+    // the iterations before an interrupt may be taken, see srv32_block_ready()
+    if (rv->irq_deadline == LLONG_MAX && count == LLONG_MAX)
+        return 0;
+    left = rv->irq_deadline - 1 - blk->max_cycles - rv->csr.mtime.c;
+    if (left < 0)
+        return 0;
+    if (left / step + 1 < count)
+        count = left / step + 1;
 
-                case FN_BSET:
-                    srv32_write_regs(rv, inst.r.rd,
-                        srv32_read_regs(rv, inst.r.rs1) |
-                        (1 << (srv32_read_regs(rv, inst.r.rs2) & 0x1f)));
-                    break;
+    *mtime_regs = 0;
+    for(i = 1; i < 32; i++) {
+        if ((live & (1 << i)) && v[i].cls == SPIN_MTIME)
+            *mtime_regs |= 1 << i;
+    }
 
-                case FN_BCLR:
-                    switch(inst.r.func3) {
-                        case OP_BCLR:
-                            srv32_write_regs(rv, inst.r.rd,
-                                srv32_read_regs(rv, inst.r.rs1) &
-                                ~(1 << (srv32_read_regs(rv, inst.r.rs2) & 0x1f)));
-                            break;
-                        case OP_BEXT:
-                            srv32_write_regs(rv, inst.r.rd,
-                                (srv32_read_regs(rv, inst.r.rs1) >>
-                                (srv32_read_regs(rv, inst.r.rs2) & 0x1f)) & 1);
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
+    return count;
+}
 
-                case FN_CLZ:
-                    switch(inst.r.func3) {
-                        case OP_ROL:
-                            {
-                                uint32_t n = srv32_read_regs(rv, inst.r.rs2) & 0x1f;
-                                srv32_write_regs(rv, inst.r.rd,
-                                    (srv32_read_regs(rv, inst.r.rs1) << n) |
-                                    ((uint32_t)srv32_read_regs(rv, inst.r.rs1) >> (32 - n)));
-                            }
-                            break;
-                        case OP_ROR:
-                            {
-                                uint32_t n = srv32_read_regs(rv, inst.r.rs2) & 0x1f;
-                                srv32_write_regs(rv, inst.r.rd,
-                                    ((uint32_t)srv32_read_regs(rv, inst.r.rs1) >> n) |
-                                    (srv32_read_regs(rv, inst.r.rs1) << (32 - n)));
-                            }
-                            break;
-                        default:
-                            printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                            return RV_TRAP;
-                    }
-                    break;
+// execute a block branching back to itself, and skip the spin iterations
+static int srv32_exec_spin(struct rv *rv, rv_block *blk) {
+    long long cycle   = rv->csr.cycle.c;
+    long long mtime   = rv->csr.mtime.c;
+    long long instret = rv->csr.instret.c;
+#ifdef RV32C_ENABLED
+    int ovh = rv->overhead;
+#endif // RV32C_ENABLED
+    srv32_cpi cpi = rv->cpi;
+    long long step, count, n;
+    uint32_t mtime_regs = 0;
+    int result;
+    int i;
 
-                case FN_BINV:
-                    srv32_write_regs(rv, inst.r.rd,
-                        srv32_read_regs(rv, inst.r.rs1) ^
-                        (1 << (srv32_read_regs(rv, inst.r.rs2) & 0x1f)));
-                    break;
-                #endif // RV32B_ENABLED
+    result = srv32_exec_block(rv, blk);
+    if (result != RV_OKAY || rv->pc != blk->pc)
+        return result;
+
+    step = rv->csr.cycle.c - cycle;
+    n    = rv->csr.instret.c - instret;
+    if (step <= 0 || step != rv->csr.mtime.c - mtime)
+        return result;
+
+    count = srv32_spin_count(rv, blk, step, &mtime_regs);
+    if (count < 0) {
+        blk->spin = -1;
+        return result;
+    }
+    // stop at the instret where srv32_run() returns
+    if (count > (rv->instret_limit - rv->csr.instret.c) / n)
+        count = (rv->instret_limit - rv->csr.instret.c) / n;
+    if (count == 0)
+        return result;
+
+    rv->csr.cycle.c   += count * step;
+    rv->csr.mtime.c   += count * step;
+    rv->csr.time.c    += count * n;
+    rv->csr.instret.c += count * n;
+#ifdef RV32C_ENABLED
+    rv->overhead += (int)(count * (rv->overhead - ovh));
+#endif // RV32C_ENABLED
+
+    for(i = 0; i < SRV32_STALL_MAX; i++) {
+        rv->cpi.events[i] += count * (rv->cpi.events[i] - cpi.events[i]);
+        rv->cpi.cycles[i] += count * (rv->cpi.cycles[i] - cpi.cycles[i]);
+    }
+    for(i = 0; i < SRV32_CLASS_MAX; i++)
+        rv->cpi.iclass[i] += count * (rv->cpi.iclass[i] - cpi.iclass[i]);
+    rv->cpi.compressed += count * (rv->cpi.compressed - cpi.compressed);
+    rv->cpi.taken      += count * (rv->cpi.taken - cpi.taken);
+    rv->cpi.flushes    += count * (rv->cpi.flushes - cpi.flushes);
+
+    for(i = 1; i < REGNUM; i++) {
+        if (mtime_regs & (1 << i))
+            rv->regs[i] = (int32_t)((uint32_t)rv->regs[i] +
+                                    (uint32_t)(count * step));
+    }
 
-                default:
-                    printf("Unknown instruction at PC 0x%08x\n", rv->pc);
-                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                    return RV_TRAP;
+    return result;
+}
+
+int srv32_run(struct rv *rv, long long count) {
+    rv_block *prev = NULL;
+    int result;
+
+    if (rv->exited)
+        return RV_EXIT;
+
+    rv->instret_limit = (count < 0) ? LLONG_MAX : rv->csr.instret.c + count;
+    rv->watch_hit.type = 0;
+
+    while(rv->csr.instret.c < rv->instret_limit) {
+        int32_t pc = rv->pc;
+        rv_block *blk = NULL;
+
+        #ifdef RV32C_ENABLED
+        if (pc >= rv->mem_base && pc < rv->mem_base + rv->mem_size && (pc & 1) == 0 &&
+            srv32_fetch_latency(rv, pc) >= 0) {
+        #else
+        if (pc >= rv->mem_base && pc < rv->mem_base + rv->mem_size && (pc & 3) == 0 &&
+            srv32_fetch_latency(rv, pc) >= 0) {
+        #endif // RV32C_ENABLED
+            // the blocks start at the breakpoints
+            if (rv->bp_map && BP_TEST(rv, pc))
+                return RV_BREAK;
+
+            // follow the chain of the previous block
+            if (prev && prev->next[0] && prev->next[0]->pc == pc) {
+                blk = prev->next[0];
+            } else if (prev && prev->next[1] && prev->next[1]->pc == pc) {
+                blk = prev->next[1];
+            } else {
+                blk = &rv->bcache[BCACHE_INDEX(pc)];
+                if (blk->pc != pc)
+                    srv32_build_block(rv, blk, pc);
+                if (prev && prev->pc != ICACHE_INVALID)
+                    prev->next[(pc == prev->end) ? 0 : 1] = blk;
             }
-            TIME_LOG; TRACE_LOG "%08x %08x x%02u (%s) <= 0x%08x\n",
-                      rv->pc, inst.inst, inst.r.rd, regname[inst.r.rd],
-                      srv32_read_regs(rv, inst.r.rd)
-            TRACE_END;
-            break;
         }
-        case OP_FENCE: {
-            TIME_LOG; TRACE_LOG "%08x %08x\n", rv->pc, inst.inst
-            TRACE_END;
-            break;
-        }
-        case OP_SYSTEM: { // I-Type
-            int val;
-            int update;
-            int csr_op = 0;
-            int csr_type;
-            // RDCYCLE, RDTIME and RDINSTRET are read only
-            switch(inst.i.func3) {
-                case OP_ECALL:
-                    TIME_LOG; TRACE_LOG "%08x %08x\n", rv->pc, inst.inst
-                    TRACE_END;
-                    switch (inst.i.imm & 3) {
-                       case 0: // ecall
-                           if (1) { // syscall, to compatible FreeRTOS usage, don't use it.
-                               int res;
-                               res = srv32_syscall(rv,
-                                                   srv32_read_regs(rv, SYS),
-                                                   srv32_read_regs(rv, A0),
-                                                   srv32_read_regs(rv, A1),
-                                                   srv32_read_regs(rv, A2),
-                                                   srv32_read_regs(rv, A3),
-                                                   srv32_read_regs(rv, A4),
-                                                   srv32_read_regs(rv, A5));
-                               // Notes: FreeRTOS will use ecall to perform context switching.
-                               // The syscall of newlib will confict with the syscall of
-                               // FreeRTOS.
-                               #if 0
-                               // FIXME: if it is prefined syscall, excute it.
-                               // otherwise raising a trap
-                               if (res != -1) {
-                                    srv32_write_regs(rv, A0, res);
-                               } else {
-                                    srv32_trap(rv, TRAP_ECALL, 0);
-                                    return RV_TRAP;
-                               }
-                               break;
-                               #else
-                               if (res != -1)
-                                    srv32_write_regs(rv, A0, res);
-                               srv32_trap(rv, TRAP_ECALL, 0);
-                               return RV_TRAP;
-                               #endif
-                           } else {
-                               srv32_trap(rv, TRAP_ECALL, 0);
-                               return RV_TRAP;
-                           }
-                       case 1: // ebreak
-                           srv32_trap(rv, TRAP_BREAK, rv->pc);
-                           return RV_TRAP;
-                       case 2: // mret
-                           rv->pc = rv->csr.mepc;
-                           // rv->csr.mstatus.mie = rv->csr.mstatus.mpie
-                           rv->csr.mstatus = (rv->csr.mstatus & (1 << MPIE)) ?
-                                              (rv->csr.mstatus | (1 << MIE)) :
-                                              (rv->csr.mstatus & ~(1 << MIE));
-                           // rv->csr.mstatus.mpie = 1
-
-                           #ifndef RV32C_ENABLED
-                           if ((rv->pc & 3) != 0) {
-                               // Instruction address misaligned
-                               return RV_OKAY;
-                           }
-                           #endif // RV32C_ENABLED
-                           srv32_cycle_add(rv, rv->branch_penalty);
-                           return RV_OKAY;
-                       default:
-                           printf("Illegal system call at PC 0x%08x\n", rv->pc);
-                           srv32_trap(rv, TRAP_INST_ILL, 0);
-                           return RV_TRAP;
-                    }
-                    break;
-                case OP_CSRRWI:
-                    csr_op   = 1;
-                    val      = inst.i.rs1;
-                    update   = 1;
-                    csr_type = OP_CSRRW;
-                    break;
-                // If the zimm[4:0] field is zero, then these instructions will not write
-                // to the CSR
-                case OP_CSRRW:
-                    csr_op   = 1;
-                    val      = srv32_read_regs(rv, inst.i.rs1);
-                    update   = 1;
-                    csr_type = OP_CSRRW;
-                    break;
-                // For both CSRRS and CSRRC, if rs1=x0, then the instruction will not
-                // write to the CSR at all
-                case OP_CSRRSI:
-                    csr_op   = 1;
-                    val      = inst.i.rs1;
-                    update   = (inst.i.rs1 == 0) ? 0 : 1;
-                    csr_type = OP_CSRRS;
-                    break;
-                case OP_CSRRS:
-                    csr_op   = 1;
-                    val      = srv32_read_regs(rv, inst.i.rs1);
-                    update   = (inst.i.rs1 == 0) ? 0 : 1;
-                    csr_type = OP_CSRRS;
-                    break;
-                case OP_CSRRCI:
-                    csr_op   = 1;
-                    val      = inst.i.rs1;
-                    update   = (inst.i.rs1 == 0) ? 0 : 1;
-                    csr_type = OP_CSRRC;
-                    break;
-                case OP_CSRRC:
-                    csr_op   = 1;
-                    val      = srv32_read_regs(rv, inst.i.rs1);
-                    update   = (inst.i.rs1 == 0) ? 0 : 1;
-                    csr_type = OP_CSRRC;
-                    break;
-                default:
-                    printf("Unknown system instruction at PC 0x%08x\n", rv->pc);
-                    TIME_LOG; TRACE_LOG "%08x %08x\n", rv->pc, inst.inst
-                    TRACE_END;
-                    srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-                    return RV_TRAP;
-            }
-            if (csr_op) {
-                int legal = 0;
-                int result = csr_rw(rv, inst.i.imm, csr_type, val, update, &legal);
-                if (legal) {
-                    srv32_write_regs(rv, inst.i.rd, result);
-                }
-                TIME_LOG; TRACE_LOG "%08x %08x",
-                          rv->pc, inst.inst
-                TRACE_END;
-                if (!legal) {
-                   TRACE_LOG "\n" TRACE_END;
-                   srv32_trap(rv, TRAP_INST_ILL, 0);
-                   return RV_TRAP;
-                }
-                TRACE_LOG " x%02u (%s) <= 0x%08x\n",
-                          inst.i.rd,
-                          regname[inst.i.rd], srv32_read_regs(rv, inst.i.rd)
-                TRACE_END;
-            }
-            break;
+
+        // out of range, misaligned, may be interrupted, or over the limit
+        if (blk && srv32_block_ready(rv, blk) &&
+            rv->csr.instret.c + blk->n <= rv->instret_limit) {
+            long long start = rv->csr.cycle.c;
+
+            // the watched loads of the skipped iterations are not checked
+            if (blk == prev && rv->spin && !rv->nwatch && blk->spin >= 0)
+                result = srv32_exec_spin(rv, blk);
+            else
+                result = srv32_exec_block(rv, blk);
+            prev = blk;
+
+            if (rv->prof && rv->csr.cycle.c >= rv->prof->next)
+                srv32_profile_sample(rv, blk, start);
+        } else {
+            result = srv32_step(rv);
+            prev = NULL;
         }
-        default: {
-            printf("Illegal instruction at PC 0x%08x\n", rv->pc);
-            TIME_LOG; TRACE_LOG "%08x %08x\n", rv->pc, inst.inst
-            TRACE_END;
-            srv32_trap(rv, TRAP_INST_ILL, inst.inst);
-            return RV_TRAP;
+
+        // also stopped by a load, e.g. the replay diverges at MMIO_GETC
+        if (result == RV_EXIT || rv->exited) {
+            rv->exited = true;
+            return RV_EXIT;
         }
-    } // end of switch(inst.r.op)
+    }
+
+    if (rv->roi_hit) {
+        rv->roi_hit = false;
+        return RV_ROI;
+    }
 
-    rv->pc = compressed ? rv->pc + 2 : rv->pc + 4;
+    if (rv->watch_hit.type)
+        return RV_BREAK;
 
     return RV_OKAY;
 }
 
+// The ROI marker of the program stops srv32_run() after the instruction,
+// only the first marker is taken.
+void srv32_roi(struct rv *rv) {
+    if (!rv->roi)
+        return;
+
+    rv->roi = false;
+    rv->roi_hit = true;
+    rv->instret_limit = rv->csr.instret.c;
+    rv->block_break = 1;
+}
+
+// Step the instructions until one is retired with a line of the trace log,
+// the instructions without the line (e.g. an illegal compressed
+// instruction) are skipped.
+int srv32_retire(struct rv *rv, srv32_retired *r) {
+    int result = RV_OKAY;
+    int i;
+
+    if (rv->exited)
+        return RV_EXIT;
+
+    r->kind = -1;
+    rv->retired = r;
+    rv->log = true;
+
+    for(i = 0; i < RETIRE_STEPS && r->kind < 0 && result != RV_EXIT; i++)
+        result = srv32_step(rv);
+
+    rv->retired = NULL;
+    rv->log = (rv->ft != NULL);
+
+    if (result == RV_EXIT)
+        rv->exited = true;
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Library interface
+//
+// The simulator is built as librvsim.a and librvsim.so with the interface
+// of librvsim.h. All of the state is kept in struct rv, and the program
+// exit is returned by srv32_run() instead of terminating the process.
+
+void srv32_config_default(srv32_config *cfg) {
+    memset(cfg, 0, sizeof(srv32_config));
+    cfg->mem_base       = MEMBASE;
+    cfg->mem_size       = (MEMSIZE)*2*1024; // default memory size
+    cfg->branch_penalty = BRANCH_PENALTY;
+    cfg->spin           = true;
+}
+
+struct rv *srv32_create(const srv32_config *cfg) {
+    struct rv *rv;
+    int i;
+
+    if ((rv = (struct rv*)aligned_malloc(sizeof(int), sizeof(struct rv))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+
+    // clear rv data structure
+    memset(rv, 0, sizeof(struct rv));
+
+    rv->mem_base       = cfg->mem_base;
+    rv->mem_size       = cfg->mem_size;
+    rv->branch_penalty = cfg->branch_penalty;
+    rv->branch_predict = cfg->branch_predict;
+    rv->singleram      = cfg->singleram;
+    rv->spin           = cfg->spin;
+    rv->quiet          = cfg->quiet;
+    rv->roi            = cfg->roi;
+    #ifdef JIT_ENABLED
+    rv->jit            = cfg->jit;
+    #endif // JIT_ENABLED
+
+    // the memory covers all of the regions, the holes are not committed,
+    // see mem_map()
+    if (cfg->platform) {
+        uint64_t first = 0xffffffffULL, last = 0;
+
+        if (!platform_read(&rv->platform, cfg->platform))
+            goto fail;
+
+        for(i = 0; i < rv->platform.nregions; i++) {
+            const platform_region *r = &rv->platform.region[i];
+
+            if (r->base < first)
+                first = r->base;
+            if ((uint64_t)r->base + r->size > last)
+                last = (uint64_t)r->base + r->size;
+            if (r->latency > rv->max_latency)
+                rv->max_latency = r->latency;
+        }
+
+        if (last - first > INT_MAX) {
+            printf("The regions of %s span over 2 GB\n", cfg->platform);
+            goto fail;
+        }
+
+        rv->mem_base = (int32_t)first;
+        rv->mem_size = (int32_t)(last - first);
+    } else {
+        platform_region *r = &rv->platform.region[0];
+
+        strncpy(r->name, "ram", sizeof(r->name) - 1);
+        r->base = rv->mem_base;
+        r->size = rv->mem_size;
+        rv->platform.nregions = 1;
+    }
+
+    rv->flat = rv->platform.nregions == 1 && rv->max_latency == 0 &&
+               !rv->platform.region[0].readonly;
+
+    if (cfg->logfile) {
+        // the binary trace for the .bin file, the text log otherwise
+        size_t n = strlen(cfg->logfile);
+        bool binary = n > 4 && strcmp(cfg->logfile + n - 4, ".bin") == 0;
+
+        if ((rv->ft=trace_open(cfg->logfile, binary)) == NULL) {
+            // LCOV_EXCL_START
+            printf("can not open file %s\n", cfg->logfile);
+            goto fail;
+            // LCOV_EXCL_STOP
+        }
+        // the trace log is compared with the RTL cycle by cycle
+        rv->spin = false;
+        rv->log = true;
+    }
+
+    if (cfg->profile) {
+        if (!srv32_profile_init(rv, cfg->profile, cfg->profile_period)) {
+            // LCOV_EXCL_START
+            printf("malloc fail\n");
+            goto fail;
+            // LCOV_EXCL_STOP
+        }
+        // each instruction of the spin loops is counted
+        if (!cfg->profile_period)
+            rv->spin = false;
+    }
+
+    if (cfg->callgraph && !srv32_callgraph_init(rv, cfg->callgraph)) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    if (cfg->stats && (rv->statsfile = strdup(cfg->stats)) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    if (cfg->outfile) {
+        if ((rv->fo=fopen(cfg->outfile, "w")) == NULL) {
+            // LCOV_EXCL_START
+            printf("can not open file %s\n", cfg->outfile);
+            goto fail;
+            // LCOV_EXCL_STOP
+        }
+    }
+
+    if (cfg->record && cfg->replay) {
+        printf("The inputs can not be recorded and replayed at the same time\n");
+        goto fail;
+    }
+
+    if ((cfg->record || cfg->replay) &&
+        !srv32_replay_open(rv, cfg->replay ? cfg->replay : cfg->record,
+                           cfg->replay == NULL))
+        goto fail;
+
+    if ((rv->dumpfile = strdup(cfg->dumpfile ? cfg->dumpfile : "dump.txt")) == NULL ||
+        (rv->mem = (int*)mem_map(NULL, rv->mem_size)) == NULL ||
+        (rv->icache = (rv_insn*)mem_map(NULL, sizeof(rv_insn) * ICACHE_SIZE)) == NULL ||
+        (rv->bcache = (rv_block*)mem_map(NULL, sizeof(rv_block) * BCACHE_SIZE)) == NULL ||
+        (rv->code_map = (uint8_t*)mem_map(NULL, CODE_MAP_SIZE(rv))) == NULL) {
+        // LCOV_EXCL_START
+        printf("malloc fail\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+
+    for(i = 0; i < (int)(sizeof(builtin_devices) / sizeof(srv32_device)); i++) {
+        if (!srv32_add_device(rv, &builtin_devices[i]))
+            goto fail;
+    }
+
+    #ifdef JIT_ENABLED
+    if (rv->jit && !srv32_jit_init(rv)) {
+        // LCOV_EXCL_START
+        printf("Can not allocate JIT code buffer\n");
+        goto fail;
+        // LCOV_EXCL_STOP
+    }
+    #endif // JIT_ENABLED
+
+    return rv;
+
+// LCOV_EXCL_START
+fail:
+    srv32_destroy(rv);
+    return NULL;
+// LCOV_EXCL_STOP
+}
+
+// clear the memory and the basic blocks
+void srv32_clear_mem(struct rv *rv) {
+    mem_map(rv->mem, rv->mem_size);
+
+    // invalidate the instruction cache and basic blocks
+    srv32_clear_cache(rv);
+}
+
+// Change the timing of the loaded program, e.g. after fork() of --fanout.
+// The basic blocks and the compiled code have the cycles of the old timing,
+// so they are built again. A latency < 0 keeps the wait states of the
+// regions.
+void srv32_retime(struct rv *rv, int32_t branch_penalty, bool branch_predict,
+                  bool singleram, int latency) {
+    int i;
+
+    rv->branch_penalty = branch_penalty;
+    rv->branch_predict = branch_predict;
+    rv->singleram      = singleram;
+
+    if (latency >= 0) {
+        for(i = 0; i < rv->platform.nregions; i++)
+            rv->platform.region[i].latency = latency;
+        rv->max_latency = latency;
+        rv->flat = rv->platform.nregions == 1 && latency == 0 &&
+                   !rv->platform.region[0].readonly;
+    }
+
+    srv32_clear_cache(rv);
+}
+
+bool srv32_load(struct rv *rv, const char *file) {
+    int i;
+
+    srv32_clear_mem(rv);
+
+    // load elf file
+    rv->loaded = false;
+    elf_close(rv->elf);
+    if ((rv->elf = elf_open(file)) == NULL ||
+        !elf_load(rv->elf, (char*)rv->mem, rv->mem_base, rv->mem_size))
+        return false;
+
+    // Registers initialize
+    for(i=0; i<REGNUM; i++) {
+        srv32_write_regs(rv, i, 0);
+    }
+
+    memset(&rv->csr, 0, sizeof(rv->csr));
+    rv->csr.mvendorid  = MVENDORID;
+    rv->csr.marchid    = MARCHID;
+    rv->csr.mimpid     = MIMPID;
+    rv->csr.mhartid    = MHARTID;
+    rv->csr.misa       = MISA;
+    rv->pc             = rv->mem_base;
+    rv->prev_pc        = rv->pc;
+
+    // pending state of the last run
+    rv->timer_irq       = 0;
+    rv->sw_irq          = 0;
+    rv->sw_irq_next     = 0;
+    rv->ext_irq         = 0;
+    rv->ext_irq_next    = 0;
+    rv->compressed_prev = 0;
+    rv->mtime_update    = 0;
+    rv->block_break     = 0;
+    rv->exited          = false;
+    rv->exitcode        = 0;
+    rv->htif_result     = 0;
+    #ifdef RV32C_ENABLED
+    rv->overhead        = 0;
+    #endif // RV32C_ENABLED
+    memset(&rv->cpi, 0, sizeof(srv32_cpi));
+    memset(rv->mhpmevent, 0, sizeof(rv->mhpmevent));
+    memset(rv->hpm_base, 0, sizeof(rv->hpm_base));
+    rv->count_class     = rv->statsfile != NULL;
+
+    srv32_irq_schedule(rv);
+
+    if (rv->prof)
+        srv32_profile_reset(rv);
+    if (rv->graph)
+        srv32_callgraph_reset(rv);
+
+    gettimeofday(&rv->time_start, NULL);
+    rv->loaded = true;
+
+    return true;
+}
+
+void srv32_get_stat(struct rv *rv, srv32_stat *stat) {
+    stat->cycle    = rv->csr.cycle.c;
+    stat->instret  = rv->csr.instret.c;
+    #ifdef RV32C_ENABLED
+    stat->overhead = rv->overhead;
+    #else
+    stat->overhead = 0;
+    #endif // RV32C_ENABLED
+    stat->pc       = rv->pc;
+    stat->exitcode = rv->exitcode;
+}
+
+void srv32_get_cpi(struct rv *rv, srv32_cpi *cpi) {
+    *cpi = rv->cpi;
+    cpi->cycle   = rv->csr.cycle.c;
+    cpi->instret = rv->csr.instret.c;
+    #ifdef RV32C_ENABLED
+    cpi->cycles[SRV32_STALL_COMPRESSED] = rv->overhead;
+    #endif // RV32C_ENABLED
+}
+
+void srv32_report(struct rv *rv) {
+    struct timeval time_end;
+    double diff;
+
+    if (rv->quiet)
+        return;
+
+    gettimeofday(&time_end, NULL);
+
+    diff = (double)(time_end.tv_sec-rv->time_start.tv_sec) +
+                   (time_end.tv_usec-rv->time_start.tv_usec)/1000000.0;
+
+#ifdef RV32C_ENABLED
+    printf("\nExcuting %lld instructions, %lld cycles, %1.3f CPI, %1.3f%% overhead\n",
+           rv->csr.instret.c, rv->csr.cycle.c,
+           ((float)rv->csr.cycle.c)/rv->csr.instret.c, (rv->overhead*100.0)/rv->csr.instret.c);
+#else
+    printf("\nExcuting %lld instructions, %lld cycles, %1.3f CPI\n", rv->csr.instret.c,
+           rv->csr.cycle.c, ((float)rv->csr.cycle.c)/rv->csr.instret.c);
+#endif // RV32C_ENABLED
+
+    printf("Program terminate\n");
+
+    printf("\n");
+    printf("Simulation statistics\n");
+    printf("=====================\n");
+    printf("Simulation time  : %0.3f s\n", (float)diff);
+    printf("Simulation cycles: %lld\n", rv->csr.cycle.c);
+    printf("Simulation speed : %0.3f MHz\n", (float)(rv->csr.cycle.c / diff / 1000000.0));
+    printf("\n");
+}
+
+void srv32_destroy(struct rv *rv) {
+    int i;
+
+    // the profile of the last program
+    if (rv->prof && rv->loaded)
+        srv32_profile_write(rv);
+    if (rv->graph && rv->loaded)
+        srv32_callgraph_write(rv);
+    if (rv->statsfile && rv->loaded)
+        srv32_stats_write(rv);
+    srv32_profile_free(rv);
+    srv32_callgraph_free(rv);
+
+    #ifdef JIT_ENABLED
+    srv32_jit_free(rv);
+    #endif // JIT_ENABLED
+    if (rv->code_map) munmap(rv->code_map, CODE_MAP_SIZE(rv));
+    if (rv->bcache) munmap(rv->bcache, sizeof(rv_block) * BCACHE_SIZE);
+    if (rv->icache) munmap(rv->icache, sizeof(rv_insn) * ICACHE_SIZE);
+    if (rv->mem) munmap(rv->mem, rv->mem_size);
+    if (rv->ft && !trace_close(rv->ft))
+        printf("can not write the trace log\n");
+    if (rv->fo) fclose(rv->fo);
+    srv32_replay_close(rv);
+    srv32_reverse_free(rv);
+    srv32_breakpoint_free(rv);
+    elf_close(rv->elf);
+    free(rv->dumpfile);
+    free(rv->statsfile);
+    for(i = 0; i < DEVICE_DIR_SIZE; i++)
+        free(rv->device_map[i]);
+    aligned_free(rv);
+}
@@ -24,8 +24,12 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/time.h>
+#include "librvsim.h"
 #include "opcode.h"
-#include "map.h"
+#include "elfloader.h"
+#include "platform.h"
+#include "trace.h"
 
 #ifdef GDBSTUB
 // LCOV_EXCL_START
@@ -49,11 +53,279 @@
 #define MEMBASE (0)
 #endif // MEMBASE
 
-enum {
-    RV_OKAY = 0,
-    RV_TRAP = 1,
-    RV_EXIT = 2
-};
+// Predecoded instruction cache, direct-mapped and indexed by PC
+#ifndef ICACHE_BITS
+#define ICACHE_BITS (16)
+#endif // ICACHE_BITS
+
+#define ICACHE_SIZE (1 << ICACHE_BITS)
+
+#ifdef RV32C_ENABLED
+#define ICACHE_INDEX(pc) (((uint32_t)(pc) >> 1) & (ICACHE_SIZE - 1))
+#else
+#define ICACHE_INDEX(pc) (((uint32_t)(pc) >> 2) & (ICACHE_SIZE - 1))
+#endif // RV32C_ENABLED
+
+#define ICACHE_INVALID (-1)
+
+struct rv;
+struct rv_insn;
+
+typedef int (*rv_handler)(struct rv *rv, const struct rv_insn *ir);
+
+typedef struct rv_insn {
+    int32_t pc;             // tag, ICACHE_INVALID if the entry is empty
+    INST    inst;           // the instruction, expanded if it is compressed
+    int32_t imm;            // sign-extended immediate
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t compressed;
+    uint8_t system;         // OP_SYSTEM, can not be interrupted
+    uint8_t sync;           // system, may access the counters
+    uint8_t memop;          // load or store, may stall or access the devices
+    uint8_t iclass;         // SRV32_CLASS_*
+    rv_handler handler;
+} rv_insn;
+
+// Basic block cache, direct-mapped and indexed by the start PC
+#ifndef BCACHE_BITS
+#define BCACHE_BITS (12)
+#endif // BCACHE_BITS
+
+#define BCACHE_SIZE (1 << BCACHE_BITS)
+
+#ifdef RV32C_ENABLED
+#define BCACHE_INDEX(pc) (((uint32_t)(pc) >> 1) & (BCACHE_SIZE - 1))
+#else
+#define BCACHE_INDEX(pc) (((uint32_t)(pc) >> 2) & (BCACHE_SIZE - 1))
+#endif // RV32C_ENABLED
+
+// maximum instructions of a basic block
+#define BLOCK_MAX   (32)
+
+// granularity of the code page map, used to invalidate the blocks
+#define CODE_PAGE_BITS (8)
+
+// the memory mapped devices are found by a two-level table, the directory
+// of 4 MB regions points to the tables of 4 KB pages holding the index + 1
+// of the device
+#define DEVICE_MAX       (32)
+#define DEVICE_PAGE_BITS (12)
+#define DEVICE_DIR_BITS  (10)
+#define DEVICE_DIR_SIZE  (1 << DEVICE_DIR_BITS)
+#define DEVICE_TBL_SIZE  (1 << (32 - DEVICE_DIR_BITS - DEVICE_PAGE_BITS))
+
+// srv32_retire() gives up after the steps without a retired instruction
+#define RETIRE_STEPS     (16)
+
+// the profile counts are kept for each halfword of the memory, and the
+// pages of 256 entries having counts are marked for the report
+#define PROFILE_PAGE_BITS (8)
+
+// the shadow call stack keeps the frames up to the depth, and the stacks
+// of the trapped contexts, e.g. the tasks switched by the trap handler
+#define CALLGRAPH_DEPTH    (256)
+#define CALLGRAPH_CONTEXTS (64)
+
+// function of the pseudo-frames of the trap handler
+#define CALLGRAPH_TRAP     (0xffffffff)
+#define CALLGRAPH_INT      (0xfffffffe)
+
+#ifdef JIT_ENABLED
+// compile a block after it has been executed the times
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD (16)
+#endif // JIT_THRESHOLD
+
+// size of the code buffer for the compiled blocks
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE (16*1024*1024)
+#endif // JIT_CODE_SIZE
+#endif // JIT_ENABLED
+
+struct rv_exec;
+
+typedef int (*rv_jit_fn)(struct rv *rv, struct rv_exec *ex);
+
+typedef struct rv_block {
+    int32_t  pc;            // tag, ICACHE_INVALID if the entry is empty
+    int32_t  end;           // the address next to the last instruction
+    int32_t  n;             // number of instructions
+    int32_t  max_cycles;    // worst-case cycles before the last instruction
+    struct rv_block *next[2]; // chained successors, fall-through and taken exit
+    int8_t   spin;          // -1 if it can not be a spin loop
+#ifdef JIT_ENABLED
+    rv_jit_fn code;         // compiled block, NULL if not compiled yet
+    uint32_t  hits;         // executed times before compiled
+#endif // JIT_ENABLED
+    uint16_t cycles[BLOCK_MAX];   // accumulated cycles up to the instruction
+    uint16_t fetches[BLOCK_MAX];  // accumulated fetches with wait states
+#ifdef RV32C_ENABLED
+    uint16_t overhead[BLOCK_MAX]; // accumulated RV32C overhead
+#endif // RV32C_ENABLED
+    rv_insn  insn[BLOCK_MAX];
+} rv_block;
+
+typedef struct profile_entry {
+    uint64_t cycles;
+    uint64_t instret;       // only counted when period is 0
+} profile_entry;
+
+// flat profile, see profile.c
+typedef struct rv_profile {
+    char          *file;
+    uint32_t       period;  // sample period in cycles, 0 counts each instruction
+    long long      next;    // cycle of the next sample
+    long long      mark;    // cycle after the last counted instruction
+    profile_entry *hist;    // indexed by (pc - mem_base) >> 1
+    uint8_t       *pages;   // the pages of hist having counts
+    size_t         size;    // number of the entries
+} rv_profile;
+
+// a call path, the child of the parent path calling the function
+typedef struct callgraph_node {
+    uint32_t func;          // the function address, or CALLGRAPH_TRAP/INT
+    int32_t  parent;
+    int32_t  child;         // the first child
+    int32_t  sibling;       // the next child of the parent
+    uint64_t self;          // exclusive cycles
+    uint64_t calls;
+} callgraph_node;
+
+typedef struct callgraph_frame {
+    int32_t  node;
+    uint32_t ret;           // the return address
+} callgraph_frame;
+
+// the shadow stack of a trapped context, found by sp and mepc at mret
+typedef struct callgraph_context {
+    uint32_t sp;
+    uint32_t pc;
+    int32_t  depth;         // 0 if the entry is free
+    callgraph_frame frame[CALLGRAPH_DEPTH];
+} callgraph_context;
+
+// call graph of the shadow call stack, see profile.c
+typedef struct rv_callgraph {
+    char           *file;
+    callgraph_node *node;
+    int32_t         nnodes;
+    int32_t         size;
+    long long       mark;   // cycle of the last call, return or trap
+    int32_t         depth;
+    callgraph_frame frame[CALLGRAPH_DEPTH];
+    callgraph_context context[CALLGRAPH_CONTEXTS];
+    int32_t         victim; // the context replaced when all are used
+    uint32_t        pending; // the trap entered, CALLGRAPH_TRAP/INT or 0
+    uint32_t        pending_sp;
+    uint32_t        pending_pc;
+} rv_callgraph;
+
+// the input of MMIO_GETC, the other records are of the syscalls by SYS_*
+#define REPLAY_GETC     0
+
+// log of the host inputs, see replay.c
+typedef struct rv_replay {
+    FILE     *fp;
+    char     *file;
+    bool      record;       // record the inputs, otherwise replay them
+    bool      diverged;     // the program does not follow the log
+    long long instret;      // stamp of the last record
+    bool      next;         // the next record is read ahead for the replay
+    int32_t   kind;
+    long long stamp;
+    int32_t   result;
+} rv_replay;
+
+// the state of the processor without the memory, see srv32_save_state()
+typedef struct rv_state {
+    int32_t   pc;
+    int32_t   prev_pc;
+    int32_t   regs[REGNUM];
+    CSR       csr;
+    int32_t   timer_irq;
+    int32_t   sw_irq;
+    int32_t   sw_irq_next;
+    int32_t   ext_irq;
+    int32_t   ext_irq_next;
+    int32_t   compressed_prev;
+    int32_t   mtime_update;
+    int32_t   exited;
+    int32_t   exitcode;
+    int32_t   htif_result;
+    int32_t   overhead;
+    int32_t   count_class;
+    long long irq_deadline;
+    srv32_cpi cpi;
+    uint32_t  mhpmevent[HPM_COUNTERS];
+    long long hpm_base[HPM_COUNTERS];
+} rv_state;
+
+// history of the debugger, see reverse.c
+typedef struct rv_undo {
+    uint32_t  offset;       // the memory word before a store
+    uint32_t  data;
+} rv_undo;
+
+typedef struct rv_snapshot {
+    long long step;         // the state before this step
+    uint64_t  log;          // entries of the undo log at the snapshot
+    uint64_t  input;        // inputs of the host before the snapshot
+    rv_state  state;
+} rv_snapshot;
+
+typedef struct rv_input {
+    long long step;
+    int32_t   kind;         // REPLAY_GETC or SYS_*
+    int32_t   result;
+    uint8_t  *data;         // the bytes of SYS_READ
+    int       len;
+} rv_input;
+
+typedef struct rv_reverse {
+    long long    step;      // instructions stepped since the history starts
+    long long    end;       // the steps executed, the later ones are new
+    bool         replay;    // this step is executed again
+    uint64_t     log;       // entries written to the undo log
+    rv_undo     *undo;
+    rv_snapshot *snap;
+    uint64_t     first;     // valid snapshots are first to last-1
+    uint64_t     last;
+    rv_input    *input;
+    uint64_t     inputs;    // inputs kept in the history
+    uint64_t     next;      // the next input of the steps executed again
+} rv_reverse;
+
+// the step is executed again by the debugger, the output is not written
+#define REV_REPLAY(rv)  ((rv)->rev && (rv)->rev->replay)
+
+// the watchpoints of the memory, see breakpoint.c
+#define WATCH_MAX       16
+#define WATCH_PAGE_BITS (6)
+
+typedef struct rv_watch {
+    uint32_t  addr;
+    int32_t   len;
+    int       type;         // SRV32_WATCH_*
+} rv_watch;
+
+// breakpoint at pc, a bit of each halfword of the memory
+#define BP_TEST(rv, pc) \
+    ((rv)->bp_map[(uint32_t)((pc) - (rv)->mem_base) >> 4] & \
+     (1 << (((uint32_t)((pc) - (rv)->mem_base) >> 1) & 7)))
+
+// any watchpoint of the type in the page of the memory offset
+#define WATCH_TEST(rv, offset, type) \
+    ((rv)->watch_map[(offset) >> WATCH_PAGE_BITS] & (type))
+
+// state of the running block
+typedef struct rv_exec {
+    const rv_block *blk;
+    int entry;              // RV32C overhead of the first instruction
+    int done;               // the last instruction committed to the counters
+    int count;              // number of instructions executed
+} rv_exec;
 
 struct rv {
     // registers
@@ -71,31 +343,174 @@ struct rv {
     int32_t mem_base;
     int32_t *mem;
 
+    // the memory regions in [mem_base, mem_base+mem_size), flat if it is
+    // one region without the wait states
+    platform platform;
+    bool     flat;
+    int      max_latency;
+
+    // memory mapped devices, see srv32_add_device()
+    srv32_device devices[DEVICE_MAX];
+    int          ndevices;
+    uint8_t     *device_map[DEVICE_DIR_SIZE];
+
+    // predecoded instructions
+    rv_insn *icache;
+
+    // basic blocks, and the map of memory pages holding the blocks
+    rv_block *bcache;
+    uint8_t  *code_map;
+    int32_t   nblocks;      // blocks built since the last flush
+
+    // interrupt pending state between the instructions
+    int timer_irq;
+    int sw_irq;
+    int sw_irq_next;
+    int ext_irq;
+    int ext_irq_next;
+    int compressed_prev;
+
+    // the mtime to check the interrupts again, see srv32_irq_schedule()
+    long long irq_deadline;
+
     bool singleram;
     bool mtime_update;
+    bool block_break;       // leave the running basic block
+    rv_exec *ex;            // the block run by the interpreter, see srv32_sync()
+    bool spin;              // fast-forward the spin loops
+    bool quiet;             // no statistics from srv32_report()
+    bool exited;            // the program is terminated
     int  exitcode;
 
+    // the instret where srv32_run() returns
+    long long instret_limit;
+
+    // srv32_run() returns RV_ROI at the next ROI marker, see srv32_roi()
+    bool roi;
+    bool roi_hit;
+
+    // breakpoints and watchpoints, the maps are NULL until one is set
+    uint8_t  *bp_map;
+    uint8_t  *watch_map;    // the watch types of each page
+    rv_watch  watch[WATCH_MAX];
+    int       nwatch;
+    rv_watch  watch_hit;    // the access stopping srv32_run(), type 0 if none
+    int32_t   watch_pc;
+
+    #ifdef RV32C_ENABLED
+    int overhead;           // cycles of the instruction type changes
+    #endif // RV32C_ENABLED
+
+    // the stall causes, and the instruction classes if count_class is set,
+    // see srv32_get_cpi()
+    srv32_cpi cpi;
+    bool      count_class;
+
+    // mhpmevent3.., the counters are the events since hpm_base, see csr_hpm()
+    uint32_t  mhpmevent[HPM_COUNTERS];
+    long long hpm_base[HPM_COUNTERS];
+
+    // result of the last HTIF call
+    int htif_result;
+
+    // start time of the simulation
+    struct timeval time_start;
+
+    #ifdef JIT_ENABLED
+    bool     jit;
+    uint8_t *jit_code;      // code buffer of the compiled blocks
+    int32_t  jit_used;
+    #endif // JIT_ENABLED
+
     #ifdef GDBSTUB
     bool halt;
     bool is_interrupted;
     gdbstub_t gdbstub;
-
-    Node *root;
     #endif
 
-    // file handle for trace log
-    FILE *ft;
+    // trace log writer
+    rv_trace *ft;
+
+    // the trace events are logged to ft or retired
+    bool log;
+    srv32_retired *retired;
+    int32_t log_cycles;     // cycles of the block not committed yet
+
+    // flat profile and call graph, NULL if not generated
+    rv_profile   *prof;
+    rv_callgraph *graph;
+
+    // log of the host inputs, NULL if not recorded or replayed
+    rv_replay *rr;
+
+    // history of the reverse execution, NULL if not debugged
+    rv_reverse *rev;
+
+    // console output, NULL for stdout
+    FILE *fo;
+
+    // file name of the memory dump
+    char *dumpfile;
+
+    // file name of the CPI breakdown, NULL if not generated
+    char *statsfile;
+
+    // the loaded ELF file and its symbols, NULL if a checkpoint is
+    // restored without it
+    elf_file *elf;
+    bool loaded;            // a program is loaded or restored
 };
 
 int srv32_syscall(struct rv *rv, int func, int a0, int a1, int a2, int a3, int a4, int a5);
 void srv32_tohost(struct rv *rv, int32_t ptr);
 int srv32_fromhost(struct rv *rv);
 int srv32_step(struct rv *rv);
-int32_t srv32_read_regs(struct rv *rv, int n);
-void srv32_write_regs(struct rv *rv, int n, int32_t v);
 void *srv32_get_memptr(struct rv *rv, int32_t addr);
 bool srv32_write_mem(struct rv *rv, int32_t addr, int32_t len, void *ptr);
 bool srv32_read_mem(struct rv *rv, int32_t addr, int32_t len, void *ptr);
+void srv32_flush_icache(struct rv *rv, int32_t addr, int32_t len);
+void srv32_commit(struct rv *rv, rv_exec *ex, int upto);
+void srv32_sync(struct rv *rv);
+void srv32_clear_mem(struct rv *rv);
+void srv32_save_state(struct rv *rv, rv_state *s);
+void srv32_load_state(struct rv *rv, const rv_state *s);
+void srv32_roi(struct rv *rv);
+void srv32_retime(struct rv *rv, int32_t branch_penalty, bool branch_predict,
+                  bool singleram, int latency);
+
+bool srv32_profile_init(struct rv *rv, const char *file, uint32_t period);
+void srv32_profile_reset(struct rv *rv);
+void srv32_profile_sample(struct rv *rv, const rv_block *blk, long long start);
+bool srv32_profile_write(struct rv *rv);
+void srv32_profile_free(struct rv *rv);
+bool srv32_callgraph_init(struct rv *rv, const char *file);
+void srv32_callgraph_reset(struct rv *rv);
+void srv32_callgraph_trap(struct rv *rv, uint32_t kind);
+void srv32_callgraph_step(struct rv *rv, const rv_insn *ir);
+bool srv32_callgraph_write(struct rv *rv);
+void srv32_callgraph_free(struct rv *rv);
+bool srv32_stats_write(struct rv *rv);
+void srv32_watch_access(struct rv *rv, int32_t addr, int32_t len, int type);
+void srv32_breakpoint_free(struct rv *rv);
+bool srv32_reverse_init(struct rv *rv);
+void srv32_reverse_free(struct rv *rv);
+void srv32_reverse_record(struct rv *rv);
+void srv32_reverse_mem(struct rv *rv, int32_t addr, int32_t len);
+bool srv32_reverse_input(struct rv *rv, int kind, int32_t *result, void *data, int len);
+void srv32_reverse_save_input(struct rv *rv, int kind, int32_t result, const void *data, int len);
+long long srv32_reverse_oldest(struct rv *rv);
+bool srv32_reverse_goto(struct rv *rv, long long step);
+bool srv32_reverse_cont(struct rv *rv, bool (*stop)(struct rv *rv, void *arg), void *arg);
+bool srv32_replay_open(struct rv *rv, const char *file, bool record);
+bool srv32_replay_close(struct rv *rv);
+bool srv32_replay_input(struct rv *rv, int kind, int32_t *result, void *data, int len);
+void srv32_record_input(struct rv *rv, int kind, int32_t result, const void *data);
+
+#ifdef JIT_ENABLED
+bool srv32_jit_init(struct rv *rv);
+void srv32_jit_free(struct rv *rv);
+rv_jit_fn srv32_jit_compile(struct rv *rv, rv_block *blk);
+#endif // JIT_ENABLED
 
 #endif // __RVSIM_H__
 
@@ -0,0 +1,79 @@
+// Copyright © 2020 Kuoping Hsu
+// stats.c: CPI breakdown by the stall causes and the instruction classes
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rvsim.h"
+
+// Each instruction takes one cycle, the cycles more than one are counted
+// by the cause where they are added, so the cycles are instret plus the
+// stall cycles of all causes. The report is in JSON, the CPI of a cause is
+// its stall cycles per instruction, which add up to the CPI.
+
+static const char *stall_name[SRV32_STALL_MAX] = {
+    "branch", "jump", "trap", "interrupt", "mret", "singleram",
+    "fetch", "memory", "compressed", "wfi"
+};
+
+static const char *class_name[SRV32_CLASS_MAX] = {
+    "alu", "mul", "div", "bitmanip", "load", "store", "branch", "jal",
+    "jalr", "csr", "system", "fence", "illegal"
+};
+
+bool srv32_stats_write(struct rv *rv) {
+    srv32_cpi cpi;
+    double instret;
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(rv->statsfile, "w")) == NULL) {
+        printf("can not open file %s\n", rv->statsfile);
+        return false;
+    }
+
+    srv32_get_cpi(rv, &cpi);
+    instret = cpi.instret ? (double)cpi.instret : 1.0;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"cycles\": %lld,\n", cpi.cycle);
+    fprintf(fp, "  \"instret\": %lld,\n", cpi.instret);
+    fprintf(fp, "  \"cpi\": %.6f,\n", cpi.cycle / instret);
+    fprintf(fp, "  \"stalls\": {\n");
+    for(i = 0; i < SRV32_STALL_MAX; i++) {
+        fprintf(fp, "    \"%s\": {\"events\": %lld, \"cycles\": %lld, \"cpi\": %.6f}%s\n",
+                stall_name[i], cpi.events[i], cpi.cycles[i], cpi.cycles[i] / instret,
+                (i < SRV32_STALL_MAX - 1) ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"classes\": {\n");
+    for(i = 0; i < SRV32_CLASS_MAX; i++) {
+        fprintf(fp, "    \"%s\": %lld%s\n", class_name[i], cpi.iclass[i],
+                (i < SRV32_CLASS_MAX - 1) ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"compressed\": %lld,\n", cpi.compressed);
+    fprintf(fp, "  \"taken\": %lld,\n", cpi.taken);
+    fprintf(fp, "  \"flushes\": %lld\n", cpi.flushes);
+    fprintf(fp, "}\n");
+
+    return fclose(fp) == 0;
+}
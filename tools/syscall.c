@@ -33,8 +33,6 @@
 #include "opcode.h"
 #include "rvsim.h"
 
-void prog_exit(struct rv *rv, int exitcode);
-
 int srv32_syscall(
     struct rv *rv,
     int func, int a0, int a1, int a2,
@@ -51,18 +49,24 @@ int srv32_syscall(
 
     switch(func) {
        case SYS_OPEN:
-           res = (int)open((const char*)a0_ptr,
-                            O_RDWR | O_CREAT /* a1 */,
-                            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH /* a2 */ );
+           if (!srv32_replay_input(rv, func, &res, NULL, 0))
+               res = (int)open((const char*)a0_ptr,
+                                O_RDWR | O_CREAT /* a1 */,
+                                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH /* a2 */ );
+           srv32_record_input(rv, func, res, NULL);
            break;
        case SYS_CLOSE:
-           res = (int)close(a0);
+           if (!srv32_replay_input(rv, func, &res, NULL, 0))
+               res = (int)close(a0);
+           srv32_record_input(rv, func, res, NULL);
            break;
        case SYS_LSEEK:
-           res = (int)lseek(a0, a1, a2);
+           if (!srv32_replay_input(rv, func, &res, NULL, 0))
+               res = (int)lseek(a0, a1, a2);
+           srv32_record_input(rv, func, res, NULL);
            break;
        case SYS_EXIT:
-           prog_exit(rv, 0);
+           rv->exited = true;
            break;
        case SYS_READ:
            #if 0
@@ -75,8 +79,12 @@ int srv32_syscall(
                } while(++i<a2 && c != '\n');
            }
            #else
-           res = (int)read(a0, (void *)(a1_ptr), a2);
+           srv32_reverse_mem(rv, a1, a2);
+           if (!srv32_replay_input(rv, func, &res, a1_ptr, a2))
+               res = (int)read(a0, (void *)(a1_ptr), a2);
+           srv32_record_input(rv, func, res, a1_ptr);
            #endif
+           srv32_flush_icache(rv, a1, a2);
            break;
        case SYS_WRITE:
            #if 0
@@ -89,20 +97,31 @@ int srv32_syscall(
                fflush(stdout);
            }
            #else
-           res = (int)write(a0, (const char*)(a1_ptr), a2);
+           // the console output is also written by the replay, but not by
+           // the steps executed again by the debugger
+           if ((a0 == STDOUT || a0 == STDERR) && REV_REPLAY(rv))
+               res = a2;
+           else if (a0 == STDOUT && rv->fo)
+               res = (int)fwrite((const char*)(a1_ptr), 1, a2, rv->fo);
+           else if (a0 == STDOUT || a0 == STDERR ||
+                    !srv32_replay_input(rv, func, &res, NULL, 0)) {
+               res = (int)write(a0, (const char*)(a1_ptr), a2);
+               if (a0 != STDOUT && a0 != STDERR)
+                   srv32_record_input(rv, func, res, NULL);
+           }
            #endif
            break;
        case SYS_DUMP: {
                FILE *fp;
                int *start = (int*)srv32_get_memptr(rv, a0);
                int *end   = (int*)srv32_get_memptr(rv, a1);
-               if ((fp = fopen("dump.txt", "w")) == NULL) {
-                   printf("Create dump.txt fail\n");
-                   exit(1);
-               }
                if ((a0 & 3) != 0 || (a1 & 3) != 0) {
                    printf("Alignment error on memory dumping.\n");
-                   exit(1);
+                   break;
+               }
+               if ((fp = fopen(rv->dumpfile, "w")) == NULL) {
+                   printf("Create %s fail\n", rv->dumpfile);
+                   break;
                }
                while(start != end)
                    fprintf(fp, "%08x\n", *start++);
@@ -110,13 +129,17 @@ int srv32_syscall(
            }
            res = a1;
            break;
+       case SYS_ROI:
+           srv32_roi(rv);
+           res = 0;
+           break;
        case SYS_DUMP_BIN: {
                FILE *fp;
                char *start = (char*)srv32_get_memptr(rv, a0);
                char *end   = (char*)srv32_get_memptr(rv, a1);
                if ((fp = fopen("dump.bin", "wb")) == NULL) {
                    printf("Create dump.bin fail\n");
-                   exit(1);
+                   break;
                }
                while(start != end)
                    fprintf(fp, "%c", *start++);
@@ -0,0 +1,401 @@
+// Copyright © 2020 Kuoping Hsu
+// trace.c: binary execution trace and its streaming writer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+// print the cycle count at the beginning of each line
+#define PRINT_TIMELOG 1
+
+#define TEXT_LINE_MAX   80              // the longest line of the text log
+
+extern const char *regname[32];
+
+static const char hexdigit[] = "0123456789abcdef";
+
+static char *put_hex(char *p, uint32_t v) {
+    int i;
+    for(i = 7; i >= 0; i--) {
+        p[i] = hexdigit[v & 15];
+        v >>= 4;
+    }
+    return p + 8;
+}
+
+// "%10d "
+static char *put_cycle(char *p, int32_t v) {
+    char buf[12];
+    char *q = buf + sizeof(buf);
+    uint32_t u = v < 0 ? -(uint32_t)v : (uint32_t)v;
+    int n;
+
+    do {
+        *--q = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--q = '-';
+    n = (int)(buf + sizeof(buf) - q);
+    for(; n < 10; n++)
+        *p++ = ' ';
+    memcpy(p, q, buf + sizeof(buf) - q);
+    p += buf + sizeof(buf) - q;
+    *p++ = ' ';
+    return p;
+}
+
+// " x%02u (%s) <= 0x%08x\n"
+static char *put_reg(char *p, int rd, uint32_t val) {
+    const char *name = regname[rd & 31];
+    int n = (int)strlen(name);
+
+    *p++ = ' ';
+    *p++ = 'x';
+    *p++ = '0' + (rd & 31) / 10;
+    *p++ = '0' + (rd & 31) % 10;
+    *p++ = ' ';
+    *p++ = '(';
+    memcpy(p, name, n);
+    p += n;
+    memcpy(p, ") <= 0x", 7);
+    p = put_hex(p + 7, val);
+    *p++ = '\n';
+    return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end,
+                                 uint32_t *v) {
+    uint32_t r = 0;
+    int shift;
+
+    for(shift = 0; p < end && shift < 35; shift += 7) {
+        r |= (uint32_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *v = r;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#define UNZIGZAG(v)     (((v) >> 1) ^ -((v) & 1))
+
+#define GET(v) \
+    if ((p = get_varint(p, end, &(v))) == NULL) goto fail
+
+#define GET_BYTE(v) \
+    if (p >= end) goto fail; \
+    (v) = *p++
+
+int trace_format(trace_state *s, const uint8_t **buf, const uint8_t *end,
+                 char *out, int len) {
+    const uint8_t *p = *buf;
+    char *q = out;
+    uint32_t v, rd, val;
+    int tag, idx;
+
+    while (p < end && q - out <= len - TEXT_LINE_MAX) {
+        tag = *p++;
+        switch(tag & TRACE_KIND) {
+            case TRACE_PC:
+                GET(v);
+                s->cycle += v;
+                GET(v);
+                s->pc += UNZIGZAG(v);
+                idx = TRACE_ITABLE(s->pc);
+                if (tag & TRACE_F_INST) {
+                    GET(s->itable_inst[idx]);
+                    s->itable_pc[idx] = s->pc;
+                }
+                if (PRINT_TIMELOG)
+                    q = put_cycle(q, (int32_t)s->cycle);
+                q = put_hex(q, s->pc);
+                *q++ = ' ';
+                q = put_hex(q, s->itable_inst[idx]);
+                if (tag & TRACE_F_RD) {
+                    GET_BYTE(rd);
+                    GET(val);
+                    q = put_reg(q, rd, val);
+                }
+                if (tag & TRACE_F_NL)
+                    *q++ = '\n';
+                s->pc += (s->itable_inst[idx] & 3) == 3 ? 4 : 2;
+                break;
+            case TRACE_REG:
+                GET_BYTE(rd);
+                GET(val);
+                q = put_reg(q, rd, val);
+                break;
+            case TRACE_READ:
+                GET(v);
+                s->addr += UNZIGZAG(v);
+                GET_BYTE(rd);
+                GET(val);
+                memcpy(q, " read 0x", 8);
+                q = put_hex(q + 8, s->addr);
+                *q++ = ',';
+                q = put_reg(q, rd, val);
+                break;
+            case TRACE_WRITE:
+                GET(v);
+                s->addr += UNZIGZAG(v);
+                GET(val);
+                memcpy(q, " write 0x", 9);
+                q = put_hex(q + 9, s->addr);
+                memcpy(q, " <= 0x", 6);
+                q = put_hex(q + 6, val);
+                *q++ = '\n';
+                break;
+            case TRACE_NL:
+                *q++ = '\n';
+                break;
+            default:
+                goto fail;
+        }
+    }
+    *buf = p;
+    return (int)(q - out);
+
+fail:
+    // LCOV_EXCL_START
+    return -1;
+    // LCOV_EXCL_STOP
+}
+
+bool trace_decode(trace_state *s, const uint8_t *buf, size_t len, FILE *fp) {
+    const uint8_t *end = buf + len;
+    char out[TRACE_BLOCK_SIZE];
+    int n;
+
+    while (buf < end) {
+        if ((n = trace_format(s, &buf, end, out, sizeof(out))) < 0)
+            return false;
+        fwrite(out, 1, n, fp);
+    }
+    return true;
+}
+
+void trace_reset(trace_state *s) {
+    memset(s, 0, sizeof(trace_state));
+    // no instruction is at pc 0xffffffff, so the table starts empty
+    memset(s->itable_pc, 0xff, sizeof(s->itable_pc));
+}
+
+static void trace_sleep(void) {
+    struct timespec ts = {0, 100000};
+    nanosleep(&ts, NULL);
+}
+
+// encode n events into the records at buf, returns the length
+static int trace_encode(trace_state *s, const trace_event *e, int n,
+                        uint8_t *buf) {
+    uint8_t *p = buf;
+    int i;
+
+    for(i = 0; i < n; i++, e++) {
+        uint8_t *tag = p++;
+        int flags = e->kind & ~TRACE_KIND;
+        int idx;
+
+        switch(e->kind & TRACE_KIND) {
+            case TRACE_PC:
+                idx = TRACE_ITABLE(e->addr);
+                p = trace_varint(p, e->cycle - s->cycle);
+                p = trace_varint(p, TRACE_ZIGZAG(e->addr - s->pc));
+                if (s->itable_pc[idx] != e->addr ||
+                    s->itable_inst[idx] != e->inst) {
+                    s->itable_pc[idx] = e->addr;
+                    s->itable_inst[idx] = e->inst;
+                    p = trace_varint(p, e->inst);
+                    flags |= TRACE_F_INST;
+                }
+                if (flags & TRACE_F_RD) {
+                    *p++ = e->rd;
+                    p = trace_varint(p, e->val);
+                }
+                s->cycle = e->cycle;
+                s->pc = e->addr + ((e->inst & 3) == 3 ? 4 : 2);
+                break;
+            case TRACE_REG:
+                *p++ = e->rd;
+                p = trace_varint(p, e->val);
+                break;
+            case TRACE_READ:
+            case TRACE_WRITE:
+                p = trace_varint(p, TRACE_ZIGZAG(e->addr - s->addr));
+                if ((e->kind & TRACE_KIND) == TRACE_READ)
+                    *p++ = e->rd;
+                p = trace_varint(p, e->val);
+                s->addr = e->addr;
+                break;
+        }
+        *tag = (uint8_t)((e->kind & TRACE_KIND) | flags);
+    }
+    return (int)(p - buf);
+}
+
+static void *trace_writer(void *arg) {
+    rv_trace *t = (rv_trace*)arg;
+
+    for(;;) {
+        uint64_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+
+        if (t->tail == head) {
+            if (__atomic_load_n(&t->done, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&t->head, __ATOMIC_ACQUIRE) == t->tail)
+                break;
+            trace_sleep();
+            continue;
+        }
+
+        while (t->tail != head) {
+            int n = (int)(t->tail & (TRACE_BLOCKS - 1));
+            const trace_event *block = t->blocks + (size_t)n * TRACE_BLOCK_EVENTS;
+            int len = trace_encode(&t->enc, block, t->len[n], t->buf);
+
+            if (t->binary) {
+                if (fwrite(t->buf, 1, len, t->fp) != (size_t)len)
+                    t->error = true;
+            } else if (!trace_decode(&t->dec, t->buf, len, t->fp)) {
+                t->error = true;
+            }
+            __atomic_store_n(&t->tail, t->tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+void trace_commit(rv_trace *t) {
+    int n = (int)(t->head & (TRACE_BLOCKS - 1));
+
+    t->len[n] = (int32_t)(t->ptr - (t->blocks + (size_t)n * TRACE_BLOCK_EVENTS));
+    __atomic_store_n(&t->head, t->head + 1, __ATOMIC_RELEASE);
+
+    // wait for the writer when the ring is full
+    while (t->head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) >= TRACE_BLOCKS)
+        sched_yield();
+
+    n = (int)(t->head & (TRACE_BLOCKS - 1));
+    t->ptr = t->blocks + (size_t)n * TRACE_BLOCK_EVENTS;
+    t->end = t->ptr + TRACE_BLOCK_EVENTS;
+}
+
+rv_trace *trace_open(const char *file, bool binary) {
+    rv_trace *t;
+
+    if ((t = (rv_trace*)calloc(1, sizeof(rv_trace))) == NULL) {
+        // LCOV_EXCL_START
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+
+    if ((t->blocks = (trace_event*)malloc((size_t)TRACE_BLOCKS * TRACE_BLOCK_EVENTS *
+                                          sizeof(trace_event))) == NULL ||
+        (t->buf = (uint8_t*)malloc(TRACE_BLOCK_EVENTS * TRACE_RECORD_MAX)) == NULL ||
+        (t->fp = fopen(file, binary ? "wb" : "w")) == NULL) {
+        free(t->blocks);
+        free(t->buf);
+        free(t);
+        return NULL;
+    }
+
+    trace_reset(&t->enc);
+    trace_reset(&t->dec);
+
+    t->binary = binary;
+    t->ptr = t->blocks;
+    t->end = t->blocks + TRACE_BLOCK_EVENTS;
+
+    if (binary) {
+        fwrite(TRACE_MAGIC, 1, 8, t->fp);
+        fputc(TRACE_VERSION, t->fp);
+    }
+
+    if (pthread_create(&t->thread, NULL, trace_writer, t) != 0) {
+        // LCOV_EXCL_START
+        fclose(t->fp);
+        free(t->blocks);
+        free(t->buf);
+        free(t);
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+    return t;
+}
+
+bool trace_close(rv_trace *t) {
+    bool ok;
+
+    if (!t)
+        return true;
+
+    trace_commit(t);
+    __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+    pthread_join(t->thread, NULL);
+
+    ok = (fclose(t->fp) == 0) && !t->error;
+    free(t->blocks);
+    free(t->buf);
+    free(t);
+    return ok;
+}
+
+int trace_convert(const char *file, FILE *fp) {
+    trace_state *s;
+    struct stat st;
+    uint8_t *buf;
+    int fd;
+    int result = 1;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        printf("can not open file %s\n", file);
+        return 1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < 9 ||
+        (buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        printf("%s is not a trace file\n", file);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    if (memcmp(buf, TRACE_MAGIC, 8) != 0 || buf[8] != TRACE_VERSION) {
+        printf("%s is not a trace file\n", file);
+    } else if ((s = (trace_state*)malloc(sizeof(trace_state))) != NULL) {
+        trace_reset(s);
+        if (trace_decode(s, buf + 9, st.st_size - 9, fp))
+            result = 0;
+        else
+            printf("%s: malformed trace record\n", file);
+        free(s);
+    }
+    munmap(buf, st.st_size);
+    return result;
+}
@@ -0,0 +1,189 @@
+// Copyright © 2020 Kuoping Hsu
+// trace.h: binary execution trace and its streaming writer
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// The simulator stores the trace events as they are into the blocks of a
+// single-producer single-consumer ring. A writer thread drains the ring and
+// encodes the events into records of a few bytes, then either stores the
+// records (the binary trace) or formats them into the text log, so the
+// simulation does not wait for the encoding, fprintf or the disk.
+//
+// Each record starts with a tag byte, the numbers are LEB128 varints.
+//
+//     TRACE_PC     cycle delta, zigzag pc delta, [inst], [rd, value]
+//     TRACE_REG    rd, value
+//     TRACE_READ   zigzag address delta, rd, value
+//     TRACE_WRITE  zigzag address delta, value
+//     TRACE_NL
+//
+// The pc is relative to the end of the previous instruction and the
+// instruction word is only stored when it misses the instruction table,
+// which both the encoder and the decoder keep in the same way.
+
+#define TRACE_MAGIC         "SRV32TRC"
+#define TRACE_VERSION       1
+
+#define TRACE_PC            0
+#define TRACE_REG           1
+#define TRACE_READ          2
+#define TRACE_WRITE         3
+#define TRACE_NL            4
+#define TRACE_KIND          7       // mask of the record kind
+#define TRACE_F_NL          (1<<3)  // TRACE_PC: the line ends
+#define TRACE_F_INST        (1<<4)  // TRACE_PC: the instruction word follows
+#define TRACE_F_RD          (1<<5)  // TRACE_PC: a register write follows
+
+#define TRACE_BLOCK_SIZE    (64*1024)
+#define TRACE_BLOCK_EVENTS  4096    // events of a ring block
+#define TRACE_BLOCKS        64      // must be a power of 2
+#define TRACE_RECORD_MAX    32      // the largest record is 22 bytes
+#define TRACE_ITABLE_BITS   12
+#define TRACE_ITABLE_SIZE   (1 << TRACE_ITABLE_BITS)
+#define TRACE_ITABLE(pc)    (((pc) >> 1) & (TRACE_ITABLE_SIZE - 1))
+
+// state shared by the encoder and the decoder
+typedef struct trace_state {
+    uint32_t cycle;
+    uint32_t pc;                    // expected pc of the next instruction
+    uint32_t addr;                  // last memory address
+    uint32_t itable_pc[TRACE_ITABLE_SIZE];
+    uint32_t itable_inst[TRACE_ITABLE_SIZE];
+} trace_state;
+
+// an event of the ring, encoded into a record by the writer thread
+typedef struct trace_event {
+    uint8_t     kind;               // record kind and the TRACE_F_* flags
+    uint8_t     rd;
+    uint32_t    cycle;
+    uint32_t    addr;               // pc of TRACE_PC, or the memory address
+    uint32_t    inst;
+    uint32_t    val;
+} trace_event;
+
+typedef struct rv_trace {
+    // producer, only touched by the simulator thread
+    trace_event *ptr;               // current position in the block
+    trace_event *end;
+    uint64_t    head;               // number of the committed blocks
+
+    // consumer, only touched by the writer thread
+    uint64_t    tail;               // number of the drained blocks
+    trace_state enc;
+    trace_state dec;
+    uint8_t    *buf;                // records of the block being drained
+
+    trace_event *blocks;
+    int32_t     len[TRACE_BLOCKS];
+    FILE       *fp;
+    bool        binary;
+    bool        done;
+    bool        error;
+    pthread_t   thread;
+} rv_trace;
+
+// clear the state before the first record
+void trace_reset(trace_state *s);
+
+// Open the trace log and start the writer thread. The file is the binary
+// trace if binary is true, otherwise the text log. Returns NULL on failure.
+rv_trace *trace_open(const char *file, bool binary);
+
+// Drain the ring, stop the writer thread and close the file. Returns
+// false if the writer failed.
+bool trace_close(rv_trace *t);
+
+// commit the current block and move to the next one
+void trace_commit(rv_trace *t);
+
+// Format the records from *buf into the text log until the end or the
+// out buffer of len bytes is nearly full. *buf is moved to the first
+// record not formatted. Returns the length of the text, -1 on a malformed
+// record.
+int trace_format(trace_state *s, const uint8_t **buf, const uint8_t *end,
+                 char *out, int len);
+
+// Decode len bytes of records and append the text log to fp.
+// Returns false on a malformed record.
+bool trace_decode(trace_state *s, const uint8_t *buf, size_t len, FILE *fp);
+
+// Convert the binary trace file to the text log. Returns 0 on success.
+int trace_convert(const char *file, FILE *fp);
+
+static inline uint8_t *trace_varint(uint8_t *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+#define TRACE_ZIGZAG(v)     (((uint32_t)(v) << 1) ^ (uint32_t)((int32_t)(v) >> 31))
+
+static inline trace_event *trace_reserve(rv_trace *t) {
+    if (t->ptr == t->end)
+        trace_commit(t);
+    return t->ptr++;
+}
+
+// the pc and the instruction, optionally followed by a register write
+static inline void trace_pc(rv_trace *t, uint32_t cycle, uint32_t pc,
+                            uint32_t inst, int flags, int rd, uint32_t val) {
+    trace_event *e = trace_reserve(t);
+
+    e->kind  = (uint8_t)(TRACE_PC | flags);
+    e->rd    = (uint8_t)rd;
+    e->cycle = cycle;
+    e->addr  = pc;
+    e->inst  = inst;
+    e->val   = val;
+}
+
+static inline void trace_reg(rv_trace *t, int rd, uint32_t val) {
+    trace_event *e = trace_reserve(t);
+
+    e->kind = TRACE_REG;
+    e->rd   = (uint8_t)rd;
+    e->val  = val;
+}
+
+static inline void trace_mem(rv_trace *t, int kind, uint32_t addr,
+                             int rd, uint32_t val) {
+    trace_event *e = trace_reserve(t);
+
+    e->kind = (uint8_t)kind;
+    e->rd   = (uint8_t)rd;
+    e->addr = addr;
+    e->val  = val;
+}
+
+static inline void trace_newline(rv_trace *t) {
+    trace_reserve(t)->kind = TRACE_NL;
+}
+
+#endif // __TRACE_H